@@ -0,0 +1,77 @@
+/*
+ -------------------------------------------------------------------------------
+ BatchKernels.h
+ Robot Library Project
+
+ DESCRIPTION:
+ Per-joint kernels behind KinematicModel::forwardKinematicsBatch(). Each
+ kernel right-multiplies every pose of a POSE_BATCH by one joint transform,
+ processing 4 (AVX2) or 8 (AVX-512) samples per instruction when the CPU
+ supports it. The instruction set is picked at runtime, so one binary runs
+ on every x86-64 machine; other architectures use the scalar kernels.
+
+ The pose buffer is the raw data of a POSE_BATCH: element r of sample s is
+ at T[r*n + s]. Rotations (a) are 3x3 column-major.
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _BatchKernels_h_
+#define _BatchKernels_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include <cstddef>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    typedef enum {
+
+        BATCH_SCALAR = 0,
+        BATCH_AVX2,
+        BATCH_AVX512,
+
+        BATCH_INSTRUCTION_SET_SIZE
+
+    } BatchInstructionSet;
+
+    const char* batchInstructionSetName(BatchInstructionSet instructionSet);
+
+    struct BatchKernelSet {
+        BatchInstructionSet instructionSet;
+
+        // T <- T * [a b]
+        void (*constant)(double* T, size_t n, const double* a, const double* b);
+        // T <- T * Rot(axis, q) given cos(q) and sin(q) for every sample
+        void (*revolute)(double* T, size_t n, const double* axis, const double* c, const double* s);
+        // Same as revolute for a coordinate axis (0, 1 or 2) scaled by sign
+        // (+1 or -1). Only the two columns the rotation mixes are touched.
+        void (*revoluteCoordinate)(double* T, size_t n, int axis, double sign, const double* c, const double* s);
+        // T <- T * Trans(axis*q)
+        void (*prismatic)(double* T, size_t n, const double* axis, const double* q);
+    };
+
+    // Best kernels for this CPU
+    const BatchKernelSet& batchKernels();
+
+    // Kernels for a specific instruction set, or NULL if this CPU lacks it
+    const BatchKernelSet* batchKernels(BatchInstructionSet instructionSet);
+
+} // namespace RobotKin
+
+#endif
+
+
@@ -0,0 +1,135 @@
+/*
+ -------------------------------------------------------------------------------
+ BoxQP.h
+ Robot Library Project
+
+ CLASS NAME:
+ BoxQP
+
+ DESCRIPTION:
+ Small dense quadratic program with simple bounds,
+
+     minimize    1/2 x^T H x + g^T x
+     subject to  lower <= x <= upper
+
+ for a symmetric positive definite H, solved with a primal active set
+ method. Every variable is either free or held at one of its bounds. Each
+ iteration solves for the free variables with the others held, then either
+ stops at the first bound in the way or releases the held variable whose
+ multiplier has the wrong sign.
+
+ The active set of the last solve is kept and used as the starting guess of
+ the next one, so a sequence of similar problems (the steps of an iterative
+ IK solver, for instance) usually takes one or two iterations each.
+
+ FILES:
+ BoxQP.h
+ BoxQP.cpp
+
+ DEPENDENCIES:
+ Frame
+
+ CONSTRUCTORS:
+ BoxQP();
+ BoxQP(size_t nVariables);
+
+ PROPERTIES:
+ maxIterations - limit on active set changes per solve (default 100).
+
+ bounds_ - -1, 0 or 1 per variable for held at lower, free and held at
+ upper. This is the warm start.
+
+ METHODS:
+ rk_result_t solve(const Eigen::MatrixXd& H, const Eigen::VectorXd& g,
+                   const Eigen::VectorXd& lower, const Eigen::VectorXd& upper,
+                   Eigen::VectorXd& x);
+ Writes the minimizer to x. Returns RK_SOLVED, RK_DIVERGED if it ran out
+ of iterations (x is then feasible but not optimal), or RK_NO_SOLUTION if
+ the bounds cross or H is not positive definite.
+
+ void reset();
+ Forgets the active set, so the next solve starts with every variable free.
+
+ NOTES:
+ All storage is sized by resize(), so solve() does not allocate for
+ problems of that size.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _BoxQP_h_
+#define _BoxQP_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Frame.h"
+#include <vector>
+#include <eigen3/Eigen/Core>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class BoxQP
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // BoxQP Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        BoxQP();
+        BoxQP(size_t nVariables);
+
+        // Destructor
+        virtual ~BoxQP();
+
+        //--------------------------------------------------------------------------
+        // BoxQP Public Member Functions
+        //--------------------------------------------------------------------------
+        void resize(size_t nVariables);
+        size_t size() const;
+        void reset();
+
+        rk_result_t solve(const Eigen::MatrixXd& H, const Eigen::VectorXd& g,
+                          const Eigen::VectorXd& lower, const Eigen::VectorXd& upper,
+                          Eigen::VectorXd& x);
+
+        int bound(size_t variable) const; // -1 lower, 0 free, 1 upper
+        size_t nActive() const;
+        size_t iterations() const; // Of the last solve
+
+        //--------------------------------------------------------------------------
+        // BoxQP Public Member Variables
+        //--------------------------------------------------------------------------
+        size_t maxIterations;
+
+    protected:
+        //--------------------------------------------------------------------------
+        // BoxQP Protected Member Variables
+        //--------------------------------------------------------------------------
+        std::vector<int> bounds_;
+        std::vector<size_t> free_;
+        Eigen::MatrixXd reduced_; // H over the free variables, factored in place
+        Eigen::VectorXd solution_; // Of the reduced system
+        Eigen::VectorXd gradient_;
+        size_t iterations_;
+
+    }; // class BoxQP
+
+} // namespace RobotKin
+
+#endif
+
+
@@ -16,6 +16,19 @@ namespace RobotKin {
         bool performNullSpaceTask;
         virtual Eigen::VectorXd nullSpaceTask(Robot& robot, const std::vector<size_t>& indices,
                                               const Eigen::VectorXd& values, Eigen::VectorXd& nullTask);
+        // What the solvers that take an IKWorkspace call, and the one to
+        // override. By default it forwards to the version above, whose
+        // returned copy of nullTask allocates once per iteration. Overriding
+        // this one instead keeps the null space task off the heap.
+        virtual void nullSpaceTask(Robot& robot, const std::vector<size_t>& indices,
+                                   const Eigen::VectorXd& values, Eigen::VectorXd& nullTask,
+                                   const IKWorkspace& workspace);
+        // The KinematicModel and ParallelIK solvers call this and the other
+        // KinematicModel overloads below. They never reach the Robot
+        // overloads, so a subclass has to override both to customize both.
+        virtual void nullSpaceTask(const KinematicModel& model, const KinematicState& state,
+                                   const std::vector<size_t>& indices, const Eigen::VectorXd& values,
+                                   Eigen::VectorXd& nullTask) const;
         void restingValues(Eigen::VectorXd newRestingValues);
         Eigen::VectorXd& restingValues();
 
@@ -29,6 +42,10 @@ namespace RobotKin {
 
         bool customErrorClamp;
         virtual void errorClamp(Robot& robot, const std::vector<size_t>& indices, SCREW& error);
+        // Does nothing. With customErrorClamp set, the KinematicModel solvers
+        // only clamp if a subclass overrides this one too.
+        virtual void errorClamp(const KinematicModel& model, const KinematicState& state,
+                                const std::vector<size_t>& indices, SCREW& error) const;
 
         int maxIterations;
         double dampingConstant;
@@ -39,16 +56,33 @@ namespace RobotKin {
         bool useIterativeJacobianSeed;
         virtual void iterativeJacobianSeed(Robot &robot, size_t attemptNumber,
                                            const std::vector<size_t>& indices, Eigen::VectorXd& values);
+        // Lifts the limits on state instead of on a Robot, and leaves the
+        // constraints untouched so one instance can be shared across threads.
+        // Random seeds are drawn from state.random, one value per joint.
+        virtual void iterativeJacobianSeed(const KinematicModel& model, KinematicState& state,
+                                           size_t attemptNumber, const std::vector<size_t>& indices,
+                                           Eigen::VectorXd& values) const;
         size_t maxAttempts;
 
         bool wrapToJointLimits;
         bool wrapSolutionToJointLimits;
 
+        // Time between iterations of Robot::boxConstrainedIK_chain(). When
+        // positive, no joint moves more than its maxVelocity() times this
+        // in one iteration.
+        double timeStep;
+
+        // The *_linkage solvers first try the closed-form solver registered
+        // on the linkage, if it has one
+        bool useAnalyticalIK;
+
         // Allow the user to call some default constraints
         static Constraints& Defaults();
 
     protected:
 
+        void restingValuesTask(const Eigen::VectorXd& values, Eigen::VectorXd& nullTask) const;
+
         Eigen::VectorXd restingValues_;
         bool hasRestingValues;
 
@@ -60,6 +60,7 @@
 #include <iostream>
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Geometry>
+#include <eigen3/Eigen/StdVector>
 
 
 //------------------------------------------------------------------------------
@@ -78,12 +79,25 @@ namespace RobotKin {
 
     typedef Eigen::Matrix<double, 6, 1> SCREW;
     typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+
+    typedef std::vector<TRANSFORM, Eigen::aligned_allocator<TRANSFORM> > TRANSFORM_VECTOR;
+    typedef std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > MATRIX6_VECTOR;
+
+    // Many poses stored one sample per column. Rows 0-8 hold the rotation in
+    // column-major order and rows 9-11 the translation, so every element of
+    // every sample is contiguous across samples.
+    typedef Eigen::Matrix<double, 12, Eigen::Dynamic, Eigen::RowMajor> POSE_BATCH;
     
     class Robot;
     class Linkage;
     class Joint;
     class Tool;
+    class Link;
     class Constraints;
+    class KinematicModel;
+    class KinematicState;
+    class IKWorkspace;
+    class WholeBodyJacobian;
     
     //------------------------------------------------------------------------------
     // Typedefs
@@ -167,14 +181,39 @@ namespace RobotKin {
     std::string JointType_to_string(JointType type);
 
 
+    // Joint axes along a coordinate axis only touch two columns of the
+    // rotation (or one column of the translation), so they get their own path
+    typedef enum {
+        AXIS_ARBITRARY = 0,
+        AXIS_X,
+        AXIS_Y,
+        AXIS_Z,
+        AXIS_NEGATIVE_X,
+        AXIS_NEGATIVE_Y,
+        AXIS_NEGATIVE_Z,
+
+        AXIS_TYPE_SIZE
+    } AxisType;
+
+    std::string AxisType_to_string(AxisType type);
+    AxisType classifyAxis(const AXIS& axis); // axis must be normalized
+    int axisIndex(AxisType type);     // 0, 1 or 2 for a coordinate axis, -1 otherwise
+    double axisSign(AxisType type);   // -1 for the negative coordinate axes, 1 otherwise
+
+    // result = respectToFixed * (rotation or translation of value about axis)
+    void jointTransform(TRANSFORM& result, const TRANSFORM& respectToFixed, JointType jointType,
+                        AxisType axisType, const AXIS& axis, double value);
+
+
     void clampMag(Eigen::VectorXd& v, double clamp);
     void clampMag(SCREW& v, double clamp);
     void clampMag(TRANSLATION& v, double clamp);
-    void clampMaxAbs(Eigen::VectorXd& v, double clamp);
+    void clampMaxAbs(Eigen::Ref<Eigen::VectorXd> v, double clamp);
     double minimum(double a, double b);
     double mod(double x, double y);
     double wrapToPi(double angle);
     void wrapToJointLimits(Robot& robot, const std::vector<size_t>& jointIndices, Eigen::VectorXd& jointValues);
+    void wrapToJointLimits(const KinematicModel& model, const std::vector<size_t>& jointIndices, Eigen::VectorXd& jointValues);
     
     class Frame
     {
@@ -184,6 +223,7 @@ namespace RobotKin {
         //--------------------------------------------------------------------------
         friend class Linkage;
         friend class Robot;
+        friend class Link;
         
     public:
         //--------------------------------------------------------------------------
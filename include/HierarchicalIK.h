@@ -0,0 +1,196 @@
+/*
+ -------------------------------------------------------------------------------
+ HierarchicalIK.h
+ Robot Library Project
+
+ CLASS NAME:
+ HierarchicalIK
+
+ DESCRIPTION:
+ Whole body inverse kinematics over a strict stack of prioritized tasks,
+ for instance feet fixed, then center of mass over the support, then
+ hands, then a resting posture. Each task only moves the robot within the
+ null space of every task above it, using the recursive projector
+
+     N_k = N_(k-1) - (J_k N_(k-1))^+ (J_k N_(k-1))
+
+ so lower priority tasks can never disturb higher ones.
+
+ FILES:
+ HierarchicalIK.h
+ HierarchicalIK.cpp
+
+ DEPENDENCIES:
+ Robot
+ WholeBodyJacobian
+ Constraints
+
+ CONSTRUCTORS:
+ HierarchicalIK(Robot& robot);
+
+ PROPERTIES:
+ jacobian_ - WholeBodyJacobian holding one block per linkage tool and one
+ for the center of mass. Tasks on the same tool share its block, and all
+ blocks are refilled together once per step.
+
+ nullSpace_ - projector onto the null space of the tasks handled so far.
+
+ METHODS:
+ rk_result_t addPoseTask(std::string linkageName, const TRANSFORM& target);
+ rk_result_t addPositionTask(std::string linkageName, const TRANSLATION& target);
+ rk_result_t addOrientationTask(std::string linkageName, const Eigen::Matrix3d& target);
+ rk_result_t addCenterOfMassTask(const TRANSLATION& target, bool horizontalOnly=false);
+ rk_result_t addPostureTask(const Eigen::VectorXd& target);
+ Appends a task below all the tasks added before it. Frame tasks follow
+ the tool of the named linkage, in robot coordinates. horizontalOnly keeps
+ only the x and y rows of the center of mass. Posture tasks pull the joints
+ towards target, over every joint or over jointIndices.
+
+ rk_result_t step(Eigen::VectorXd& jointValues, Constraints& constraints);
+ Takes one step of the whole stack from jointValues (one value per joint
+ of the robot) and writes the result to the robot. Meant to be called
+ once per control cycle.
+
+ rk_result_t solve(Eigen::VectorXd& jointValues, Constraints& constraints);
+ Steps until the robot stops moving (or only flips back and forth across a
+ singular configuration) or constraints.maxIterations is used up. Returns RK_SOLVED if every task other than the posture tasks is
+ within constraints.convergenceTolerance, RK_CONVERGED if the robot
+ settled without meeting all of them (the best compromise the priorities
+ allow), and RK_DIVERGED otherwise.
+
+ NOTES:
+ Each level uses a damped pseudoinverse (constraints.dampingConstant) for
+ its step, but an almost undamped one for its projector, so the damping
+ does not leak lower priority motion into higher priority tasks.
+
+ All storage is sized when tasks are added, so step() and solve() do not
+ allocate.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _HierarchicalIK_h_
+#define _HierarchicalIK_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Frame.h"
+#include "WholeBodyJacobian.h"
+#include "Constraints.h"
+#include <vector>
+#include <string>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Cholesky>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class HierarchicalIK
+    {
+    public:
+        typedef enum {
+            POSE_TASK = 0,
+            POSITION_TASK,
+            ORIENTATION_TASK,
+            CENTER_OF_MASS_TASK,
+            POSTURE_TASK
+        } TaskType;
+
+        //--------------------------------------------------------------------------
+        // HierarchicalIK Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        HierarchicalIK(Robot& robot);
+
+        // Destructor
+        virtual ~HierarchicalIK();
+
+        //--------------------------------------------------------------------------
+        // HierarchicalIK Public Member Functions
+        //--------------------------------------------------------------------------
+        // Tasks in order of priority, highest first
+        rk_result_t addPoseTask(std::string linkageName, const TRANSFORM& target);
+        rk_result_t addPositionTask(std::string linkageName, const TRANSLATION& target);
+        rk_result_t addOrientationTask(std::string linkageName, const Eigen::Matrix3d& target);
+        rk_result_t addCenterOfMassTask(const TRANSLATION& target, bool horizontalOnly=false);
+        rk_result_t addPostureTask(const Eigen::VectorXd& target);
+        rk_result_t addPostureTask(const std::vector<size_t>& jointIndices, const Eigen::VectorXd& target);
+        void clear();
+
+        // Pose, position and orientation tasks take the parts of a TRANSFORM
+        // they use. Center of mass tasks take a TRANSLATION.
+        void target(size_t task, const TRANSFORM& newTarget);
+        void target(size_t task, const TRANSLATION& newTarget);
+        void target(size_t task, const Eigen::VectorXd& newTarget);
+
+        size_t nTasks() const;
+        TaskType taskType(size_t task) const;
+        double taskError(size_t task) const; // Before the last step, unclamped
+
+        rk_result_t step(Eigen::VectorXd& jointValues,
+                         RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+        rk_result_t solve(Eigen::VectorXd& jointValues,
+                          RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+
+    protected:
+        //--------------------------------------------------------------------------
+        // HierarchicalIK Protected Member Functions
+        //--------------------------------------------------------------------------
+        rk_result_t addFrameTask(TaskType type, const std::string& linkageName, const TRANSFORM& target);
+        void addTask(TaskType type, int block, size_t firstRow, size_t nRows);
+        void computeErrors(RobotKin::Constraints& constraints);
+        bool tasksMet(double tolerance) const;
+
+        //--------------------------------------------------------------------------
+        // HierarchicalIK Protected Member Variables
+        //--------------------------------------------------------------------------
+        Robot& robot_;
+        WholeBodyJacobian jacobian_;
+        std::vector<int> linkageBlocks_; // Block of each linkage tool, -1 if none
+        int centerOfMassBlock_;
+
+        // Tasks. Frame and center of mass tasks use rows firstRows_ to
+        // firstRows_ + nRows of a block of jacobian_, posture tasks their
+        // joints of the identity.
+        std::vector<TaskType> types_;
+        std::vector<int> blocks_;
+        std::vector<size_t> firstRows_;
+        std::vector<size_t> linkages_;
+        TRANSFORM_VECTOR targets_; // Frame targets, or the center of mass in the translation
+        std::vector<std::vector<size_t> > postureJoints_;
+        std::vector<Eigen::VectorXd> postureTargets_;
+
+        // Per task scratch: error, J N, (J N)(J N)^T and its factor
+        std::vector<Eigen::VectorXd> errors_;
+        std::vector<double> errorNorms_;
+        std::vector<double> lastErrorNorms_; // One and two steps back, for solve()
+        std::vector<double> olderErrorNorms_;
+        std::vector<Eigen::MatrixXd> projected_;
+        std::vector<Eigen::MatrixXd> projectedInverse_;
+        std::vector<Eigen::MatrixXd> gram_;
+        std::vector<Eigen::LLT<Eigen::MatrixXd> > factors_;
+
+        Eigen::MatrixXd nullSpace_;
+        Eigen::VectorXd delta_;
+        std::vector<size_t> allJoints_;
+
+    }; // class HierarchicalIK
+
+} // namespace RobotKin
+
+#endif
+
+
@@ -0,0 +1,151 @@
+/*
+ -------------------------------------------------------------------------------
+ IKWorkspace.h
+ Robot Library Project
+
+ CLASS NAME:
+ IKWorkspace
+
+ DESCRIPTION:
+ Scratch storage for the iterative IK solvers. A workspace is sized once for
+ a chain length and then handed to every solve on chains of that length, so
+ the solver itself never touches the heap. Each thread should own its own
+ workspace.
+
+ FILES:
+ IKWorkspace.h
+ IKWorkspace.cpp
+
+ DEPENDENCIES:
+ Frame
+ BoxQP
+
+ CONSTRUCTORS:
+ IKWorkspace();
+ IKWorkspace(size_t nJoints);
+
+ PROPERTIES:
+ J, Jinv - chain Jacobian (6 x n) and its damped pseudoinverse (n x 6).
+
+ JJt, dampedInverse - J*J^T and (J*J^T + damping^2*I)^-1.
+
+ delta, nullErr, deltaNull - joint steps of the primary and null space tasks.
+
+ dampedErr, predictedErr, trialErr - error terms of a Levenberg-Marquardt
+ step.
+
+ damping, iterations - final damping and iteration count of the last
+ Levenberg-Marquardt solve.
+
+ H, gradient, lower, upper, qp - step problem of Robot::boxConstrainedIK_chain()
+ and its solver, which keeps its active set from one step to the next.
+
+ METHODS:
+ void resize(size_t nJoints);
+ Allocates everything for chains with nJoints joints. Does nothing if the
+ workspace already has that size.
+
+ NOTES:
+ Passing a workspace of the wrong size to a solver resizes it, which
+ allocates once. Robot solves on 6 and 7 joint chains keep J, Jinv and the
+ joint steps in fixed-size stack storage instead (see
+ Robot::dampedLeastSquaresIK_chain<N>()).
+
+ With a null space task, the Robot solvers call the IKWorkspace overload of
+ Constraints::nullSpaceTask(). Unless a subclass overrides that overload, it
+ goes through the older copying signature, which allocates once per
+ iteration.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _IKWorkspace_h_
+#define _IKWorkspace_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Frame.h"
+#include "BoxQP.h"
+#include <vector>
+#include <eigen3/Eigen/Core>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class IKWorkspace
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // IKWorkspace Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        IKWorkspace();
+        IKWorkspace(size_t nJoints);
+
+        // Destructor
+        virtual ~IKWorkspace();
+
+        //--------------------------------------------------------------------------
+        // IKWorkspace Public Member Functions
+        //--------------------------------------------------------------------------
+        void resize(size_t nJoints);
+        size_t size() const;
+
+        //--------------------------------------------------------------------------
+        // IKWorkspace Public Member Variables
+        //--------------------------------------------------------------------------
+        std::vector<Joint*> joints;
+
+        Eigen::Matrix<double, 6, Eigen::Dynamic> J;
+        Eigen::Matrix<double, Eigen::Dynamic, 6> Jinv;
+        Matrix6d JJt;
+        Matrix6d dampedInverse;
+        Matrix6d JJtInverse;
+
+        SCREW err;
+        SCREW Jnull; // J*nullErr
+        SCREW f;
+
+        Eigen::VectorXd delta;
+        Eigen::VectorXd nullErr;
+        Eigen::VectorXd deltaNull;
+        Eigen::VectorXd stored;
+
+        // Used by Robot::boxConstrainedIK_chain()
+        Eigen::MatrixXd H;
+        Eigen::VectorXd gradient;
+        Eigen::VectorXd lower;
+        Eigen::VectorXd upper;
+        BoxQP qp;
+
+        // Used by Robot::levenbergMarquardtIK_chain()
+        SCREW dampedErr;    // (J J^T + lambda I)^-1 err
+        SCREW predictedErr; // err - J*delta, the error the linear model predicts
+        SCREW trialErr;     // Error after the step being tried
+
+        // Set by Robot::levenbergMarquardtIK_chain()
+        double damping;
+        size_t iterations;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    }; // class IKWorkspace
+
+} // namespace RobotKin
+
+#endif
+
+
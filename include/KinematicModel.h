@@ -0,0 +1,276 @@
+/*
+ -------------------------------------------------------------------------------
+ KinematicModel.h
+ Robot Library Project
+
+ CLASS NAME:
+ KinematicModel
+ KinematicState
+
+ DESCRIPTION:
+ Flat, cache-friendly copy of a Robot's kinematic tree. Every joint of the
+ robot is stored in topological order (parents before children) in
+ contiguous arrays, so forward kinematics, Jacobians and center of mass
+ queries run as linear sweeps instead of walking Linkage and Joint objects.
+
+ The model only holds topology and constants and is never modified by a
+ query. Joint values and the frames computed from them live in a separate
+ KinematicState, so several threads can share one model as long as each
+ of them works on its own state.
+
+ FILES:
+ KinematicModel.h
+ KinematicModel.cpp
+
+ DEPENDENCIES:
+ Robot
+ Constraints
+
+ CONSTRUCTORS:
+ KinematicModel();
+ KinematicModel(const Robot& robot);
+ KinematicState();
+ KinematicState(const KinematicModel& model);
+
+ PROPERTIES:
+ parents_ - index of the parent joint of each joint (-1 for the robot base).
+
+ fixed_ - frame of each joint with respect to its parent joint frame when
+ the joint value is zero. Linkage base frames and the tools that carry child
+ linkages are folded into these transforms.
+
+ KinematicState::values_, frames_ - joint values and the resulting joint
+ frames with respect to the robot.
+
+ METHODS:
+ void compile(const Robot& robot);
+ Rebuilds the arrays from the current structure of robot. Joint indices
+ match the joint indices of the robot.
+
+ void values(KinematicState& state, ...) const;
+ Writes joint values into state and recomputes only the frames downstream
+ of the joints whose values changed.
+
+ void updateFrames(KinematicState& state) const;
+ Recomputes all joint and tool frames of state in one forward sweep.
+
+ rk_result_t forwardKinematicsBatch(const KinematicState& state, ...) const;
+ Evaluates the tool pose of a linkage, or the pose of the last joint of a
+ chain, for every column of a matrix of joint configurations. Joints on the
+ way to the tip that are not part of the chain keep their values in state.
+ The poses are written into a POSE_BATCH, one sample per column.
+
+ rk_result_t dampedLeastSquaresIK_chain(KinematicState& state, ...) const;
+ Same solver as Robot::dampedLeastSquaresIK_chain(), but all of its
+ scratch values live in state, so it can run concurrently on one model. It
+ calls the KinematicModel overloads of the Constraints hooks, so a subclass
+ that only overrides the Robot ones gets the default behavior here.
+
+ rk_result_t dampedLeastSquaresIK_attempt(KinematicState& state, ...) const;
+ Runs one seed attempt of the solver. ParallelIK runs several of these at
+ once and cancels the rest when one succeeds.
+
+ NOTES:
+ The model is a snapshot. Changes to the structure of the Robot (new
+ linkages, joints, tools or mass properties) require another compile().
+ The Robot remains the authoring front-end.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _KinematicModel_h_
+#define _KinematicModel_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Frame.h"
+#include <vector>
+#include <atomic>
+#include <random>
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Geometry>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class KinematicState
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // KinematicState Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        KinematicState();
+        KinematicState(const KinematicModel& model);
+
+        // Destructor
+        virtual ~KinematicState();
+
+        bool imposeLimits;
+
+        // Draws the random seeds of Constraints::iterativeJacobianSeed(), so
+        // states on different threads never share an engine
+        std::mt19937 random;
+
+        //--------------------------------------------------------------------------
+        // KinematicState Public Member Functions
+        //--------------------------------------------------------------------------
+        const Eigen::VectorXd& values() const;
+        double value(size_t jointIndex) const;
+
+        const TRANSFORM& jointRespectToRobot(size_t jointIndex) const;
+        const TRANSFORM& toolRespectToRobot(size_t toolIndex) const;
+
+    protected:
+        friend class KinematicModel;
+
+        //--------------------------------------------------------------------------
+        // KinematicState Protected Member Variables
+        //--------------------------------------------------------------------------
+        Eigen::VectorXd values_;
+        TRANSFORM_VECTOR frames_;
+        TRANSFORM_VECTOR toolFrames_;
+
+        // Joints whose value changed since their frames were computed
+        std::vector<bool> dirty_;
+        size_t firstDirtyJoint_; // Frames upstream of this joint are still valid
+
+    }; // class KinematicState
+
+    class KinematicModel
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // KinematicModel Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        KinematicModel();
+        KinematicModel(const Robot& robot);
+
+        // Destructor
+        virtual ~KinematicModel();
+
+        void compile(const Robot& robot);
+
+        //--------------------------------------------------------------------------
+        // KinematicModel Public Member Functions
+        //--------------------------------------------------------------------------
+        size_t nJoints() const;
+        size_t nTools() const; // One tool per linkage, indexed like the linkages
+
+        int parentIndex(size_t jointIndex) const;
+        JointType jointType(size_t jointIndex) const;
+        const AXIS& jointAxis(size_t jointIndex) const;
+        AxisType axisType(size_t jointIndex) const;
+        const TRANSFORM& respectToParent(size_t jointIndex) const;
+        double min(size_t jointIndex) const;
+        double max(size_t jointIndex) const;
+        int toolParentIndex(size_t toolIndex) const;
+        void linkageJointIndices(size_t linkageIndex, std::vector<size_t>& jointIndices) const;
+
+        // Values and limit setting of the Robot at the time of compile()
+        const Eigen::VectorXd& defaultValues() const;
+        bool defaultImposeLimits() const;
+
+        void values(KinematicState& state, const Eigen::VectorXd& someValues) const;
+        void values(KinematicState& state, const std::vector<size_t>& jointIndices,
+                    const Eigen::VectorXd& jointValues) const;
+        rk_result_t setJointValue(KinematicState& state, size_t jointIndex, double val) const;
+
+        void updateFrames(KinematicState& state) const;
+
+        // location should be specified with respect to robot coordinates
+        void jacobian(Eigen::MatrixXd& J, const KinematicState& state,
+                      const std::vector<size_t>& jointIndices, const TRANSLATION& location) const;
+        void jacobian(Eigen::Matrix<double, 6, Eigen::Dynamic>& J, const KinematicState& state,
+                      const std::vector<size_t>& jointIndices, const TRANSLATION& location) const;
+
+        double mass() const;
+        TRANSLATION centerOfMass(const KinematicState& state) const; // With respect to robot coordinates
+
+        // configurations has one row per entry of jointIndices and one column per sample
+        rk_result_t forwardKinematicsBatch(const KinematicState& state, const std::vector<size_t>& jointIndices,
+                                           const Eigen::MatrixXd& configurations, POSE_BATCH& poses,
+                                           const TRANSFORM& finalTransform = TRANSFORM::Identity()) const;
+        // configurations has one row per joint of the linkage and one column per sample
+        rk_result_t forwardKinematicsBatch(const KinematicState& state, size_t linkageIndex,
+                                           const Eigen::MatrixXd& configurations, POSE_BATCH& poses) const;
+
+        // Instantiated for 6 x 6, 6 x 7 and 6 x n storage
+        template<typename JacobianType>
+        void chainJacobian(JacobianType& J, const KinematicState& state,
+                           const std::vector<size_t>& jointIndices, const TRANSLATION& location) const;
+        static TRANSFORM batchPose(const POSE_BATCH& poses, size_t sample);
+
+        rk_result_t dampedLeastSquaresIK_chain(KinematicState& state, const std::vector<size_t>& jointIndices,
+                                               Eigen::VectorXd& jointValues, const TRANSFORM& target,
+                                               const Constraints& constraints) const;
+        rk_result_t dampedLeastSquaresIK_chain(KinematicState& state, const std::vector<size_t>& jointIndices,
+                                               Eigen::VectorXd& jointValues, const TRANSFORM& target,
+                                               const Constraints& constraints, IKWorkspace& workspace) const;
+
+        // A single seed attempt of the solver above. error receives the norm
+        // of the remaining pose error. Stops early once cancel is set.
+        rk_result_t dampedLeastSquaresIK_attempt(KinematicState& state, const std::vector<size_t>& jointIndices,
+                                                 Eigen::VectorXd& jointValues, const TRANSFORM& target,
+                                                 const Constraints& constraints, IKWorkspace& workspace,
+                                                 size_t attempt, double& error,
+                                                 const std::atomic<bool>* cancel = NULL) const;
+
+    protected:
+        //--------------------------------------------------------------------------
+        // KinematicModel Protected Member Variables
+        //--------------------------------------------------------------------------
+        // Topology and constants
+        std::vector<int> parents_;
+        TRANSFORM_VECTOR fixed_;
+        std::vector<AXIS> axes_;
+        std::vector<AxisType> axisTypes_;
+        std::vector<JointType> types_;
+        std::vector<double> min_;
+        std::vector<double> max_;
+
+        std::vector<int> toolParents_;
+        TRANSFORM_VECTOR toolFixed_;
+
+        std::vector<double> masses_;
+        std::vector<TRANSLATION> coms_; // With respect to each joint frame
+        std::vector<double> toolMasses_;
+        std::vector<TRANSLATION> toolComs_; // With respect to each tool frame
+        double rootMass_;
+        TRANSLATION rootCom_;
+
+        std::vector<size_t> linkageFirstJoints_;
+        std::vector<size_t> linkageJointCounts_;
+
+        Eigen::VectorXd defaultValues_;
+        bool defaultImposeLimits_;
+
+        //--------------------------------------------------------------------------
+        // KinematicModel Protected Member Functions
+        //--------------------------------------------------------------------------
+        void updateDirtyFrames(KinematicState& state) const;
+        rk_result_t batchToTip(const KinematicState& state, int tip, const TRANSFORM& tipOffset,
+                               const std::vector<size_t>& jointIndices,
+                               const Eigen::MatrixXd& configurations, POSE_BATCH& poses) const;
+
+    }; // class KinematicModel
+
+} // namespace RobotKin
+
+#endif
+
+
@@ -59,6 +59,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <functional>
 #include <eigen3/Eigen/Core>
 #include <eigen3/Eigen/Geometry>
 
@@ -87,6 +88,7 @@ namespace RobotKin {
         friend class Robot;
         friend class Linkage;
         friend class Joint;
+        friend class Tool;
 
     public:
         //----------------------------------------------------------------------
@@ -96,12 +98,15 @@ namespace RobotKin {
         Link(); // TODO
         Link(double newMass, TRANSLATION newCom); // TODO
         Link(double newMass, TRANSLATION newCom, Eigen::Matrix3d newInertiaTensor); // TODO
+        Link(const Link& link);
+
+        Link& operator=(const Link& link);
 
         double mass() const;
         const TRANSLATION& const_com() const;
-        TRANSLATION& com();
+        TRANSLATION& com(); // Marks the mass caches stale, prefer const_com() for reads
         const Eigen::Matrix3d& const_tensor() const;
-        Eigen::Matrix3d& tensor();
+        Eigen::Matrix3d& tensor(); // Same as com()
 
 
         void setMass(double newMass, TRANSLATION newCom); // TODO
@@ -120,6 +125,11 @@ namespace RobotKin {
         TRANSLATION com_;
         Eigen::Matrix3d tensor_;
 
+        // Tells the linkage or robot that owns this link that its cached
+        // mass sums are stale
+        void massChanged();
+        Frame* frame_; // Joint, tool or robot carrying this link, if any
+
     }; // Class Link
 
     
@@ -133,6 +143,8 @@ namespace RobotKin {
         friend class Linkage;
         friend class Robot;
         friend class Link;
+        friend class KinematicModel;
+        friend class WholeBodyJacobian;
 
     public:
 
@@ -177,10 +189,15 @@ namespace RobotKin {
         void min(double newMin);
         void max(double newMax);
 
+        // Largest speed of the joint (rad/s or m/s), infinite by default
+        double maxVelocity() const;
+        void maxVelocity(double newMaxVelocity);
+
         JointType getJointType();
 
         void setJointAxis(AXIS axis);
         AXIS getJointAxis();
+        AxisType getAxisType() const;
 
         const TRANSFORM& respectToFixed() const;
         void respectToFixed(TRANSFORM aCoordinate);
@@ -220,6 +237,19 @@ namespace RobotKin {
 
         const Robot* parentRobot() const;
 
+        void updateTransform();
+
+        // Torque from mass, with mass weighted center of mass moment, hanging
+        // downstream or upstream of this joint
+        double gravityTorque(double mass, const TRANSLATION& moment, bool downstream) const;
+
+        // Geometric Jacobian column of this joint for a point at location.
+        // The first takes location in linkage coordinates, the second in the
+        // coordinates that linkageFrame places the linkage in. Both reuse
+        // the cached frame with respect to the linkage.
+        SCREW jacobianColumn(const TRANSLATION& location) const;
+        SCREW jacobianColumn(const TRANSLATION& location, const TRANSFORM& linkageFrame) const;
+
     private:
         //----------------------------------------------------------------------
         // Joint Private Member Variables
@@ -227,7 +257,9 @@ namespace RobotKin {
         JointType jointType_; // Type of joint (REVOLUTE or PRISMATIC)
         double min_; // Minimum joint value
         double max_; // Maximum joint value
+        double maxVelocity_; // Maximum joint speed
         AXIS jointAxis_;
+        AxisType axisType_; // Set by setJointAxis()
         TRANSFORM respectToFixedTransformed_; // Coordinates transformed according to the joint value and type with respect to respectToFixed frame
         TRANSFORM respectToLinkage_; // Coordinates with respect to linkage base frame
         size_t localID_;
@@ -244,6 +276,8 @@ namespace RobotKin {
         friend class Linkage;
         friend class Robot;
         friend class Frame;
+        friend class KinematicModel;
+        friend class WholeBodyJacobian;
 
     public:
         //----------------------------------------------------------------------
@@ -315,7 +349,10 @@ namespace RobotKin {
         friend class Frame;
         friend class Joint;
         friend class Tool;
+        friend class Link;
         friend class Robot;
+        friend class KinematicModel;
+        friend class WholeBodyJacobian;
         
     public:
 
@@ -426,6 +463,11 @@ namespace RobotKin {
         
         void jacobian(Eigen::MatrixXd& J, TRANSLATION location, const Frame *refFrame) const;
         void jacobian(Eigen::MatrixXd& J, const std::vector<Joint*>& jointFrames, TRANSLATION location, const Frame* refFrame) const;
+
+        // Same as above into 6 x n storage, which does not allocate once it
+        // has the right number of columns
+        void jacobian(Matrix6Xd& J, const TRANSLATION& location, const Frame *refFrame) const;
+        void jacobian(Matrix6Xd& J, const std::vector<Joint*>& jointFrames, const TRANSLATION& location, const Frame* refFrame) const;
         
         void printInfo() const;
         
@@ -443,7 +485,14 @@ namespace RobotKin {
         //--------------------------------------------------------------------------
         // Linkage Public Member Variables
         //--------------------------------------------------------------------------
-        bool (*analyticalIK)(Eigen::VectorXd& q, const TRANSFORM& B, const Eigen::VectorXd& qPrev);
+        // Closed-form IK for this linkage. robot is the robot the linkage is
+        // solved on, B is the tool with respect to the linkage, and qPrev
+        // picks between multiple solutions. The robot is passed in at every
+        // call, so copies of the linkage never point back at another robot.
+        typedef std::function<bool(Robot& robot, Eigen::VectorXd& q, const TRANSFORM& B,
+                                   const Eigen::VectorXd& qPrev)> AnalyticalIK;
+        AnalyticalIK analyticalIK;
+        bool hasAnalyticalIK() const;
         
     protected:
         //--------------------------------------------------------------------------
@@ -468,14 +517,38 @@ namespace RobotKin {
         //--------------------------------------------------------------------------
         void initialize(std::vector<Joint> joints, Tool tool);
         void updateFrames();
+        void updateJointFrames();
+        void updateStaleFrames();
         void updateChildLinkage();
-        static bool defaultAnalyticalIK(Eigen::VectorXd& q, const TRANSFORM& B, const Eigen::VectorXd& qPrev);
+        void markFramesDirty(size_t fromJoint);
+        void framesChanged();
+        void linksChanged();
+        bool deferringUpdates() const;
+        void updateMassCache();
+        TRANSLATION centerOfMassFromMoment(double mass, const TRANSLATION& moment, FrameType withRespectTo);
+        static bool defaultAnalyticalIK(Robot& robot, Eigen::VectorXd& q, const TRANSFORM& B, const Eigen::VectorXd& qPrev);
         
         
         //--------------------------------------------------------------------------
         // Linkage Private Member Variables
         //--------------------------------------------------------------------------
         bool initializing_;
+        bool deferUpdates_; // Joint writes only mark the frames as stale
+        bool framesDirty_; // Joint frames need to be recomputed
+        size_t firstDirtyJoint_; // Frames upstream of this joint are still valid
+        bool framesMoved_; // Tool frame changed during the last robot update
+
+        // Mass cache: mass and mass weighted center of mass of joints i and
+        // beyond in linkage coordinates, and the tool's moment. The masses are
+        // rebuilt when linksRevision_ moves, the moments when this linkage's
+        // joint frames are recomputed.
+        std::vector<double> massSuffix_;
+        std::vector<TRANSLATION> momentSuffix_;
+        TRANSLATION toolMoment_;
+        size_t linksRevision_; // Goes up every time a joint or tool Link changes
+        size_t massRevision_;
+        size_t framesRevision_; // Goes up every time the joint frames are recomputed
+        size_t momentRevision_;
         std::map<std::string, size_t> jointNameToIndex_;
         
         
@@ -0,0 +1,166 @@
+/*
+ -------------------------------------------------------------------------------
+ ParallelIK.h
+ Robot Library Project
+
+ CLASS NAME:
+ ParallelIK
+
+ DESCRIPTION:
+ Multi-start inverse kinematics on a pool of threads. The seed attempts that
+ Constraints::iterativeJacobianSeed() would try one after another (current
+ values, resting values, zeros, random) are handed out to the workers, each
+ of which solves on its own KinematicState and IKWorkspace. The first attempt
+ to reach RK_SOLVED cancels the others. If none of them succeed, the attempt
+ that ended closest to the target is returned.
+
+ FILES:
+ ParallelIK.h
+ ParallelIK.cpp
+
+ DEPENDENCIES:
+ KinematicModel
+ IKWorkspace
+ Constraints
+
+ CONSTRUCTORS:
+ ParallelIK(const KinematicModel& model, size_t nThreads = 0);
+ nThreads = 0 uses one thread per hardware core. The model must outlive the
+ ParallelIK.
+
+ METHODS:
+ rk_result_t dampedLeastSquaresIK_chain(KinematicState& state, ...);
+ Same arguments and result as KinematicModel::dampedLeastSquaresIK_chain().
+ On return jointValues and state hold the winning attempt.
+
+ int lastAttempt() const;
+ double lastError() const;
+ Seed attempt and remaining pose error of the last solve.
+
+ size_t attemptsStarted() const;
+ How many seed attempts the last solve handed out before it finished or was
+ cancelled.
+
+ NOTES:
+ One ParallelIK runs one solve at a time. Calls from several threads at once
+ must use separate instances. Every solve draws one number from
+ state.random, and each attempt reseeds its worker's engine from that
+ number and the attempt index. A seeded state therefore gets the same random
+ attempts however the threads are scheduled.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _ParallelIK_h_
+#define _ParallelIK_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "KinematicModel.h"
+#include "IKWorkspace.h"
+#include "Constraints.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class ParallelIK
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // ParallelIK Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        ParallelIK(const KinematicModel& model, size_t nThreads = 0);
+
+        // Destructor
+        virtual ~ParallelIK();
+
+        //--------------------------------------------------------------------------
+        // ParallelIK Public Member Functions
+        //--------------------------------------------------------------------------
+        rk_result_t dampedLeastSquaresIK_chain(KinematicState& state, const std::vector<size_t>& jointIndices,
+                                               Eigen::VectorXd& jointValues, const TRANSFORM& target,
+                                               const Constraints& constraints=Constraints::Defaults());
+
+        size_t threads() const;
+        int lastAttempt() const;
+        double lastError() const;
+        size_t attemptsStarted() const;
+
+    protected:
+        struct Worker
+        {
+            Worker(const KinematicModel& model) : state(model) { }
+
+            KinematicState state;
+            IKWorkspace workspace;
+            Eigen::VectorXd values;
+            std::thread thread;
+
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        };
+
+        //--------------------------------------------------------------------------
+        // ParallelIK Protected Member Functions
+        //--------------------------------------------------------------------------
+        void work(Worker* worker);
+
+        //--------------------------------------------------------------------------
+        // ParallelIK Protected Member Variables
+        //--------------------------------------------------------------------------
+        const KinematicModel& model_;
+        std::vector<Worker*> workers_;
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable finished_;
+        size_t generation_;
+        size_t busy_;
+        bool shutdown_;
+
+        // The solve in progress
+        const KinematicState* jobState_;
+        const std::vector<size_t>* jobIndices_;
+        const Eigen::VectorXd* jobValues_;
+        const TRANSFORM* jobTarget_;
+        const Constraints* jobConstraints_;
+        size_t jobAttempts_;
+        std::mt19937::result_type jobSeed_;
+        std::atomic<size_t> nextAttempt_;
+        std::atomic<bool> cancel_;
+
+        // Best attempt so far, guarded by mutex_
+        rk_result_t bestResult_;
+        double bestError_;
+        int bestAttempt_;
+        Eigen::VectorXd bestValues_;
+
+    private:
+        ParallelIK(const ParallelIK&);
+        ParallelIK& operator=(const ParallelIK&);
+
+    }; // class ParallelIK
+
+} // namespace RobotKin
+
+#endif
+
+
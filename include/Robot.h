@@ -94,7 +94,11 @@ namespace RobotKin {
         // Robot Friends
         //--------------------------------------------------------------------------
         friend class Linkage;
+        friend class Link;
+        friend class Joint;
         friend class Frame;
+        friend class KinematicModel;
+        friend class WholeBodyJacobian;
         
     public:
         //--------------------------------------------------------------------------
@@ -172,8 +176,41 @@ namespace RobotKin {
         TRANSFORM respectToWorld() const;
         
         void jacobian(Eigen::MatrixXd& J, const std::vector<Joint*>& jointFrames, TRANSLATION location, const Frame* refFrame) const;
-        
+
+        // Same as above into fixed or 6 x n storage, which does not allocate.
+        // Without refFrame the result is in robot coordinates. Instantiated
+        // for N = 6, 7 and Eigen::Dynamic.
+        template<int N>
+        void jacobian(Eigen::Matrix<double, 6, N>& J, const std::vector<Joint*>& jointFrames,
+                      const TRANSLATION& location) const;
+        template<int N>
+        void jacobian(Eigen::Matrix<double, 6, N>& J, const std::vector<Joint*>& jointFrames,
+                      const TRANSLATION& location, const Frame* refFrame) const;
+
+        // Jacobian and its time derivative at joint velocities
+        // jointVelocities (one per entry of jointFrames), built in the same
+        // pass. jointFrames are taken as a serial chain ordered from the base
+        // outward, and location moves with the last of them. Jdot is the
+        // derivative in robot coordinates, rotated into refFrame like J, so
+        // that J*qdd + Jdot*qd is the acceleration expressed in refFrame.
+        // Returns RK_INVALID_JOINT if the velocities do not match the chain.
+        template<int N>
+        rk_result_t jacobianDerivative(Eigen::Matrix<double, 6, N>& J, Eigen::Matrix<double, 6, N>& Jdot,
+                                       const std::vector<Joint*>& jointFrames, const TRANSLATION& location,
+                                       const Eigen::VectorXd& jointVelocities, const Frame* refFrame) const;
+
+        // Only the product Jdot*qd, without storing either matrix
+        rk_result_t jacobianDerivativeTimesVelocity(SCREW& JdotQd, const std::vector<Joint*>& jointFrames,
+                                                    const TRANSLATION& location, const Eigen::VectorXd& jointVelocities,
+                                                    const Frame* refFrame) const;
+
         void updateFrames();
+
+        // While deferred, joint writes only mark their linkage as stale.
+        // commitFrameUpdates() recomputes every stale frame in a single pass.
+        void deferFrameUpdates();
+        void commitFrameUpdates();
+        bool deferringFrameUpdates() const;
         void printInfo() const;
         
         //--------------------------------------------------------------------------
@@ -217,12 +254,90 @@ namespace RobotKin {
         rk_result_t dampedLeastSquaresIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
                                                const TRANSFORM &target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
 
+        // Reuses the storage in workspace, so repeated solves do not allocate.
+        // Chains of 6 or 7 joints are forwarded to the fixed-size solver below.
+        rk_result_t dampedLeastSquaresIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                               const TRANSFORM &target, RobotKin::Constraints& constraints,
+                                               IKWorkspace& workspace);
+
+        // Solver compiled for chains of exactly N joints. Instantiated for
+        // N = 6, 7 and Eigen::Dynamic.
+        template<int N>
+        rk_result_t dampedLeastSquaresIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                               const TRANSFORM &target, RobotKin::Constraints& constraints,
+                                               IKWorkspace& workspace);
+
         rk_result_t dampedLeastSquaresIK_chain(const std::vector<std::string>& jointNames, Eigen::VectorXd& jointValues,
                                                const TRANSFORM& target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
 
         rk_result_t dampedLeastSquaresIK_linkage(const std::string linkageName, Eigen::VectorXd &jointValues,
                                                  const TRANSFORM& target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
 
+        // Runs the closed-form solver registered on the linkage and checks its
+        // answer with forward kinematics. jointValues is the previous
+        // configuration going in and the solution coming out. Returns
+        // RK_SOLVER_NOT_READY if the linkage has no solver, and RK_NO_SOLUTION
+        // if the answer misses target by more than tolerance, in which case
+        // the joints are left unchanged.
+        rk_result_t analyticalIK_linkage(const std::string linkageName, Eigen::VectorXd& jointValues,
+                                         const TRANSFORM& target, const TRANSFORM& finalTF=TRANSFORM::Identity(),
+                                         double tolerance=0.0001);
+
+        // Solves the targets in order, starting each solve from the last
+        // solution and starting the first from the current joint values.
+        // trajectory gets one column per target and results one entry per
+        // target. jumps lists the targets where some joint moved more than
+        // maxJump from the previous column. Returns RK_SOLVED only if every
+        // target was solved.
+        rk_result_t dampedLeastSquaresIK_trajectory(const std::vector<size_t> &jointIndices, const TRANSFORM_VECTOR& targets,
+                                                    Eigen::MatrixXd& trajectory, std::vector<rk_result_t>& results,
+                                                    std::vector<size_t>& jumps,
+                                                    RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults(),
+                                                    double maxJump=M_PI/4);
+
+        rk_result_t dampedLeastSquaresIK_trajectory(const std::string linkageName, const TRANSFORM_VECTOR& targets,
+                                                    Eigen::MatrixXd& trajectory, std::vector<rk_result_t>& results,
+                                                    std::vector<size_t>& jumps,
+                                                    RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults(),
+                                                    double maxJump=M_PI/4);
+
+        /////////////////
+
+        // Levenberg-Marquardt: the damping starts at constraints.dampingConstant
+        // and adapts to how well each step's predicted error reduction matches
+        // the actual one. Steps that make the error worse are rejected, which
+        // takes the place of the error and delta clamps. A custom error clamp
+        // still applies, to the current and the trial error alike. The
+        // workspace overload reports the final damping and iteration count.
+        rk_result_t levenbergMarquardtIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                               const TRANSFORM &target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+
+        rk_result_t levenbergMarquardtIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                               const TRANSFORM &target, RobotKin::Constraints& constraints,
+                                               IKWorkspace& workspace);
+
+        rk_result_t levenbergMarquardtIK_linkage(const std::string linkageName, Eigen::VectorXd &jointValues,
+                                                 const TRANSFORM& target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+
+        /////////////////
+
+        // Solves each damped least squares step as a box constrained QP, so
+        // no step ever leaves the joint limits (nor moves a joint faster than
+        // its maxVelocity() when constraints.timeStep is positive, nor more
+        // than constraints.deltaClamp when performDeltaClamp is set). The
+        // limits hold even while imposeLimits is off, and the iterative seeds
+        // are not allowed to lift them. The QP active set carries over from
+        // step to step, and between solves that share a workspace.
+        rk_result_t boxConstrainedIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                           const TRANSFORM &target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+
+        rk_result_t boxConstrainedIK_chain(const std::vector<size_t> &jointIndices, Eigen::VectorXd &jointValues,
+                                           const TRANSFORM &target, RobotKin::Constraints& constraints,
+                                           IKWorkspace& workspace);
+
+        rk_result_t boxConstrainedIK_linkage(const std::string linkageName, Eigen::VectorXd &jointValues,
+                                             const TRANSFORM& target, RobotKin::Constraints& constraints=RobotKin::Constraints::Defaults());
+
         /////////////////
 
         TRANSLATION centerOfMass(FrameType withRespectTo=ROBOT); // Center of mass for entire robot + tools
@@ -240,6 +355,67 @@ namespace RobotKin {
 
         void gravityJointTorques(const std::vector<size_t> &jointIndices, Eigen::VectorXd &torques, bool downstream=true);
 
+        // Gravity torque of every joint, indexed by joint id. Subtree masses
+        // and mass-weighted centers of mass are accumulated from the tips
+        // inward in one pass, so the whole body costs O(n) and repeated calls
+        // do not allocate.
+        void gravityJointTorques(Eigen::VectorXd &torques, bool downstream=true);
+
+        // Jacobian of centerOfMass() with respect to the joints, one column
+        // per joint in joint id order or in the order of jointIndices. Built
+        // from the same subtree sums as gravityJointTorques(), so the whole
+        // 3 x n matrix costs one O(n) pass. withRespectTo is ROBOT or WORLD.
+        void centerOfMassJacobian(Eigen::Matrix3Xd &J, FrameType withRespectTo=ROBOT);
+        void centerOfMassJacobian(const std::vector<size_t> &jointIndices, Eigen::Matrix3Xd &J,
+                                  FrameType withRespectTo=ROBOT);
+
+        //--------------------------------------------------------------------------
+        // Dynamics
+        //--------------------------------------------------------------------------
+
+        // Recursive Newton-Euler inverse dynamics. Overwrites the robot's joint
+        // values with q, without clamping it to the joint limits, and returns
+        // the torques (forces for prismatic joints) that give the
+        // accelerations qdd at velocities qd, indexed by joint id. The robot
+        // frame is fixed and gravity pulls along its -z axis, so with qd and
+        // qdd zero this matches gravityJointTorques(). Link and tool tensors
+        // are taken about their center of mass in the axes of their frame.
+        // Costs O(n) and repeated calls do not allocate.
+        rk_result_t inverseDynamics(const Eigen::VectorXd &q, const Eigen::VectorXd &qd,
+                                    const Eigen::VectorXd &qdd, Eigen::VectorXd &torques);
+
+        // Joint space mass matrix M(q) by the composite rigid body algorithm,
+        // indexed by joint id. Overwrites the joint values with q, unclamped
+        // like inverseDynamics(). Only joints on a common branch are coupled, so
+        // the entries between independent limbs are exactly zero. The second
+        // overload picks out the rows and columns of jointIndices.
+        rk_result_t massMatrix(const Eigen::VectorXd &q, Eigen::MatrixXd &M);
+        rk_result_t massMatrix(const Eigen::VectorXd &q, const std::vector<size_t> &jointIndices,
+                               Eigen::MatrixXd &M);
+
+        // Factors a full mass matrix in place as M = L^T L, leaving L in the
+        // lower triangle. L keeps the branch sparsity of M, so factoring costs
+        // O(n d^2) and solving O(n d) for tree depth d, instead of O(n^3) and
+        // O(n^2). Returns RK_NO_SOLUTION if M is not positive definite.
+        rk_result_t factorMassMatrix(Eigen::MatrixXd &M);
+
+        // Given L from factorMassMatrix(): x = M^-1 x, and the whole inverse.
+        void massMatrixSolve(const Eigen::MatrixXd &L, Eigen::VectorXd &x);
+        void massMatrixInverse(const Eigen::MatrixXd &L, Eigen::MatrixXd &Minv);
+
+        // Articulated body algorithm: the joint accelerations that torques
+        // produce at q and qd, indexed by joint id, in O(n) without
+        // allocating after the first call. Overwrites the joint values with
+        // q, unclamped like inverseDynamics().
+        rk_result_t forwardDynamics(const Eigen::VectorXd &q, const Eigen::VectorXd &qd,
+                                    const Eigen::VectorXd &torques, Eigen::VectorXd &qdd);
+
+        // One semi-implicit Euler step of length dt: qd is advanced with the
+        // accelerations from forwardDynamics() and q with the new qd. Joint
+        // limits are neither enforced on q nor used to clamp it when
+        // evaluating the dynamics.
+        rk_result_t stepDynamics(Eigen::VectorXd &q, Eigen::VectorXd &qd,
+                                 const Eigen::VectorXd &torques, double dt);
 
         static Robot& Default();
 
@@ -258,6 +434,75 @@ namespace RobotKin {
         // Robot Protected Member Variables
         //--------------------------------------------------------------------------
         virtual void initialize(std::vector<Linkage> linkageObjs, std::vector<int> parentIndices);
+
+        void updateStaleFrames();
+
+        // Writes q into the joints as given, even with imposeLimits set, so
+        // the dynamics are evaluated where the caller asked
+        void dynamicsValues(const Eigen::VectorXd &q);
+
+        // Fills dynamicsParent_ and dynamicsLinkageBody_
+        void updateDynamicsTree();
+
+        // Fills the tree, dynamicsInertia_ with each link's own inertia and
+        // dynamicsMotion_, at the current joint values
+        void updateDynamicsInertia();
+
+        // Fills the subtree sums below from the tips inward in one pass,
+        // unless nothing changed since the last time
+        void updateSubtreeMasses();
+
+        // One entry of gravityJointTorques(), for Joint::gravityTorque()
+        double gravityJointTorque(size_t jointIndex, bool downstream);
+
+        // Per joint: mass and mass weighted center of mass downstream of the
+        // joint. Per linkage: the same for its whole subtree.
+        std::vector<double> subtreeJointMass_;
+        std::vector<TRANSLATION> subtreeJointMoment_;
+        std::vector<double> subtreeLinkageMass_;
+        std::vector<TRANSLATION> subtreeLinkageMoment_;
+
+        // Scratch space for gravityJointTorques(): the upstream sums and the
+        // root of each linkage's tree
+        std::vector<double> gravityJointMass_;
+        std::vector<TRANSLATION> gravityJointMoment_;
+        std::vector<size_t> gravityLinkageRoot_;
+        Eigen::VectorXd gravityTorques_;
+
+        std::vector<size_t> comJacobianIndices_;
+
+        // Scratch space for inverseDynamics(), in robot coordinates. Per
+        // joint: the joint carrying its link (-1 for the base), origin, axis,
+        // motion of its link and the load it carries. Per linkage: the last
+        // link its tool and children are attached to.
+        std::vector<int> dynamicsParent_;
+        std::vector<int> dynamicsLinkageBody_;
+        std::vector<TRANSLATION> dynamicsOrigin_;
+        std::vector<TRANSLATION> dynamicsAxis_;
+        std::vector<TRANSLATION> dynamicsOmega_;
+        std::vector<TRANSLATION> dynamicsAlpha_;
+        std::vector<TRANSLATION> dynamicsAccel_;
+        std::vector<TRANSLATION> dynamicsForce_;
+        std::vector<TRANSLATION> dynamicsMoment_;
+
+        // Scratch space for massMatrix() and forwardDynamics(): composite or
+        // articulated spatial inertia and motion axis of each joint about the
+        // robot origin
+        MATRIX6_VECTOR dynamicsInertia_;
+        Matrix6Xd dynamicsMotion_;
+        Eigen::MatrixXd dynamicsMass_;
+
+        // Scratch space for forwardDynamics(), per joint: spatial velocity,
+        // velocity product acceleration, bias force, U = I*S, D = S^T*U,
+        // u = tau - S^T*bias force, and spatial acceleration
+        Matrix6Xd dynamicsVelocity_;
+        Matrix6Xd dynamicsBias_;
+        Matrix6Xd dynamicsBiasForce_;
+        Matrix6Xd dynamicsU_;
+        Eigen::VectorXd dynamicsD_;
+        Eigen::VectorXd dynamicsu_;
+        Matrix6Xd dynamicsAcceleration_;
+        Eigen::VectorXd dynamicsQdd_;
         
         
     private:
@@ -272,6 +517,25 @@ namespace RobotKin {
         // Robot Private Member Variables
         //--------------------------------------------------------------------------
         bool initializing_;
+        bool deferUpdates_;
+
+        // Goes up every time any linkage's frames are recomputed
+        size_t frameRevision_;
+
+        // Goes up every time any Link of this robot changes or a linkage is
+        // added
+        size_t linksRevision_;
+
+        // Whole body mass and mass weighted center of mass in robot
+        // coordinates, with the linksRevision_ and frameRevision_ they were
+        // summed at. The subtree sums above are stamped the same way.
+        double massCache_;
+        size_t massRevision_;
+        TRANSLATION momentCache_;
+        size_t momentRevision_;
+        size_t momentFrameRevision_;
+        size_t subtreeRevision_;
+        size_t subtreeFrameRevision_;
         
         
         
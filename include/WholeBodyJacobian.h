@@ -0,0 +1,168 @@
+/*
+ -------------------------------------------------------------------------------
+ WholeBodyJacobian.h
+ Robot Library Project
+
+ CLASS NAME:
+ WholeBodyJacobian
+
+ DESCRIPTION:
+ Stacked Jacobian of several end effectors of a Robot (joint frames, linkage
+ tools and the center of mass) against every joint of the robot. A frame
+ only depends on the joints between it and the robot base, so each task is
+ stored as a dense block over just those columns together with the joint
+ ids of the columns. The nonzero structure is fixed when the tasks are
+ added, and update() only refills the blocks.
+
+ Joints shared by several end effectors (the torso of a humanoid, for
+ instance) have their axis and origin computed once per update() and are
+ reused by every task that needs them.
+
+ FILES:
+ WholeBodyJacobian.h
+ WholeBodyJacobian.cpp
+
+ DEPENDENCIES:
+ Robot
+
+ CONSTRUCTORS:
+ WholeBodyJacobian(Robot& robot);
+
+ PROPERTIES:
+ taskRows_, taskColumns_, taskBlocks_ - first row of each task in the
+ stacked matrix, the joint ids its columns belong to (ascending), and its
+ 6 x m (3 x n for the center of mass) block of values.
+
+ METHODS:
+ rk_result_t addJoint(size_t jointIndex);
+ rk_result_t addTool(size_t linkageIndex);
+ rk_result_t addCenterOfMass();
+ Appends six rows for a joint frame or a linkage tool, or three rows for
+ the center of mass. Frame rows are linear velocity over angular velocity,
+ like Robot::jacobian().
+
+ void update(FrameType withRespectTo=ROBOT);
+ Recomputes every block at the current joint values, in ROBOT or WORLD
+ coordinates.
+
+ void multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const;
+ void multiplyTranspose(const Eigen::VectorXd& y, Eigen::VectorXd& x) const;
+ void outerProduct(Eigen::MatrixXd& JJt) const;
+ y = J*x, x = J^T*y and J*J^T, touching only the stored blocks. Two tasks
+ only meet on the joints they share, which are listed once when the tasks
+ are added.
+
+ void toDense(Eigen::MatrixXd& J) const;
+ Scatters the blocks into a dense rows() x cols() matrix.
+
+ NOTES:
+ Like KinematicModel, the structure is a snapshot of the robot when the
+ tasks are added. update() does not allocate once the blocks exist.
+
+
+ VERSIONS:
+ 1.0 - 10/17/26
+
+ -------------------------------------------------------------------------------
+ */
+
+
+
+#ifndef _WholeBodyJacobian_h_
+#define _WholeBodyJacobian_h_
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Frame.h"
+#include <vector>
+#include <string>
+#include <utility>
+#include <eigen3/Eigen/Core>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+
+namespace RobotKin {
+
+    class WholeBodyJacobian
+    {
+    public:
+        //--------------------------------------------------------------------------
+        // WholeBodyJacobian Lifecycle
+        //--------------------------------------------------------------------------
+        // Constructors
+        WholeBodyJacobian(Robot& robot);
+
+        // Destructor
+        virtual ~WholeBodyJacobian();
+
+        //--------------------------------------------------------------------------
+        // WholeBodyJacobian Public Member Functions
+        //--------------------------------------------------------------------------
+        rk_result_t addJoint(size_t jointIndex);
+        rk_result_t addJoint(const std::string& jointName);
+        rk_result_t addTool(size_t linkageIndex);
+        rk_result_t addTool(const std::string& linkageName);
+        rk_result_t addCenterOfMass();
+        void clear();
+
+        void update(FrameType withRespectTo=ROBOT);
+
+        size_t rows() const;
+        size_t cols() const; // Always the number of joints of the robot
+        size_t nonZeros() const; // Stored entries, including structural zeros
+
+        size_t nTasks() const;
+        size_t taskRow(size_t task) const;
+        const std::vector<size_t>& taskColumns(size_t task) const;
+        const Eigen::MatrixXd& taskBlock(size_t task) const;
+
+        void multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const;
+        void multiplyTranspose(const Eigen::VectorXd& y, Eigen::VectorXd& x) const;
+        void outerProduct(Eigen::MatrixXd& JJt) const;
+        void toDense(Eigen::MatrixXd& J) const;
+
+    protected:
+        //--------------------------------------------------------------------------
+        // WholeBodyJacobian Protected Member Functions
+        //--------------------------------------------------------------------------
+        void addTask(int jointIndex, int linkageIndex, size_t nRows, const std::vector<size_t>& columns);
+        void linkageAncestorJoints(size_t linkageIndex, std::vector<size_t>& columns) const;
+
+        //--------------------------------------------------------------------------
+        // WholeBodyJacobian Protected Member Variables
+        //--------------------------------------------------------------------------
+        Robot& robot_;
+
+        // Tasks. Joint frame tasks have a joint index, tool tasks a linkage
+        // index, and the center of mass neither (both -1).
+        std::vector<int> taskJoints_;
+        std::vector<int> taskLinkages_;
+        std::vector<size_t> taskRows_;
+        std::vector<std::vector<size_t> > taskColumns_;
+        std::vector<Eigen::MatrixXd> taskBlocks_;
+        size_t rows_;
+
+        // Column pairs (position in task a, position in task b) of the
+        // joints two tasks share, for every pair a <= b
+        std::vector<std::vector<std::pair<size_t, size_t> > > shared_;
+
+        // Every joint some frame task depends on, and the axes and origins of
+        // those joints in robot coordinates, indexed by joint id
+        std::vector<size_t> activeJoints_;
+        Eigen::Matrix3Xd axes_;
+        Eigen::Matrix3Xd origins_;
+        Eigen::Matrix3Xd comJacobian_;
+
+    }; // class WholeBodyJacobian
+
+} // namespace RobotKin
+
+#endif
+
+
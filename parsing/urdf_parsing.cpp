@@ -207,6 +207,8 @@ bool RobotKinURDF::addURDFJoint(RobotKin::Linkage &linkage, boost::shared_ptr<ur
     if(ujoint->limits)
     {
         RobotKin::Joint joint(transform, ujoint->name, 0, jt, jointAxis, ujoint->limits->lower, ujoint->limits->upper);
+        if(ujoint->limits->velocity > 0)
+            joint.maxVelocity(ujoint->limits->velocity);
         joint.link = link;
         linkage.addJoint(joint);
     }
@@ -0,0 +1,436 @@
+/*
+ -------------------------------------------------------------------------------
+ BatchKernels.cpp
+ Robot Library Project
+
+ SIMD-across-samples kernels for batch forward kinematics with runtime
+ instruction set dispatch.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "BatchKernels.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define RK_BATCH_X86
+#include <immintrin.h>
+#endif
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// Scalar kernels
+//------------------------------------------------------------------------------
+// These handle samples [begin, n) so the SIMD kernels can hand them the tail
+static void scalarConstantFrom(double* T, size_t n, size_t begin, const double* a, const double* b)
+{
+    for (size_t s = begin; s < n; ++s) {
+        double r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = T[i*n+s];
+
+        for (int row = 0; row < 3; ++row)
+            T[(9+row)*n+s] += r[row]*b[0] + r[3+row]*b[1] + r[6+row]*b[2];
+
+        for (int c = 0; c < 3; ++c)
+            for (int row = 0; row < 3; ++row)
+                T[(3*c+row)*n+s] = r[row]*a[3*c] + r[3+row]*a[3*c+1] + r[6+row]*a[3*c+2];
+    }
+}
+
+static void scalarRevoluteFrom(double* T, size_t n, size_t begin, const double* axis,
+                               const double* cq, const double* sq)
+{
+    const double x = axis[0], y = axis[1], z = axis[2];
+
+    for (size_t s = begin; s < n; ++s) {
+        // Rodrigues' formula for a rotation about a unit axis, column-major
+        double c = cq[s], sn = sq[s], t = 1-c;
+        double a[9] = { c + x*x*t,    y*x*t + z*sn, z*x*t - y*sn,
+                        x*y*t - z*sn, c + y*y*t,    z*y*t + x*sn,
+                        x*z*t + y*sn, y*z*t - x*sn, c + z*z*t };
+
+        double r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = T[i*n+s];
+
+        for (int col = 0; col < 3; ++col)
+            for (int row = 0; row < 3; ++row)
+                T[(3*col+row)*n+s] = r[row]*a[3*col] + r[3+row]*a[3*col+1] + r[6+row]*a[3*col+2];
+    }
+}
+
+static void scalarRevoluteCoordinateFrom(double* T, size_t n, size_t begin, int axis, double sign,
+                                         const double* cq, const double* sq)
+{
+    // Rotating about axis i only mixes columns j and k
+    double* Tj = T + 3*((axis+1)%3)*n;
+    double* Tk = T + 3*((axis+2)%3)*n;
+
+    for (size_t s = begin; s < n; ++s) {
+        double c = cq[s], sn = sign*sq[s];
+        for (int row = 0; row < 3; ++row) {
+            double rj = Tj[row*n+s], rk = Tk[row*n+s];
+            Tj[row*n+s] = c*rj + sn*rk;
+            Tk[row*n+s] = c*rk - sn*rj;
+        }
+    }
+}
+
+static void scalarPrismaticFrom(double* T, size_t n, size_t begin, const double* axis, const double* q)
+{
+    for (size_t s = begin; s < n; ++s)
+        for (int row = 0; row < 3; ++row)
+            T[(9+row)*n+s] += (T[row*n+s]*axis[0] + T[(3+row)*n+s]*axis[1] + T[(6+row)*n+s]*axis[2])*q[s];
+}
+
+static void scalarConstant(double* T, size_t n, const double* a, const double* b)
+{ scalarConstantFrom(T, n, 0, a, b); }
+
+static void scalarRevolute(double* T, size_t n, const double* axis, const double* c, const double* s)
+{ scalarRevoluteFrom(T, n, 0, axis, c, s); }
+
+static void scalarRevoluteCoordinate(double* T, size_t n, int axis, double sign, const double* c, const double* s)
+{ scalarRevoluteCoordinateFrom(T, n, 0, axis, sign, c, s); }
+
+static void scalarPrismatic(double* T, size_t n, const double* axis, const double* q)
+{ scalarPrismaticFrom(T, n, 0, axis, q); }
+
+
+#ifdef RK_BATCH_X86
+//------------------------------------------------------------------------------
+// AVX2 kernels (4 samples per instruction)
+//------------------------------------------------------------------------------
+#define RK_AVX2 __attribute__((target("avx2,fma")))
+
+// Every AVX2 and AVX-512 kernel below ends with _mm256_zeroupper() before it
+// hands the tail to the scalar kernels. Those are compiled as legacy SSE
+// code, which stalls while the upper halves of the vector registers are
+// dirty.
+
+// Writes R*A for the 9 rotation rows at sample s
+static inline RK_AVX2 void avx2Rotate(double* T, size_t n, size_t s, const __m256d r[9], const __m256d a[9])
+{
+    for (int col = 0; col < 3; ++col)
+        for (int row = 0; row < 3; ++row) {
+            __m256d v = _mm256_mul_pd(r[row], a[3*col]);
+            v = _mm256_fmadd_pd(r[3+row], a[3*col+1], v);
+            v = _mm256_fmadd_pd(r[6+row], a[3*col+2], v);
+            _mm256_storeu_pd(T + (3*col+row)*n + s, v);
+        }
+}
+
+static RK_AVX2 void avx2Constant(double* T, size_t n, const double* a, const double* b)
+{
+    __m256d av[9], bv[3];
+    for (int i = 0; i < 9; ++i)
+        av[i] = _mm256_set1_pd(a[i]);
+    for (int i = 0; i < 3; ++i)
+        bv[i] = _mm256_set1_pd(b[i]);
+
+    size_t s = 0;
+    for (; s + 4 <= n; s += 4) {
+        __m256d r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = _mm256_loadu_pd(T + i*n + s);
+
+        for (int row = 0; row < 3; ++row) {
+            __m256d p = _mm256_loadu_pd(T + (9+row)*n + s);
+            p = _mm256_fmadd_pd(r[row], bv[0], p);
+            p = _mm256_fmadd_pd(r[3+row], bv[1], p);
+            p = _mm256_fmadd_pd(r[6+row], bv[2], p);
+            _mm256_storeu_pd(T + (9+row)*n + s, p);
+        }
+
+        avx2Rotate(T, n, s, r, av);
+    }
+
+    _mm256_zeroupper();
+    scalarConstantFrom(T, n, s, a, b);
+}
+
+static RK_AVX2 void avx2Revolute(double* T, size_t n, const double* axis, const double* cq, const double* sq)
+{
+    const __m256d x = _mm256_set1_pd(axis[0]);
+    const __m256d y = _mm256_set1_pd(axis[1]);
+    const __m256d z = _mm256_set1_pd(axis[2]);
+    const __m256d xx = _mm256_mul_pd(x, x), yy = _mm256_mul_pd(y, y), zz = _mm256_mul_pd(z, z);
+    const __m256d xy = _mm256_mul_pd(x, y), xz = _mm256_mul_pd(x, z), yz = _mm256_mul_pd(y, z);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    size_t s = 0;
+    for (; s + 4 <= n; s += 4) {
+        __m256d c = _mm256_loadu_pd(cq + s);
+        __m256d sn = _mm256_loadu_pd(sq + s);
+        __m256d t = _mm256_sub_pd(one, c);
+        __m256d xs = _mm256_mul_pd(x, sn), ys = _mm256_mul_pd(y, sn), zs = _mm256_mul_pd(z, sn);
+
+        __m256d a[9];
+        a[0] = _mm256_fmadd_pd(xx, t, c);
+        a[1] = _mm256_fmadd_pd(xy, t, zs);
+        a[2] = _mm256_fmsub_pd(xz, t, ys);
+        a[3] = _mm256_fmsub_pd(xy, t, zs);
+        a[4] = _mm256_fmadd_pd(yy, t, c);
+        a[5] = _mm256_fmadd_pd(yz, t, xs);
+        a[6] = _mm256_fmadd_pd(xz, t, ys);
+        a[7] = _mm256_fmsub_pd(yz, t, xs);
+        a[8] = _mm256_fmadd_pd(zz, t, c);
+
+        __m256d r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = _mm256_loadu_pd(T + i*n + s);
+
+        avx2Rotate(T, n, s, r, a);
+    }
+
+    _mm256_zeroupper();
+    scalarRevoluteFrom(T, n, s, axis, cq, sq);
+}
+
+static RK_AVX2 void avx2RevoluteCoordinate(double* T, size_t n, int axis, double sign,
+                                           const double* cq, const double* sq)
+{
+    double* Tj = T + 3*((axis+1)%3)*n;
+    double* Tk = T + 3*((axis+2)%3)*n;
+    const __m256d sg = _mm256_set1_pd(sign);
+
+    size_t s = 0;
+    for (; s + 4 <= n; s += 4) {
+        __m256d c = _mm256_loadu_pd(cq + s);
+        __m256d sn = _mm256_mul_pd(sg, _mm256_loadu_pd(sq + s));
+        for (int row = 0; row < 3; ++row) {
+            __m256d rj = _mm256_loadu_pd(Tj + row*n + s);
+            __m256d rk = _mm256_loadu_pd(Tk + row*n + s);
+            _mm256_storeu_pd(Tj + row*n + s, _mm256_fmadd_pd(c, rj, _mm256_mul_pd(sn, rk)));
+            _mm256_storeu_pd(Tk + row*n + s, _mm256_fmsub_pd(c, rk, _mm256_mul_pd(sn, rj)));
+        }
+    }
+
+    _mm256_zeroupper();
+    scalarRevoluteCoordinateFrom(T, n, s, axis, sign, cq, sq);
+}
+
+static RK_AVX2 void avx2Prismatic(double* T, size_t n, const double* axis, const double* q)
+{
+    const __m256d ax = _mm256_set1_pd(axis[0]);
+    const __m256d ay = _mm256_set1_pd(axis[1]);
+    const __m256d az = _mm256_set1_pd(axis[2]);
+
+    size_t s = 0;
+    for (; s + 4 <= n; s += 4) {
+        __m256d qv = _mm256_loadu_pd(q + s);
+        for (int row = 0; row < 3; ++row) {
+            __m256d d = _mm256_mul_pd(_mm256_loadu_pd(T + row*n + s), ax);
+            d = _mm256_fmadd_pd(_mm256_loadu_pd(T + (3+row)*n + s), ay, d);
+            d = _mm256_fmadd_pd(_mm256_loadu_pd(T + (6+row)*n + s), az, d);
+            __m256d p = _mm256_fmadd_pd(d, qv, _mm256_loadu_pd(T + (9+row)*n + s));
+            _mm256_storeu_pd(T + (9+row)*n + s, p);
+        }
+    }
+
+    _mm256_zeroupper();
+    scalarPrismaticFrom(T, n, s, axis, q);
+}
+
+
+//------------------------------------------------------------------------------
+// AVX-512 kernels (8 samples per instruction)
+//------------------------------------------------------------------------------
+#define RK_AVX512 __attribute__((target("avx512f")))
+
+static inline RK_AVX512 void avx512Rotate(double* T, size_t n, size_t s, const __m512d r[9], const __m512d a[9])
+{
+    for (int col = 0; col < 3; ++col)
+        for (int row = 0; row < 3; ++row) {
+            __m512d v = _mm512_mul_pd(r[row], a[3*col]);
+            v = _mm512_fmadd_pd(r[3+row], a[3*col+1], v);
+            v = _mm512_fmadd_pd(r[6+row], a[3*col+2], v);
+            _mm512_storeu_pd(T + (3*col+row)*n + s, v);
+        }
+}
+
+static RK_AVX512 void avx512Constant(double* T, size_t n, const double* a, const double* b)
+{
+    __m512d av[9], bv[3];
+    for (int i = 0; i < 9; ++i)
+        av[i] = _mm512_set1_pd(a[i]);
+    for (int i = 0; i < 3; ++i)
+        bv[i] = _mm512_set1_pd(b[i]);
+
+    size_t s = 0;
+    for (; s + 8 <= n; s += 8) {
+        __m512d r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = _mm512_loadu_pd(T + i*n + s);
+
+        for (int row = 0; row < 3; ++row) {
+            __m512d p = _mm512_loadu_pd(T + (9+row)*n + s);
+            p = _mm512_fmadd_pd(r[row], bv[0], p);
+            p = _mm512_fmadd_pd(r[3+row], bv[1], p);
+            p = _mm512_fmadd_pd(r[6+row], bv[2], p);
+            _mm512_storeu_pd(T + (9+row)*n + s, p);
+        }
+
+        avx512Rotate(T, n, s, r, av);
+    }
+
+    _mm256_zeroupper();
+    scalarConstantFrom(T, n, s, a, b);
+}
+
+static RK_AVX512 void avx512Revolute(double* T, size_t n, const double* axis, const double* cq, const double* sq)
+{
+    const __m512d x = _mm512_set1_pd(axis[0]);
+    const __m512d y = _mm512_set1_pd(axis[1]);
+    const __m512d z = _mm512_set1_pd(axis[2]);
+    const __m512d xx = _mm512_mul_pd(x, x), yy = _mm512_mul_pd(y, y), zz = _mm512_mul_pd(z, z);
+    const __m512d xy = _mm512_mul_pd(x, y), xz = _mm512_mul_pd(x, z), yz = _mm512_mul_pd(y, z);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    size_t s = 0;
+    for (; s + 8 <= n; s += 8) {
+        __m512d c = _mm512_loadu_pd(cq + s);
+        __m512d sn = _mm512_loadu_pd(sq + s);
+        __m512d t = _mm512_sub_pd(one, c);
+        __m512d xs = _mm512_mul_pd(x, sn), ys = _mm512_mul_pd(y, sn), zs = _mm512_mul_pd(z, sn);
+
+        __m512d a[9];
+        a[0] = _mm512_fmadd_pd(xx, t, c);
+        a[1] = _mm512_fmadd_pd(xy, t, zs);
+        a[2] = _mm512_fmsub_pd(xz, t, ys);
+        a[3] = _mm512_fmsub_pd(xy, t, zs);
+        a[4] = _mm512_fmadd_pd(yy, t, c);
+        a[5] = _mm512_fmadd_pd(yz, t, xs);
+        a[6] = _mm512_fmadd_pd(xz, t, ys);
+        a[7] = _mm512_fmsub_pd(yz, t, xs);
+        a[8] = _mm512_fmadd_pd(zz, t, c);
+
+        __m512d r[9];
+        for (int i = 0; i < 9; ++i)
+            r[i] = _mm512_loadu_pd(T + i*n + s);
+
+        avx512Rotate(T, n, s, r, a);
+    }
+
+    _mm256_zeroupper();
+    scalarRevoluteFrom(T, n, s, axis, cq, sq);
+}
+
+static RK_AVX512 void avx512RevoluteCoordinate(double* T, size_t n, int axis, double sign,
+                                               const double* cq, const double* sq)
+{
+    double* Tj = T + 3*((axis+1)%3)*n;
+    double* Tk = T + 3*((axis+2)%3)*n;
+    const __m512d sg = _mm512_set1_pd(sign);
+
+    size_t s = 0;
+    for (; s + 8 <= n; s += 8) {
+        __m512d c = _mm512_loadu_pd(cq + s);
+        __m512d sn = _mm512_mul_pd(sg, _mm512_loadu_pd(sq + s));
+        for (int row = 0; row < 3; ++row) {
+            __m512d rj = _mm512_loadu_pd(Tj + row*n + s);
+            __m512d rk = _mm512_loadu_pd(Tk + row*n + s);
+            _mm512_storeu_pd(Tj + row*n + s, _mm512_fmadd_pd(c, rj, _mm512_mul_pd(sn, rk)));
+            _mm512_storeu_pd(Tk + row*n + s, _mm512_fmsub_pd(c, rk, _mm512_mul_pd(sn, rj)));
+        }
+    }
+
+    _mm256_zeroupper();
+    scalarRevoluteCoordinateFrom(T, n, s, axis, sign, cq, sq);
+}
+
+static RK_AVX512 void avx512Prismatic(double* T, size_t n, const double* axis, const double* q)
+{
+    const __m512d ax = _mm512_set1_pd(axis[0]);
+    const __m512d ay = _mm512_set1_pd(axis[1]);
+    const __m512d az = _mm512_set1_pd(axis[2]);
+
+    size_t s = 0;
+    for (; s + 8 <= n; s += 8) {
+        __m512d qv = _mm512_loadu_pd(q + s);
+        for (int row = 0; row < 3; ++row) {
+            __m512d d = _mm512_mul_pd(_mm512_loadu_pd(T + row*n + s), ax);
+            d = _mm512_fmadd_pd(_mm512_loadu_pd(T + (3+row)*n + s), ay, d);
+            d = _mm512_fmadd_pd(_mm512_loadu_pd(T + (6+row)*n + s), az, d);
+            __m512d p = _mm512_fmadd_pd(d, qv, _mm512_loadu_pd(T + (9+row)*n + s));
+            _mm512_storeu_pd(T + (9+row)*n + s, p);
+        }
+    }
+
+    _mm256_zeroupper();
+    scalarPrismaticFrom(T, n, s, axis, q);
+}
+#endif // RK_BATCH_X86
+
+
+//------------------------------------------------------------------------------
+// Dispatch
+//------------------------------------------------------------------------------
+static const char *BatchInstructionSet_string[BATCH_INSTRUCTION_SET_SIZE] =
+{
+    "BATCH_SCALAR",
+    "BATCH_AVX2",
+    "BATCH_AVX512"
+};
+
+const char* RobotKin::batchInstructionSetName(BatchInstructionSet instructionSet)
+{
+    if (0 <= instructionSet && instructionSet < BATCH_INSTRUCTION_SET_SIZE)
+        return BatchInstructionSet_string[instructionSet];
+    else
+        return "Unknown Instruction Set";
+}
+
+static const BatchKernelSet scalarKernels = { BATCH_SCALAR, scalarConstant, scalarRevolute,
+                                                 scalarRevoluteCoordinate, scalarPrismatic };
+#ifdef RK_BATCH_X86
+static const BatchKernelSet avx2Kernels = { BATCH_AVX2, avx2Constant, avx2Revolute,
+                                               avx2RevoluteCoordinate, avx2Prismatic };
+static const BatchKernelSet avx512Kernels = { BATCH_AVX512, avx512Constant, avx512Revolute,
+                                                 avx512RevoluteCoordinate, avx512Prismatic };
+#endif
+
+const BatchKernelSet* RobotKin::batchKernels(BatchInstructionSet instructionSet)
+{
+    if (instructionSet == BATCH_SCALAR)
+        return &scalarKernels;
+
+#ifdef RK_BATCH_X86
+    __builtin_cpu_init();
+    if (instructionSet == BATCH_AVX2
+            && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return &avx2Kernels;
+    if (instructionSet == BATCH_AVX512 && __builtin_cpu_supports("avx512f"))
+        return &avx512Kernels;
+#endif
+
+    return NULL;
+}
+
+static const BatchKernelSet& selectBatchKernels()
+{
+    for (int set = BATCH_INSTRUCTION_SET_SIZE-1; set > BATCH_SCALAR; --set) {
+        const BatchKernelSet* kernels = batchKernels(static_cast<BatchInstructionSet>(set));
+        if (kernels != NULL)
+            return *kernels;
+    }
+    return scalarKernels;
+}
+
+const BatchKernelSet& RobotKin::batchKernels()
+{
+    static const BatchKernelSet& kernels = selectBatchKernels();
+    return kernels;
+}
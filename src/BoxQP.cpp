@@ -0,0 +1,232 @@
+/*
+ -------------------------------------------------------------------------------
+ BoxQP.cpp
+ Robot Library Project
+
+ Warm started active set solver for bound constrained quadratic programs.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "BoxQP.h"
+#include <eigen3/Eigen/Cholesky>
+#include <iostream>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// BoxQP Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+BoxQP::BoxQP()
+    : maxIterations(100),
+      iterations_(0)
+{
+    resize(0);
+}
+
+BoxQP::BoxQP(size_t nVariables)
+    : maxIterations(100),
+      iterations_(0)
+{
+    resize(nVariables);
+}
+
+// Destructor
+BoxQP::~BoxQP()
+{
+
+}
+
+
+//------------------------------------------------------------------------------
+// BoxQP Public Member Functions
+//------------------------------------------------------------------------------
+void BoxQP::resize(size_t nVariables)
+{
+    bounds_.assign(nVariables, 0);
+    free_.reserve(nVariables);
+    reduced_.resize(nVariables, nVariables);
+    solution_.resize(nVariables);
+    gradient_.resize(nVariables);
+}
+
+size_t BoxQP::size() const { return bounds_.size(); }
+
+void BoxQP::reset()
+{
+    for(size_t i=0; i<bounds_.size(); i++)
+        bounds_[i] = 0;
+}
+
+rk_result_t BoxQP::solve(const MatrixXd& H, const VectorXd& g,
+                         const VectorXd& lower, const VectorXd& upper, VectorXd& x)
+{
+    const double tolerance = 1e-10;
+    size_t n = g.size();
+
+    if(H.rows() != (Index)n || H.cols() != (Index)n || lower.size() != (Index)n || upper.size() != (Index)n)
+    {
+        cerr << "ERROR! QP sizes do not match: H is " << H.rows() << "x" << H.cols()
+             << ", g has " << n << " entries and the bounds " << lower.size()
+             << " and " << upper.size() << endl;
+        return RK_NO_SOLUTION;
+    }
+
+    // Only allocates if the problem changed size
+    if(size() != n)
+        resize(n);
+    if(x.size() != (Index)n)
+        x.resize(n);
+
+    // Start from the last active set. Free variables start as close to zero
+    // as the bounds allow, so the starting point is always feasible.
+    for(size_t i=0; i<n; i++)
+    {
+        if(lower[i] > upper[i])
+        {
+            cerr << "ERROR! Bounds of variable " << i << " cross: ("
+                 << lower[i] << " > " << upper[i] << ")" << endl;
+            return RK_NO_SOLUTION;
+        }
+
+        if(bounds_[i] < 0)
+            x[i] = lower[i];
+        else if(bounds_[i] > 0)
+            x[i] = upper[i];
+        else
+            x[i] = std::min(std::max(0.0, lower[i]), upper[i]);
+    }
+
+    for(iterations_=0; iterations_<maxIterations; iterations_++)
+    {
+        free_.clear();
+        for(size_t i=0; i<n; i++)
+            if(bounds_[i] == 0)
+                free_.push_back(i);
+        size_t m = free_.size();
+
+        // Minimize over the free variables with the others held:
+        // H_ff x_f = -g_f - H_fh x_h
+        for(size_t a=0; a<m; a++)
+        {
+            size_t i = free_[a];
+            double rhs = -g[i];
+            for(size_t j=0; j<n; j++)
+                if(bounds_[j] != 0)
+                    rhs -= H(i,j)*x[j];
+            solution_[a] = rhs;
+
+            for(size_t b=0; b<=a; b++)
+                reduced_(a,b) = H(i, free_[b]);
+        }
+
+        if(m > 0)
+        {
+            Ref<MatrixXd> block(reduced_.topLeftCorner(m, m));
+            LLT<Ref<MatrixXd> > factor(block);
+            if(factor.info() != Success)
+            {
+                cerr << "ERROR! QP Hessian is not positive definite" << endl;
+                return RK_NO_SOLUTION;
+            }
+
+            VectorBlock<VectorXd> solution(solution_, 0, m);
+            factor.solveInPlace(solution);
+        }
+
+        // Walk towards the free minimizer until the first bound in the way
+        double alpha = 1;
+        int blocking = -1;
+        int blockingBound = 0;
+        for(size_t a=0; a<m; a++)
+        {
+            size_t i = free_[a];
+            double step = solution_[a] - x[i];
+
+            if(solution_[a] < lower[i] - tolerance && step < 0)
+            {
+                double t = (lower[i] - x[i])/step;
+                if(t < alpha)
+                {
+                    alpha = t;
+                    blocking = (int)i;
+                    blockingBound = -1;
+                }
+            }
+            else if(solution_[a] > upper[i] + tolerance && step > 0)
+            {
+                double t = (upper[i] - x[i])/step;
+                if(t < alpha)
+                {
+                    alpha = t;
+                    blocking = (int)i;
+                    blockingBound = 1;
+                }
+            }
+        }
+
+        for(size_t a=0; a<m; a++)
+            x[free_[a]] += alpha*(solution_[a] - x[free_[a]]);
+
+        if(blocking >= 0)
+        {
+            bounds_[blocking] = blockingBound;
+            x[blocking] = blockingBound < 0 ? lower[blocking] : upper[blocking];
+            continue;
+        }
+
+        // At the minimizer of this active set. A held variable whose
+        // gradient points into the box (the wrong multiplier sign) can
+        // still lower the cost, so release the worst one.
+        int release = -1;
+        double worst = tolerance;
+        for(size_t i=0; i<n; i++)
+        {
+            if(bounds_[i] == 0 || lower[i] == upper[i])
+                continue;
+
+            gradient_[i] = H.col(i).dot(x) + g[i];
+            double violation = bounds_[i] < 0 ? -gradient_[i] : gradient_[i];
+            if(violation > worst)
+            {
+                worst = violation;
+                release = (int)i;
+            }
+        }
+
+        if(release < 0)
+            return RK_SOLVED;
+
+        bounds_[release] = 0;
+    }
+
+    return RK_DIVERGED;
+}
+
+int BoxQP::bound(size_t variable) const { return bounds_[variable]; }
+
+size_t BoxQP::nActive() const
+{
+    size_t active = 0;
+    for(size_t i=0; i<bounds_.size(); i++)
+        if(bounds_[i] != 0)
+            active++;
+    return active;
+}
+
+size_t BoxQP::iterations() const { return iterations_; }
@@ -2,6 +2,7 @@
 
 #include "Robot.h"
 #include "Constraints.h"
+#include "KinematicModel.h"
 
 #include <time.h>
 
@@ -27,7 +28,9 @@ Constraints::Constraints()
       performDeltaClamp(true),
       deltaClamp(5*M_PI/180),
       wrapToJointLimits(true),
-      wrapSolutionToJointLimits(true)
+      wrapSolutionToJointLimits(true),
+      timeStep(0),
+      useAnalyticalIK(true)
 {
 
 }
@@ -61,11 +64,41 @@ VectorXd Constraints::nullSpaceTask(Robot& robot, const std::vector<size_t> &ind
     return nullTask;
 }
 
+void Constraints::nullSpaceTask(Robot& robot, const std::vector<size_t> &indices,
+                                const VectorXd& values, VectorXd& nullTask, const IKWorkspace&)
+{
+    nullSpaceTask(robot, indices, values, nullTask);
+}
+
+void Constraints::nullSpaceTask(const KinematicModel&, const KinematicState&,
+                                const std::vector<size_t>&, const VectorXd& values,
+                                VectorXd& nullTask) const
+{
+    restingValuesTask(values, nullTask);
+}
+
+void Constraints::restingValuesTask(const VectorXd& values, VectorXd& nullTask) const
+{
+    if(hasRestingValues)
+    {
+        nullTask = restingValues_ - values;
+        clampMag(nullTask, 0.1);
+    }
+    else
+        nullTask.setZero(values.size());
+}
+
 void Constraints::errorClamp(Robot &robot, const std::vector<size_t> &indices, SCREW &error)
 {
 
 }
 
+void Constraints::errorClamp(const KinematicModel&, const KinematicState&,
+                             const std::vector<size_t>&, SCREW&) const
+{
+
+}
+
 void Constraints::iterativeJacobianSeed(Robot& robot, size_t attemptNumber,
                                         const std::vector<size_t> &indices, Eigen::VectorXd &values)
 {
@@ -101,3 +134,29 @@ void Constraints::iterativeJacobianSeed(Robot& robot, size_t attemptNumber,
 
 
 
+
+void Constraints::iterativeJacobianSeed(const KinematicModel& model, KinematicState& state,
+                                        size_t attemptNumber, const std::vector<size_t> &indices,
+                                        Eigen::VectorXd &values) const
+{
+    if( attemptNumber == 0 )
+        return;
+    else if( attemptNumber == 1 && hasRestingValues
+             && values.size() == restingValues_.size() )
+        for(int i=0; i<values.size(); i++)
+            values(i) = restingValues_(i);
+    else if( attemptNumber == 2 )
+    {
+        state.imposeLimits = false;
+        for(int i=0; i<values.size(); i++)
+            values(i) = 0;
+    }
+    else
+    {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for(int i=0; i<values.size(); i++)
+            values(i) = unit(state.random)
+                    *(model.max(indices[i]) - model.min(indices[i]))
+                    + model.min(indices[i]);
+    }
+}
@@ -0,0 +1,526 @@
+/*
+ -------------------------------------------------------------------------------
+ Dynamics.cpp
+ Robot Library Project
+
+ Rigid body dynamics over the Robot tree.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "Robot.h"
+#include <iostream>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// Local Functions
+//------------------------------------------------------------------------------
+// Adds the force and the moment about origin that it takes to give link
+// (attached to frame) the motion of the rigid body whose origin has
+// acceleration accel and which spins at omega, alpha.
+static void addLinkWrench(const Link& link, const TRANSFORM& frame, const TRANSLATION& origin,
+                          const TRANSLATION& omega, const TRANSLATION& alpha, const TRANSLATION& accel,
+                          TRANSLATION& force, TRANSLATION& moment)
+{
+    if(link.mass() == 0 && !link.hasTensor())
+        return;
+
+    TRANSLATION r = frame*link.const_com() - origin;
+    TRANSLATION F = link.mass()*(accel + alpha.cross(r) + omega.cross(omega.cross(r)));
+
+    force += F;
+    moment += r.cross(F);
+
+    if(link.hasTensor())
+    {
+        Matrix3d I = frame.rotation()*link.const_tensor()*frame.rotation().transpose();
+        moment += I*alpha + omega.cross(I*omega);
+    }
+}
+
+static Matrix3d skew(const TRANSLATION& v)
+{
+    Matrix3d S;
+    S <<     0, -v[2],  v[1],
+          v[2],     0, -v[0],
+         -v[1],  v[0],     0;
+    return S;
+}
+
+// Spatial cross products in (angular, linear) order: v x m for a motion m
+// and v x* f for a force f
+static SCREW crossMotion(const SCREW& v, const SCREW& m)
+{
+    SCREW result;
+    result << v.head<3>().cross(m.head<3>()),
+              v.tail<3>().cross(m.head<3>()) + v.head<3>().cross(m.tail<3>());
+    return result;
+}
+
+static SCREW crossForce(const SCREW& v, const SCREW& f)
+{
+    SCREW result;
+    result << v.head<3>().cross(f.head<3>()) + v.tail<3>().cross(f.tail<3>()),
+              v.head<3>().cross(f.tail<3>());
+    return result;
+}
+
+// Adds the spatial inertia of link (attached to frame) about the robot
+// origin, in (angular, linear) order.
+static void addLinkInertia(const Link& link, const TRANSFORM& frame, Matrix6d& inertia)
+{
+    if(link.mass() == 0 && !link.hasTensor())
+        return;
+
+    double m = link.mass();
+    Matrix3d C = skew(frame*link.const_com());
+
+    if(link.hasTensor())
+        inertia.topLeftCorner<3,3>() += frame.rotation()*link.const_tensor()*frame.rotation().transpose();
+    inertia.topLeftCorner<3,3>() -= m*C*C;
+    inertia.topRightCorner<3,3>() += m*C;
+    inertia.bottomLeftCorner<3,3>() -= m*C;
+    inertia.bottomRightCorner<3,3>().diagonal().array() += m;
+}
+
+
+
+//------------------------------------------------------------------------------
+// Robot Dynamics
+//------------------------------------------------------------------------------
+void Robot::dynamicsValues(const VectorXd &q)
+{
+    bool wasImposing = imposeLimits;
+    imposeLimits = false;
+    values(q);
+    imposeLimits = wasImposing;
+}
+
+void Robot::updateDynamicsTree()
+{
+    dynamicsParent_.resize(joints_.size());
+    dynamicsLinkageBody_.resize(linkages_.size());
+
+    for(size_t l=0; l<linkages_.size(); l++)
+    {
+        Linkage& L = *linkages_[l];
+        int parent = L.hasParent ? dynamicsLinkageBody_[L.parentLinkage_->id()] : -1;
+
+        for(size_t j=0; j<L.joints_.size(); j++)
+        {
+            dynamicsParent_[L.joints_[j]->id()] = parent;
+            parent = L.joints_[j]->id();
+        }
+
+        dynamicsLinkageBody_[l] = parent;
+    }
+}
+
+void Robot::updateDynamicsInertia()
+{
+    updateDynamicsTree();
+
+    dynamicsInertia_.resize(joints_.size());
+    dynamicsMotion_.resize(6, joints_.size());
+
+    // Every link's spatial inertia and joint motion axis about the robot
+    // origin. Tools ride on the last link of their linkage.
+    for(size_t l=0; l<linkages_.size(); l++)
+    {
+        Linkage& L = *linkages_[l];
+
+        for(size_t j=0; j<L.joints_.size(); j++)
+        {
+            Joint& joint = *L.joints_[j];
+            size_t k = joint.id();
+            TRANSFORM frame = joint.respectToRobot();
+            AXIS z = frame.rotation()*joint.jointAxis_;
+
+            dynamicsInertia_[k].setZero();
+            addLinkInertia(joint.link, frame, dynamicsInertia_[k]);
+
+            if(joint.jointType_ == REVOLUTE)
+                dynamicsMotion_.col(k) << z, frame.translation().cross(z);
+            else if(joint.jointType_ == PRISMATIC)
+                dynamicsMotion_.col(k) << TRANSLATION::Zero(), z;
+            else
+                dynamicsMotion_.col(k).setZero();
+        }
+
+        int body = dynamicsLinkageBody_[l];
+        if(body >= 0)
+            addLinkInertia(L.tool_.massProperties, L.tool_.respectToRobot(), dynamicsInertia_[body]);
+    }
+}
+
+rk_result_t Robot::inverseDynamics(const VectorXd &q, const VectorXd &qd, const VectorXd &qdd,
+                                   VectorXd &torques)
+{
+    size_t nJ = joints_.size();
+    size_t nL = linkages_.size();
+
+    if((size_t)q.size() != nJ || (size_t)qd.size() != nJ || (size_t)qdd.size() != nJ)
+    {
+        cerr << "ERROR! Inverse dynamics needs " << nJ << " values each for q, qd and qdd "
+             << "but got " << q.size() << ", " << qd.size() << " and " << qdd.size() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    dynamicsValues(q);
+    updateDynamicsTree();
+
+    dynamicsOrigin_.resize(nJ);
+    dynamicsAxis_.resize(nJ);
+    dynamicsOmega_.resize(nJ);
+    dynamicsAlpha_.resize(nJ);
+    dynamicsAccel_.resize(nJ);
+    dynamicsForce_.resize(nJ);
+    dynamicsMoment_.resize(nJ);
+    torques.resize(nJ);
+
+    // Gravity enters as an upward acceleration of the fixed base
+    const TRANSLATION baseAccel = TRANSLATION::UnitZ()*gravity_constant;
+
+    // Forward pass: velocities and accelerations from the base outward
+    for(size_t l=0; l<nL; l++)
+    {
+        Linkage& L = *linkages_[l];
+
+        for(size_t j=0; j<L.joints_.size(); j++)
+        {
+            Joint& joint = *L.joints_[j];
+            size_t k = joint.id();
+            int parent = dynamicsParent_[k];
+            TRANSFORM frame = joint.respectToRobot();
+
+            dynamicsOrigin_[k] = frame.translation();
+            dynamicsAxis_[k] = frame.rotation()*joint.jointAxis_;
+
+            const TRANSLATION& z = dynamicsAxis_[k];
+            TRANSLATION& omega = dynamicsOmega_[k];
+            TRANSLATION& alpha = dynamicsAlpha_[k];
+            TRANSLATION& accel = dynamicsAccel_[k];
+
+            if(parent < 0)
+            {
+                omega.setZero();
+                alpha.setZero();
+                accel = baseAccel;
+            }
+            else
+            {
+                const TRANSLATION& w = dynamicsOmega_[parent];
+                TRANSLATION d = dynamicsOrigin_[k] - dynamicsOrigin_[parent];
+                omega = w;
+                alpha = dynamicsAlpha_[parent];
+                accel = dynamicsAccel_[parent] + alpha.cross(d) + w.cross(w.cross(d));
+            }
+
+            if(joint.jointType_ == REVOLUTE)
+            {
+                alpha += z*qdd[k] + omega.cross(z)*qd[k];
+                omega += z*qd[k];
+            }
+            else if(joint.jointType_ == PRISMATIC)
+                accel += z*qdd[k] + 2*omega.cross(z)*qd[k];
+
+            dynamicsForce_[k].setZero();
+            dynamicsMoment_[k].setZero();
+            addLinkWrench(joint.link, frame, dynamicsOrigin_[k], omega, alpha, accel,
+                          dynamicsForce_[k], dynamicsMoment_[k]);
+        }
+    }
+
+    // Backward pass: linkages are stored parents first, so walking them
+    // backwards hands every child's load to its parent before the parent's
+    // joints are read
+    for(int l=nL-1; l>=0; l--)
+    {
+        Linkage& L = *linkages_[l];
+
+        int body = dynamicsLinkageBody_[l];
+        if(body >= 0)
+            addLinkWrench(L.tool_.massProperties, L.tool_.respectToRobot(), dynamicsOrigin_[body],
+                          dynamicsOmega_[body], dynamicsAlpha_[body], dynamicsAccel_[body],
+                          dynamicsForce_[body], dynamicsMoment_[body]);
+
+        for(int j=L.joints_.size()-1; j>=0; j--)
+        {
+            Joint& joint = *L.joints_[j];
+            size_t k = joint.id();
+
+            if(joint.jointType_ == REVOLUTE)
+                torques[k] = dynamicsMoment_[k].dot(dynamicsAxis_[k]);
+            else if(joint.jointType_ == PRISMATIC)
+                torques[k] = dynamicsForce_[k].dot(dynamicsAxis_[k]);
+            else
+                torques[k] = 0;
+
+            int parent = dynamicsParent_[k];
+            if(parent >= 0)
+            {
+                dynamicsForce_[parent] += dynamicsForce_[k];
+                dynamicsMoment_[parent] += dynamicsMoment_[k]
+                        + (dynamicsOrigin_[k] - dynamicsOrigin_[parent]).cross(dynamicsForce_[k]);
+            }
+        }
+    }
+
+    return RK_SOLVED;
+}
+
+rk_result_t Robot::massMatrix(const VectorXd &q, MatrixXd &M)
+{
+    size_t nJ = joints_.size();
+
+    if((size_t)q.size() != nJ)
+    {
+        cerr << "ERROR! Mass matrix needs " << nJ << " joint values but got " << q.size() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    dynamicsValues(q);
+    updateDynamicsInertia();
+    M.setZero(nJ, nJ);
+
+    // Children always have larger ids than their parents, so counting down
+    // finishes each composite inertia before it is passed on. All of them are
+    // taken about the same origin, which makes passing on a plain sum. Only
+    // joints on a common branch get entries; independent limbs stay zero.
+    for(int k=nJ-1; k>=0; k--)
+    {
+        SCREW F = dynamicsInertia_[k]*dynamicsMotion_.col(k);
+        M(k,k) = dynamicsMotion_.col(k).dot(F);
+
+        for(int j=dynamicsParent_[k]; j>=0; j=dynamicsParent_[j])
+            M(j,k) = M(k,j) = dynamicsMotion_.col(j).dot(F);
+
+        if(dynamicsParent_[k] >= 0)
+            dynamicsInertia_[dynamicsParent_[k]] += dynamicsInertia_[k];
+    }
+
+    return RK_SOLVED;
+}
+
+rk_result_t Robot::massMatrix(const VectorXd &q, const vector<size_t> &jointIndices, MatrixXd &M)
+{
+    rk_result_t result = massMatrix(q, dynamicsMass_);
+    if(result != RK_SOLVED)
+        return result;
+
+    M.resize(jointIndices.size(), jointIndices.size());
+    for(size_t i=0; i<jointIndices.size(); i++)
+        for(size_t j=0; j<jointIndices.size(); j++)
+            M(i,j) = dynamicsMass_(jointIndices[i], jointIndices[j]);
+
+    return RK_SOLVED;
+}
+
+// Featherstone's LTL factorization. Eliminating from the tips inward only
+// ever touches a joint and its ancestors, so no fill-in appears outside the
+// branches.
+rk_result_t Robot::factorMassMatrix(MatrixXd &M)
+{
+    if((size_t)M.rows() != joints_.size() || (size_t)M.cols() != joints_.size())
+    {
+        cerr << "ERROR! Mass matrix must be " << joints_.size() << "x" << joints_.size()
+             << " but is " << M.rows() << "x" << M.cols() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    updateDynamicsTree();
+
+    for(int k=M.rows()-1; k>=0; k--)
+    {
+        if(M(k,k) <= 0)
+        {
+            cerr << "ERROR! Mass matrix is not positive definite at joint "
+                 << joints_[k]->name() << "!" << endl;
+            return RK_NO_SOLUTION;
+        }
+
+        M(k,k) = sqrt(M(k,k));
+        for(int i=dynamicsParent_[k]; i>=0; i=dynamicsParent_[i])
+            M(k,i) /= M(k,k);
+
+        for(int i=dynamicsParent_[k]; i>=0; i=dynamicsParent_[i])
+            for(int j=i; j>=0; j=dynamicsParent_[j])
+                M(i,j) -= M(k,i)*M(k,j);
+    }
+
+    M.triangularView<StrictlyUpper>().setZero();
+
+    return RK_SOLVED;
+}
+
+void Robot::massMatrixSolve(const MatrixXd &L, VectorXd &x)
+{
+    updateDynamicsTree();
+
+    // x = L^-T x
+    for(int i=L.rows()-1; i>=0; i--)
+    {
+        x[i] /= L(i,i);
+        for(int j=dynamicsParent_[i]; j>=0; j=dynamicsParent_[j])
+            x[j] -= L(i,j)*x[i];
+    }
+
+    // x = L^-1 x
+    for(int i=0; i<L.rows(); i++)
+    {
+        for(int j=dynamicsParent_[i]; j>=0; j=dynamicsParent_[j])
+            x[i] -= L(i,j)*x[j];
+        x[i] /= L(i,i);
+    }
+}
+
+void Robot::massMatrixInverse(const MatrixXd &L, MatrixXd &Minv)
+{
+    updateDynamicsTree();
+
+    Minv.setZero(L.rows(), L.cols());
+    for(int c=0; c<Minv.cols(); c++)
+    {
+        // L^-T of a unit vector is only nonzero on the joint and its ancestors
+        Minv(c,c) = 1;
+        for(int i=c; i>=0; i=dynamicsParent_[i])
+        {
+            Minv(i,c) /= L(i,i);
+            for(int j=dynamicsParent_[i]; j>=0; j=dynamicsParent_[j])
+                Minv(j,c) -= L(i,j)*Minv(i,c);
+        }
+
+        for(int i=0; i<L.rows(); i++)
+        {
+            for(int j=dynamicsParent_[i]; j>=0; j=dynamicsParent_[j])
+                Minv(i,c) -= L(i,j)*Minv(j,c);
+            Minv(i,c) /= L(i,i);
+        }
+    }
+}
+
+// Featherstone's articulated body algorithm, with every spatial quantity
+// taken about the robot origin
+rk_result_t Robot::forwardDynamics(const VectorXd &q, const VectorXd &qd, const VectorXd &torques,
+                                   VectorXd &qdd)
+{
+    size_t nJ = joints_.size();
+
+    if((size_t)q.size() != nJ || (size_t)qd.size() != nJ || (size_t)torques.size() != nJ)
+    {
+        cerr << "ERROR! Forward dynamics needs " << nJ << " values each for q, qd and torques "
+             << "but got " << q.size() << ", " << qd.size() << " and " << torques.size() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    dynamicsValues(q);
+    updateDynamicsInertia();
+
+    dynamicsVelocity_.resize(6, nJ);
+    dynamicsBias_.resize(6, nJ);
+    dynamicsBiasForce_.resize(6, nJ);
+    dynamicsU_.resize(6, nJ);
+    dynamicsD_.resize(nJ);
+    dynamicsu_.resize(nJ);
+    dynamicsAcceleration_.resize(6, nJ);
+    qdd.resize(nJ);
+
+    // Velocities, velocity product accelerations and bias forces outward
+    for(size_t k=0; k<nJ; k++)
+    {
+        int parent = dynamicsParent_[k];
+        SCREW Sqd = dynamicsMotion_.col(k)*qd[k];
+
+        if(parent < 0)
+        {
+            dynamicsVelocity_.col(k) = Sqd;
+            dynamicsBias_.col(k).setZero();
+        }
+        else
+        {
+            dynamicsVelocity_.col(k) = dynamicsVelocity_.col(parent) + Sqd;
+            dynamicsBias_.col(k) = crossMotion(dynamicsVelocity_.col(parent), Sqd);
+        }
+
+        SCREW v = dynamicsVelocity_.col(k);
+        dynamicsBiasForce_.col(k) = crossForce(v, dynamicsInertia_[k]*v);
+    }
+
+    // Articulated inertias and bias forces inward. Children always have
+    // larger ids than their parents, so counting down finishes each one
+    // before it is passed on.
+    for(int k=nJ-1; k>=0; k--)
+    {
+        const Matrix6d& IA = dynamicsInertia_[k];
+        int parent = dynamicsParent_[k];
+
+        dynamicsU_.col(k) = IA*dynamicsMotion_.col(k);
+        dynamicsD_[k] = dynamicsMotion_.col(k).dot(dynamicsU_.col(k));
+        dynamicsu_[k] = torques[k] - dynamicsMotion_.col(k).dot(dynamicsBiasForce_.col(k));
+
+        if(parent < 0)
+            continue;
+
+        // Anchored joints hand their whole body on to the parent
+        if(dynamicsD_[k] == 0)
+        {
+            dynamicsInertia_[parent] += IA;
+            dynamicsBiasForce_.col(parent) += dynamicsBiasForce_.col(k) + IA*dynamicsBias_.col(k);
+            continue;
+        }
+
+        SCREW U = dynamicsU_.col(k);
+        Matrix6d Ia = IA - U*U.transpose()/dynamicsD_[k];
+        dynamicsInertia_[parent] += Ia;
+        dynamicsBiasForce_.col(parent) += dynamicsBiasForce_.col(k) + Ia*dynamicsBias_.col(k)
+                + U*dynamicsu_[k]/dynamicsD_[k];
+    }
+
+    // Gravity enters as an upward acceleration of the fixed base
+    SCREW baseAcceleration;
+    baseAcceleration << 0, 0, 0, 0, 0, gravity_constant;
+
+    // Accelerations outward
+    for(size_t k=0; k<nJ; k++)
+    {
+        int parent = dynamicsParent_[k];
+        SCREW a = dynamicsBias_.col(k);
+        a += parent < 0 ? baseAcceleration : SCREW(dynamicsAcceleration_.col(parent));
+
+        if(dynamicsD_[k] == 0)
+            qdd[k] = 0;
+        else
+            qdd[k] = (dynamicsu_[k] - dynamicsU_.col(k).dot(a))/dynamicsD_[k];
+
+        dynamicsAcceleration_.col(k) = a + dynamicsMotion_.col(k)*qdd[k];
+    }
+
+    return RK_SOLVED;
+}
+
+rk_result_t Robot::stepDynamics(VectorXd &q, VectorXd &qd, const VectorXd &torques, double dt)
+{
+    rk_result_t result = forwardDynamics(q, qd, torques, dynamicsQdd_);
+    if(result != RK_SOLVED)
+        return result;
+
+    qd += dt*dynamicsQdd_;
+    q += dt*qd;
+
+    return RK_SOLVED;
+}
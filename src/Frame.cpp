@@ -51,6 +51,93 @@ string RobotKin::JointType_to_string(JointType type)
         return "Unknown Joint Type";
 }
 
+static const char *AxisType_string[AXIS_TYPE_SIZE] =
+{
+    "AXIS_ARBITRARY",
+    "AXIS_X",
+    "AXIS_Y",
+    "AXIS_Z",
+    "AXIS_NEGATIVE_X",
+    "AXIS_NEGATIVE_Y",
+    "AXIS_NEGATIVE_Z"
+};
+
+string RobotKin::AxisType_to_string(AxisType type)
+{
+    if( 0 <= type && type < AXIS_TYPE_SIZE )
+        return AxisType_string[type];
+    else
+        return "Unknown Axis Type";
+}
+
+AxisType RobotKin::classifyAxis(const AXIS& axis)
+{
+    const double tol = 1e-12;
+    for(int i=0; i<3; i++)
+    {
+        if( fabs(axis[(i+1)%3]) > tol || fabs(axis[(i+2)%3]) > tol )
+            continue;
+
+        if( fabs(axis[i]-1) <= tol )
+            return static_cast<AxisType>(AXIS_X+i);
+        if( fabs(axis[i]+1) <= tol )
+            return static_cast<AxisType>(AXIS_NEGATIVE_X+i);
+    }
+
+    return AXIS_ARBITRARY;
+}
+
+int RobotKin::axisIndex(AxisType type)
+{
+    if( AXIS_X <= type && type <= AXIS_Z )
+        return type - AXIS_X;
+    else if( AXIS_NEGATIVE_X <= type && type <= AXIS_NEGATIVE_Z )
+        return type - AXIS_NEGATIVE_X;
+    else
+        return -1;
+}
+
+double RobotKin::axisSign(AxisType type)
+{
+    if( AXIS_NEGATIVE_X <= type && type <= AXIS_NEGATIVE_Z )
+        return -1;
+    else
+        return 1;
+}
+
+void RobotKin::jointTransform(TRANSFORM& result, const TRANSFORM& respectToFixed, JointType jointType,
+                              AxisType axisType, const AXIS& axis, double value)
+{
+    int i = axisIndex(axisType);
+
+    if( jointType == REVOLUTE && i >= 0 )
+    {
+        // Rotating about axis i only mixes the other two columns
+        double c = cos(value), s = axisSign(axisType)*sin(value);
+        int j = (i+1)%3, k = (i+2)%3;
+        Matrix3d R = respectToFixed.linear();
+        AXIS colJ = R.col(j);
+
+        R.col(j) = c*colJ + s*R.col(k);
+        R.col(k) = c*R.col(k) - s*colJ;
+
+        result.translation() = respectToFixed.translation();
+        result.linear() = R;
+        result.makeAffine();
+    }
+    else if( jointType == REVOLUTE )
+        result = respectToFixed * Eigen::AngleAxisd(value, axis);
+    else if( jointType == PRISMATIC && i >= 0 )
+    {
+        result = respectToFixed;
+        result.translation() += axisSign(axisType)*value*respectToFixed.linear().col(i);
+    }
+    else if( jointType == PRISMATIC )
+        result = respectToFixed * Eigen::Translation3d(value*axis);
+    else
+        result = respectToFixed;
+}
+
 
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,408 @@
+/*
+ -------------------------------------------------------------------------------
+ HierarchicalIK.cpp
+ Robot Library Project
+
+ Prioritized whole body IK with recursive null space projection.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "HierarchicalIK.h"
+#include "Robot.h"
+#include <iostream>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+// Squared damping of the projectors. Only there to keep the factorization
+// definite when the projected Jacobian loses rank.
+static const double projectorDamping = 1e-10;
+
+static void rotationError(const Matrix3d& rotation, const Matrix3d& target, TRANSLATION& Rerr)
+{
+    AngleAxisd aaerr(target*rotation.transpose());
+    if(fabs(aaerr.angle()) <= M_PI)
+        Rerr = aaerr.angle()*aaerr.axis();
+    else
+        Rerr = (aaerr.angle()-2*M_PI)*aaerr.axis();
+}
+
+
+
+//------------------------------------------------------------------------------
+// HierarchicalIK Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+HierarchicalIK::HierarchicalIK(Robot& robot)
+    : robot_(robot),
+      jacobian_(robot),
+      linkageBlocks_(robot.nLinkages(), -1),
+      centerOfMassBlock_(-1),
+      nullSpace_(robot.nJoints(), robot.nJoints()),
+      delta_(robot.nJoints()),
+      allJoints_(robot.nJoints())
+{
+    for(size_t j=0; j<allJoints_.size(); j++)
+        allJoints_[j] = j;
+}
+
+// Destructor
+HierarchicalIK::~HierarchicalIK()
+{
+
+}
+
+
+//------------------------------------------------------------------------------
+// HierarchicalIK Public Member Functions
+//------------------------------------------------------------------------------
+rk_result_t HierarchicalIK::addPoseTask(string linkageName, const TRANSFORM& target)
+{
+    return addFrameTask(POSE_TASK, linkageName, target);
+}
+
+rk_result_t HierarchicalIK::addPositionTask(string linkageName, const TRANSLATION& target)
+{
+    TRANSFORM frame = TRANSFORM::Identity();
+    frame.translation() = target;
+    return addFrameTask(POSITION_TASK, linkageName, frame);
+}
+
+rk_result_t HierarchicalIK::addOrientationTask(string linkageName, const Matrix3d& target)
+{
+    TRANSFORM frame = TRANSFORM::Identity();
+    frame.linear() = target;
+    return addFrameTask(ORIENTATION_TASK, linkageName, frame);
+}
+
+rk_result_t HierarchicalIK::addCenterOfMassTask(const TRANSLATION& target, bool horizontalOnly)
+{
+    if(centerOfMassBlock_ < 0)
+    {
+        jacobian_.addCenterOfMass();
+        centerOfMassBlock_ = (int)jacobian_.nTasks()-1;
+    }
+
+    addTask(CENTER_OF_MASS_TASK, centerOfMassBlock_, 0, horizontalOnly ? 2 : 3);
+    targets_.back().translation() = target;
+    return RK_SOLVED;
+}
+
+rk_result_t HierarchicalIK::addPostureTask(const VectorXd& target)
+{
+    return addPostureTask(allJoints_, target);
+}
+
+rk_result_t HierarchicalIK::addPostureTask(const vector<size_t>& jointIndices, const VectorXd& target)
+{
+    if((size_t)target.size() != jointIndices.size())
+    {
+        cerr << "ERROR! Posture task has " << jointIndices.size() << " joints but "
+             << target.size() << " values were given!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    for(size_t i=0; i<jointIndices.size(); i++)
+    {
+        if(jointIndices[i] >= robot_.nJoints())
+        {
+            cerr << "ERROR! Invalid joint index: (" << jointIndices[i] << ")" << endl;
+            return RK_INVALID_JOINT;
+        }
+    }
+
+    addTask(POSTURE_TASK, -1, 0, jointIndices.size());
+    postureJoints_.back() = jointIndices;
+    postureTargets_.back() = target;
+    return RK_SOLVED;
+}
+
+void HierarchicalIK::clear()
+{
+    jacobian_.clear();
+    linkageBlocks_.assign(robot_.nLinkages(), -1);
+    centerOfMassBlock_ = -1;
+
+    types_.clear();
+    blocks_.clear();
+    firstRows_.clear();
+    linkages_.clear();
+    targets_.clear();
+    postureJoints_.clear();
+    postureTargets_.clear();
+
+    errors_.clear();
+    errorNorms_.clear();
+    lastErrorNorms_.clear();
+    olderErrorNorms_.clear();
+    projected_.clear();
+    projectedInverse_.clear();
+    gram_.clear();
+    factors_.clear();
+}
+
+void HierarchicalIK::target(size_t task, const TRANSFORM& newTarget) { targets_[task] = newTarget; }
+void HierarchicalIK::target(size_t task, const TRANSLATION& newTarget) { targets_[task].translation() = newTarget; }
+
+void HierarchicalIK::target(size_t task, const VectorXd& newTarget)
+{
+    if(newTarget.size() != postureTargets_[task].size())
+    {
+        cerr << "ERROR! Posture task " << task << " needs " << postureTargets_[task].size()
+             << " values but " << newTarget.size() << " were given!" << endl;
+        return;
+    }
+
+    postureTargets_[task] = newTarget;
+}
+
+size_t HierarchicalIK::nTasks() const { return types_.size(); }
+HierarchicalIK::TaskType HierarchicalIK::taskType(size_t task) const { return types_[task]; }
+double HierarchicalIK::taskError(size_t task) const { return errorNorms_[task]; }
+
+rk_result_t HierarchicalIK::step(VectorXd& jointValues, Constraints& constraints)
+{
+    if((size_t)jointValues.size() != allJoints_.size())
+    {
+        cerr << "ERROR! Robot has " << allJoints_.size() << " joints but "
+             << jointValues.size() << " values were given!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    robot_.values(jointValues);
+    computeErrors(constraints);
+    jacobian_.update();
+
+    double damping = constraints.dampingConstant*constraints.dampingConstant;
+
+    nullSpace_.setIdentity();
+    delta_.setZero();
+
+    for(size_t k=0; k<types_.size(); k++)
+    {
+        // Project this task into the null space of the ones above, and take
+        // away what the steps above already did for it. The frame and center
+        // of mass blocks only touch their own columns.
+        MatrixXd& projected = projected_[k];
+        VectorXd& residual = errors_[k];
+        Index m = projected.rows();
+
+        if(types_[k] == POSTURE_TASK)
+        {
+            const vector<size_t>& joints = postureJoints_[k];
+            for(size_t i=0; i<joints.size(); i++)
+            {
+                projected.row(i) = nullSpace_.row(joints[i]);
+                residual[i] -= delta_[joints[i]];
+            }
+        }
+        else
+        {
+            const vector<size_t>& columns = jacobian_.taskColumns(blocks_[k]);
+            const MatrixXd& block = jacobian_.taskBlock(blocks_[k]);
+
+            projected.setZero();
+            for(size_t c=0; c<columns.size(); c++)
+            {
+                projected.noalias() += block.block(firstRows_[k], c, m, 1)*nullSpace_.row(columns[c]);
+                residual -= block.block(firstRows_[k], c, m, 1)*delta_[columns[c]];
+            }
+        }
+
+        gram_[k].noalias() = projected*projected.transpose();
+
+        factors_[k].compute(gram_[k] + damping*MatrixXd::Identity(m, m));
+        factors_[k].solveInPlace(residual);
+        delta_.noalias() += projected.transpose()*residual;
+
+        if(k+1 == types_.size())
+            break;
+
+        projectedInverse_[k] = projected;
+        factors_[k].compute(gram_[k] + projectorDamping*MatrixXd::Identity(m, m));
+        factors_[k].solveInPlace(projectedInverse_[k]);
+        nullSpace_.noalias() -= projected.transpose()*projectedInverse_[k];
+    }
+
+    // Scaled as a whole by its largest entry either way, so the priorities
+    // are kept (clampMaxAbs() only looks at the largest positive entry)
+    if(constraints.performDeltaClamp)
+    {
+        double largest = delta_.cwiseAbs().maxCoeff();
+        if(largest > constraints.deltaClamp)
+            delta_ *= constraints.deltaClamp/largest;
+    }
+
+    jointValues += delta_;
+
+    if(constraints.wrapToJointLimits)
+        wrapToJointLimits(robot_, allJoints_, jointValues);
+
+    robot_.values(jointValues);
+    for(size_t j=0; j<allJoints_.size(); j++)
+        jointValues[j] = robot_.joint(j).value();
+
+    return RK_SOLVED;
+}
+
+rk_result_t HierarchicalIK::solve(VectorXd& jointValues, Constraints& constraints)
+{
+    double tolerance = constraints.convergenceTolerance;
+
+    for(int iterations=0; iterations<constraints.maxIterations; iterations++)
+    {
+        rk_result_t result = step(jointValues, constraints);
+        if(result != RK_SOLVED)
+            return result;
+
+        if(delta_.norm() <= tolerance)
+            return tasksMet(tolerance) ? RK_SOLVED : RK_CONVERGED;
+
+        // Against an unreachable task the damped steps can settle into
+        // flipping back and forth across a singular configuration, so errors
+        // that repeat every other step also count as settled
+        bool repeating = iterations >= 2;
+        for(size_t k=0; k<errorNorms_.size() && repeating; k++)
+            repeating = fabs(errorNorms_[k] - olderErrorNorms_[k]) <= tolerance;
+
+        if(repeating)
+            return tasksMet(tolerance) ? RK_SOLVED : RK_CONVERGED;
+
+        olderErrorNorms_.swap(lastErrorNorms_);
+        lastErrorNorms_ = errorNorms_;
+    }
+
+    computeErrors(constraints);
+    return tasksMet(tolerance) ? RK_SOLVED : RK_DIVERGED;
+}
+
+
+//------------------------------------------------------------------------------
+// HierarchicalIK Protected Member Functions
+//------------------------------------------------------------------------------
+rk_result_t HierarchicalIK::addFrameTask(TaskType type, const string& linkageName, const TRANSFORM& target)
+{
+    vector<string> names(1, linkageName);
+    vector<size_t> indices;
+    if(robot_.linkageNamesToIndices(names, indices) != RK_SOLVED)
+    {
+        cerr << "ERROR! Invalid linkage name: (" << linkageName << ")" << endl;
+        return RK_INVALID_LINKAGE;
+    }
+
+    // Tasks on the same tool share one block of the whole body Jacobian
+    size_t linkage = indices[0];
+    if(linkageBlocks_[linkage] < 0)
+    {
+        jacobian_.addTool(linkage);
+        linkageBlocks_[linkage] = (int)jacobian_.nTasks()-1;
+    }
+
+    if(type == POSE_TASK)
+        addTask(type, linkageBlocks_[linkage], 0, 6);
+    else if(type == POSITION_TASK)
+        addTask(type, linkageBlocks_[linkage], 0, 3);
+    else
+        addTask(type, linkageBlocks_[linkage], 3, 3);
+
+    linkages_.back() = linkage;
+    targets_.back() = target;
+    return RK_SOLVED;
+}
+
+void HierarchicalIK::addTask(TaskType type, int block, size_t firstRow, size_t nRows)
+{
+    size_t n = allJoints_.size();
+
+    types_.push_back(type);
+    blocks_.push_back(block);
+    firstRows_.push_back(firstRow);
+    linkages_.push_back(0);
+    targets_.push_back(TRANSFORM::Identity());
+    postureJoints_.push_back(vector<size_t>());
+    postureTargets_.push_back(VectorXd());
+
+    errors_.push_back(VectorXd::Zero(nRows));
+    errorNorms_.push_back(0);
+    lastErrorNorms_.push_back(0);
+    olderErrorNorms_.push_back(0);
+    projected_.push_back(MatrixXd::Zero(nRows, n));
+    projectedInverse_.push_back(MatrixXd::Zero(nRows, n));
+    gram_.push_back(MatrixXd::Zero(nRows, nRows));
+    factors_.emplace_back(nRows);
+}
+
+void HierarchicalIK::computeErrors(Constraints& constraints)
+{
+    for(size_t k=0; k<types_.size(); k++)
+    {
+        VectorXd& error = errors_[k];
+        TRANSLATION Terr, Rerr;
+
+        if(types_[k] == POSTURE_TASK)
+        {
+            const vector<size_t>& joints = postureJoints_[k];
+            for(size_t i=0; i<joints.size(); i++)
+                error[i] = postureTargets_[k][i] - robot_.joint(joints[i]).value();
+            errorNorms_[k] = error.norm();
+            continue;
+        }
+
+        if(types_[k] == CENTER_OF_MASS_TASK)
+        {
+            Terr = targets_[k].translation() - robot_.centerOfMass(ROBOT);
+            error = Terr.head(error.size());
+            errorNorms_[k] = error.norm();
+
+            if(constraints.performErrorClamp)
+                clampMag(error, constraints.translationClamp);
+            continue;
+        }
+
+        TRANSFORM pose = robot_.linkage(linkages_[k]).tool().respectToRobot();
+        Terr = targets_[k].translation() - pose.translation();
+        rotationError(pose.linear(), targets_[k].linear(), Rerr);
+
+        if(types_[k] == POSE_TASK)
+            errorNorms_[k] = sqrt(Terr.squaredNorm() + Rerr.squaredNorm());
+        else if(types_[k] == POSITION_TASK)
+            errorNorms_[k] = Terr.norm();
+        else
+            errorNorms_[k] = Rerr.norm();
+
+        if(constraints.performErrorClamp)
+        {
+            clampMag(Terr, constraints.translationClamp);
+            clampMag(Rerr, constraints.rotationClamp);
+        }
+
+        if(types_[k] == POSE_TASK)
+            error << Terr, Rerr;
+        else if(types_[k] == POSITION_TASK)
+            error = Terr;
+        else
+            error = Rerr;
+    }
+}
+
+bool HierarchicalIK::tasksMet(double tolerance) const
+{
+    for(size_t k=0; k<types_.size(); k++)
+        if(types_[k] != POSTURE_TASK && errorNorms_[k] > tolerance)
+            return false;
+
+    return true;
+}
@@ -26,6 +26,19 @@ using namespace Eigen;
 using namespace RobotKin;
 
 
+// Adapts a Hubo solver to Linkage::AnalyticalIK. The solver runs on the robot
+// it is called with, and gives up on robots that are not a Hubo.
+template<bool (Hubo::*solver)(VectorXd&, const TRANSFORM&, const VectorXd&)>
+static bool huboAnalyticalIK(Robot& robot, VectorXd& q, const TRANSFORM& B, const VectorXd& qPrev)
+{
+    Hubo* hubo = dynamic_cast<Hubo*>(&robot);
+    if(hubo == NULL)
+        return false;
+
+    return (hubo->*solver)(q, B, qPrev);
+}
+
+
 //------------------------------------------------------------------------------
 // Hubo Lifecycle
 //------------------------------------------------------------------------------
@@ -225,6 +238,12 @@ void Hubo::initialize()
     Robot::initialize(linkages, parentIndices);
 //    cerr << "init finished" << endl;
     name("HUBO");
+
+    // Closed-form solvers that the *_linkage IK solvers try first
+    linkage("LEFT_ARM").analyticalIK = huboAnalyticalIK<&Hubo::leftArmAnalyticalIK>;
+    linkage("RIGHT_ARM").analyticalIK = huboAnalyticalIK<&Hubo::rightArmAnalyticalIK>;
+    linkage("LEFT_LEG").analyticalIK = huboAnalyticalIK<&Hubo::leftLegAnalyticalIK>;
+    linkage("RIGHT_LEG").analyticalIK = huboAnalyticalIK<&Hubo::rightLegAnalyticalIK>;
 }
 
 
@@ -604,25 +623,88 @@ void Hubo::legFK(TRANSFORM& B, const SCREW& q, size_t side)
     linkage(index).values(q0);
 }
 
+//------------------------------------------------------------------------------
+// Branch Helpers
+//------------------------------------------------------------------------------
+// The closed-form limb solvers have eight solution branches. Each branch
+// lives in one lane of these arrays, so every step below runs on all eight
+// at once.
+typedef Eigen::Array<double, 8, 1> BranchArray;
+typedef Eigen::Array<double, 6, 8> BranchSolutions;
+
+struct BranchAtan2 {
+    double operator()(double y, double x) const { return atan2(y, x); }
+};
+
+static inline BranchArray branchAtan2(const BranchArray& y, const BranchArray& x)
+{
+    return y.binaryExpr(x, BranchAtan2());
+}
+
+static inline BranchArray branchWrapToPi(const BranchArray& angle)
+{ // Same arithmetic as Hubo::wrapToPi()
+    BranchArray shifted = angle + M_PI;
+    return shifted - 2*M_PI*(shifted/(2*M_PI)).floor() - M_PI;
+}
+
+static inline BranchArray branchClamp(const BranchArray& value)
+{
+    return value.min(1.0).max(-1.0);
+}
+
+// atan2(S, sign*sqrt(1-S^2)), snapped to +/-pi/2 when S is within zeroSize of
+// +/-1. The square root is taken as zero when |S| > 1.
+static inline BranchArray branchAngle(const BranchArray& S, const BranchArray& sign, double zeroSize)
+{
+    BranchArray angle = branchAtan2(S, sign*(1 - S*S).max(0.0).sqrt());
+    angle = ((S - 1).abs() < zeroSize).select(M_PI/2, angle);
+    angle = ((S + 1).abs() < zeroSize).select(-M_PI/2, angle);
+    return angle;
+}
+
+// Scores all eight solutions at once. Solutions with every joint within the
+// limits score their total wrapped distance to qPrev and the rest score
+// infinity. Returns false if no solution is within the limits.
+static bool closestBranch(const BranchSolutions& qAll, const Eigen::Matrix<double, 6, 2>& limits,
+                          const SCREW& qPrev, Eigen::Index& minInd)
+{
+    Eigen::Array<bool, 1, 8> withinLim =
+            ( (qAll >= limits.col(0).array().replicate<1,8>())
+           && (qAll <= limits.col(1).array().replicate<1,8>()) ).colwise().all();
+
+    if(!withinLim.any())
+        return false;
+
+    BranchSolutions diff = qAll - qPrev.array().replicate<1,8>();
+    for(int j=0; j<6; j++)
+        diff.row(j) = branchWrapToPi(diff.row(j).transpose()).transpose();
+
+    Eigen::Array<double, 1, 8> qDiffSum = withinLim.select(diff.abs().colwise().sum(),
+                                                           std::numeric_limits<double>::infinity());
+    qDiffSum.minCoeff(&minInd);
+    return true;
+}
+
 bool Hubo::armAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev, size_t side)
 {
     q.resize(6,1);
-    Eigen::ArrayXXd qAll(6,8);
+    BranchSolutions qAll;
     
     // Declarations
     TRANSFORM shoulder, shoulderInv, toolFixed, toolFixedInv, B5_6, BInv;
     double nx, sx, ax, px;
     double ny, sy, ay, py;
     double nz, sz, az, pz;
-    double q1, q2, q3, q4, q5, q6;
     double qP1, qP3;
-    double qT;
     Eigen::Matrix<int, 8, 3> m;
     
-    double S2, S4, S5, S6;
-    double C2, C4, C5, C6;
+    BranchArray q1, q2, q3, q4, q5, q6;
+    BranchArray S2, S4, S5, S6;
+    BranchArray C2, C5, C6;
+    BranchArray qT;
+    double C4;
     
-    Eigen::MatrixXd limits(6,2);
+    Eigen::Matrix<double, 6, 2> limits;
     SCREW offsets; offsets.setZero();
     
     // Parameters
@@ -685,236 +767,125 @@ bool Hubo::armAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev,
     -1, -1,  1,
     -1, -1, -1;
     
-    // Calculate inverse kinematics
-    for (size_t i = 0; i < 8; i++) {
+    // Branch signs, one lane per row of m
+    BranchArray m0 = m.col(0).cast<double>().array();
+    BranchArray m1 = m.col(1).cast<double>().array();
+    BranchArray m2 = m.col(2).cast<double>().array();
+    
+    // Calculate inverse kinematics for all eight branches
+    // Solve for q4
+    C4 = max(min((2*l4*px - l2*l2 - l3*l3 + l4*l4 + px*px + py*py + pz*pz)/(2*l2*l3),1.0),-1.0);
+    
+    if (fabs(C4 - 1) < zeroSize) { // Case 1: q4 == 0
+        // Set q4
+        q4.setZero();
+        
+        // Set q3
+        q3.setConstant(qP3);
+        
+        // Solve for q6
+        S6.setConstant(max(min( py/(l2 + l3), 1.0),-1.0));
+        C6.setConstant(max(min( -(l4 + px)/(l2 + l3), 1.0), -1.0));
+        q6 = branchAtan2(S6, C6);
+        
+        // Solve for q2
+        S2 = branchClamp(C4*C6*ax - C4*S6*ay);
+        q2 = branchAngle(S2, m2, zeroSize);
+        C2 = q2.cos();
+        
+        // Solve for q5
+        qT = branchAtan2(-C6*ay - S6*ax, BranchArray::Constant(az));
+        qT = (C2 < 0).select(qT + M_PI, qT);
+        q5 = branchWrapToPi(qT - q3);
+        
+        // Solve for q1
+        q1 = branchAtan2(S6*ny - C6*nx, C6*sx - S6*sy);
+        q1 = branchWrapToPi((C2 < 0).select(q1 + M_PI, q1));
+        
+        // Case 3: q2 = pi/2 or -pi/2
+        BranchArray q5a = branchWrapToPi(BranchArray::Constant(qP1 - qP3 - atan2(nz,-sz))); // Case 3a: q2 = pi/2
+        BranchArray q5b = branchWrapToPi(BranchArray::Constant(atan2(-nz,sz) - qP1 - qP3)); // Case 3b: q2 = -pi/2
+        Eigen::Array<bool, 8, 1> case3 = C2.abs() < zeroSize;
+        q1 = case3.select(qP1, q1);
+        q5 = case3.select((S2 > 0).select(q5a, q5b), q5);
+        
+    } else {
         
         // Solve for q4
-        C4 = max(min((2*l4*px - l2*l2 - l3*l3 + l4*l4 + px*px + py*py + pz*pz)/(2*l2*l3),1.0),-1.0);
-
-        if (fabs(C4 - 1) < zeroSize) { // Case 1: q4 == 0
-            // Set q4
-            q4 = 0;
-            
-            // Set q3
-            q3 = qP3;
-            
-            // Solve for q6
-            S6 = max(min( py/(l2 + l3), 1.0),-1.0);
-            C6 = max(min( -(l4 + px)/(l2 + l3), 1.0), -1.0);
-            q6 = atan2(S6,C6);
-            
-            
-            // Solve for q2
-            S2 = max(min( C4*C6*ax - C4*S6*ay, 1.0),-1.0);
-            if (fabs(S2 - 1) < zeroSize) {
-                q2 = M_PI/2;
-            } else if (fabs(S2 + 1) < zeroSize) {
-                q2 = -M_PI/2;
-            } else {
-                complex<double> radical = 1-S2*S2;
-                q2 = atan2(S2,m(i,2)*real(sqrt(radical)));
-            }
-            
-            // Solve for q5
-            qT = atan2(-C6*ay - S6*ax,az);
-            C2 = cos(q2);
-            
-            if (fabs(C2) < zeroSize) { // Case 3: q2 = pi/2 or -pi/2
-                
-                q1 = qP1;
-                q3 = qP3;
-                
-                // Solve for q5
-                if (S2 > 0) { // Case 3a: q2 = pi/2
-                    qT = atan2(nz,-sz);
-                    q5 = wrapToPi(q1 - q3 - qT);
-                } else { // Case 3b: q2 = -pi/2
-                    qT = atan2(-nz,sz);
-                    q5 = wrapToPi(qT - q1 - q3);
-                }
-                
-                
-            } else {
-                
-                if (C2 < 0) {
-                    qT = qT + M_PI;
-                }
-                q5 = wrapToPi(qT - q3);
-                
-                // Solve for q1
-                q1 = atan2(S6*ny - C6*nx,C6*sx - S6*sy);
-                if (C2 < 0) {
-                    q1 = q1 + M_PI;
-                }
-                q1 = wrapToPi(q1);
-            }
-            
-        } else {
-            
-            // Solve for q4
-            complex<double> radical = 1-C4*C4;
-            q4 = atan2(m(i,0)*real(sqrt(radical)),C4);
-            
-            // Solve for q5
-            S4 = sin(q4);
-            S5 = pz/(S4*l2);
-            if (fabs(S5 - 1) < zeroSize) {
-                q5 = M_PI/2;
-            } else if (fabs(S5 + 1) < zeroSize) {
-                q5 = -M_PI/2;
-            } else {
-                radical = 1-S5*S5;
-                q5 = atan2(S5,m(i,1)*real(sqrt(radical)));
-            }
-            
-            // Solve for q6
-            C5 = cos(q5);
-            S6 =max(min( (C5*S4*l2 + (py*(l3 + C4*l2 - (C5*S4*l2*py)/(l4 + px)))/(l4 + px + py*py/(l4 + px)))/(l4 + px), 1.0),-1.0);
-            C6 = max(min( -(l3 + C4*l2 - (C5*S4*l2*py)/(l4 + px))/(l4 + px + py*py/(l4 + px)), 1.0),-1.0);
-            q6 = atan2(S6,C6);
-            
-            // Solve for q2
-            S2 = max(min(ax*(C4*C6 - C5*S4*S6) - ay*(C4*S6 + C5*C6*S4) - S4*S5*az,1.0),-1.0);
-            if (fabs(S2 - 1) < zeroSize) {
-                q2 = M_PI/2;
-            } else if (fabs(S2 + 1) < zeroSize) {
-                q2 = -M_PI/2;
-            } else {
-                radical = 1-S2*S2;
-                q2 = atan2(S2,m(i,2)*real(sqrt(radical)));
-            }
-            
-            // Solve for q3
-            C2 = cos(q2);
-            
-            if (fabs(C2) < zeroSize) { // Case 2: q2 = pi/2 or -pi/2
-                
-                q3 = qP3;
-                // Solve for q1
-                if (S2 > 0) { // Case 2a: q2 = pi/2
-                    qT = atan2(S6*sy - C6*sx,S6*ny - C6*nx);
-                    if (S4 < 0) {
-                        qT = qT + M_PI;
-                    }
-                    q1 = wrapToPi(qT + q3);
-                } else { // Case 2b: q2 = -pi/2
-                    qT = atan2(S6*sy - C6*sx,S6*ny - C6*nx);
-                    if (S4 < 0) {
-                        qT = qT + M_PI;
-                    }
-                    q1 = wrapToPi(qT - q3);
-                }
-                
-            } else {
-                q3 = atan2(S4*S6*ay - C4*S5*az - C6*S4*ax - C4*C5*C6*ay - C4*C5*S6*ax,C5*az - C6*S5*ay - S5*S6*ax);
-                if (C2 < 0) {
-                    q3 = q3 - M_PI;
-                }
-                q3 = wrapToPi(q3);
-                
-                // Solve for q1
-                q1 = atan2(C4*S6*ny - C4*C6*nx + S4*S5*nz + C5*C6*S4*ny + C5*S4*S6*nx,C4*C6*sx - C4*S6*sy - S4*S5*sz - C5*C6*S4*sy - C5*S4*S6*sx);
-                if (C2 < 0) {
-                    q1 = q1 + M_PI;
-                }
-                q1 = wrapToPi(q1);
-            }
-        }
+        q4 = branchAtan2(m0*sqrt(max(1-C4*C4, 0.0)), BranchArray::Constant(C4));
         
-        qAll(0,i) = q1;
-        qAll(1,i) = q2;
-        qAll(2,i) = q3;
-        qAll(3,i) = q4;
-        qAll(4,i) = q5;
-        qAll(5,i) = q6;
+        // Solve for q5
+        S4 = q4.sin();
+        S5 = pz/(S4*l2);
+        q5 = branchAngle(S5, m1, zeroSize);
         
+        // Solve for q6
+        C5 = q5.cos();
+        S6 = branchClamp( (C5*S4*l2 + (py*(l3 + C4*l2 - (C5*S4*l2*py)/(l4 + px)))/(l4 + px + py*py/(l4 + px)))/(l4 + px) );
+        C6 = branchClamp( -(l3 + C4*l2 - (C5*S4*l2*py)/(l4 + px))/(l4 + px + py*py/(l4 + px)) );
+        q6 = branchAtan2(S6, C6);
+        
+        // Solve for q2
+        S2 = branchClamp(ax*(C4*C6 - C5*S4*S6) - ay*(C4*S6 + C5*C6*S4) - S4*S5*az);
+        q2 = branchAngle(S2, m2, zeroSize);
+        
+        // Solve for q3
+        C2 = q2.cos();
+        q3 = branchAtan2(S4*S6*ay - C4*S5*az - C6*S4*ax - C4*C5*C6*ay - C4*C5*S6*ax, C5*az - C6*S5*ay - S5*S6*ax);
+        q3 = branchWrapToPi((C2 < 0).select(q3 - M_PI, q3));
+        
+        // Solve for q1
+        q1 = branchAtan2(C4*S6*ny - C4*C6*nx + S4*S5*nz + C5*C6*S4*ny + C5*S4*S6*nx, C4*C6*sx - C4*S6*sy - S4*S5*sz - C5*C6*S4*sy - C5*S4*S6*sx);
+        q1 = branchWrapToPi((C2 < 0).select(q1 + M_PI, q1));
+        
+        // Case 2: q2 = pi/2 or -pi/2
+        qT = branchAtan2(S6*sy - C6*sx, S6*ny - C6*nx);
+        qT = (S4 < 0).select(qT + M_PI, qT);
+        Eigen::Array<bool, 8, 1> case2 = C2.abs() < zeroSize;
+        q3 = case2.select(qP3, q3);
+        q1 = case2.select((S2 > 0).select(branchWrapToPi(qT + qP3),   // Case 2a: q2 = pi/2
+                                          branchWrapToPi(qT - qP3)),  // Case 2b: q2 = -pi/2
+                          q1);
     }
-
-    // Set to offsets
-    for( size_t j=0; j<8; j++) {
-        for (size_t i = 0; i < 6; i++) {
-            if (side==SIDE_RIGHT) {
-                qAll(i,j) = wrapToPi(qAll(i,j) - offsets(i));
-            } else {
-                qAll(i,j) = wrapToPi(qAll(i,j) - offsets(i));
-            }
-        }
-    }
-    // TODO: Find best solution using better method
     
-    Eigen::ArrayXd qDiff(6,1); qDiff.setZero();
-    Eigen::ArrayXd qDiffSum(8,1);
-    bool withinLim[8];
-    size_t minInd;
+    qAll.row(0) = q1.transpose();
+    qAll.row(1) = q2.transpose();
+    qAll.row(2) = q3.transpose();
+    qAll.row(3) = q4.transpose();
+    qAll.row(4) = q5.transpose();
+    qAll.row(5) = q6.transpose();
+    
+    // Set to offsets
+    for (int i = 0; i < 6; i++)
+        qAll.row(i) = branchWrapToPi((qAll.row(i) - offsets(i)).transpose()).transpose();
     
     // if any joint solution is infintesimal, set it to zero
-    for(size_t i=0; i<8; i++)
-        for(size_t j=0; j<6; j++)
-            if(qAll(j,i) < zeroSize && qAll(j,i) > -zeroSize)
-                qAll(j,i) = 0.0;
-    
-    // Initialize withinLim to all trues for all eight solutions
-    for(size_t i=0; i<8; i++)
-        withinLim[i] = true;
-    
-    // Check each set of solutions to see if any are outside the limits
-    for(size_t i=0; i<8; i++)
-        for(size_t j=0; j<6; j++)
-            if( limits(j,0) > qAll(j,i) || qAll(j,i) > limits(j,1) )
-                withinLim[i] = false;
-    
-    // Initialze anyWithin boolean array to all trues
-    bool anyWithin=false;
-    for(size_t i=0; i<8; i++)
-        if( withinLim[i] )
-            anyWithin = true;
-    
-    // If any solution has all joints within the limits...
-    if(anyWithin)
-    {
-        // for each solution...
-        for (size_t i = 0; i < 8; i++) {
-            // if all the joints of solution i are within the limits...
-            if( withinLim[i] )
-            {
-                // calculate the differences between solution angles, j, and previous angles
-                for (size_t j=0; j < 6; j++)
-                    qDiff(j) = wrapToPi(qAll(j,i) - qPrev(j));
-                // sum the absolute values of the differences to get total difference
-                qDiffSum(i) = qDiff.abs().sum();
-            }
-            // if the solution doesn't have all the joints within the limits...
-            else
-                // set the difference for that solution to infinity
-                qDiffSum(i) = std::numeric_limits<double>::infinity();
-        }
-        // and take the solution closest to previous solution
-        qDiffSum.minCoeff(&minInd);
-        q = qAll.col(minInd);
-    }
+    qAll = (qAll.abs() < zeroSize).select(0.0, qAll);
+    
+    // take the solution within the limits that is closest to the previous solution
+    Eigen::Index minInd;
+    bool anyWithin = closestBranch(qAll, limits, qPrev, minInd);
+    
     // if no solution has all the joints within the limits...
-    else
+    if(!anyWithin)
     {
+        Eigen::Array<double, 8, 1> qDiffSum;
         // then for each solution...
         for( size_t i=0; i<8; i++)
         {
-            // create a 6d vector of angles of solution i
-            SCREW qtemp = qAll.col(i).matrix();
-            // take the min of the angles and the joint upper limits
-            qtemp = qtemp.cwiseMin(limits.col(1));
-            // then take the max of those angles and the joint lower limits
-            qtemp = qtemp.cwiseMax(limits.col(0));
-            // create an TRANSFORM 4x4 matrix for the temp pose
-            TRANSFORM Btemp;
+            // clamp the angles of solution i to the joint limits
+            SCREW qtemp = qAll.col(i).matrix().cwiseMin(limits.col(1)).cwiseMax(limits.col(0));
             // find the pose associated with the temp angles
+            TRANSFORM Btemp;
             armFK( Btemp, qtemp, side );
             // calculate the distance from previous pose to temp pose locations
             qDiffSum(i) = (Btemp.translation() - B.translation()).norm();
         }
         // find the solution that's closest the previous position
         qDiffSum.minCoeff(&minInd);
-        q = qAll.col(minInd);
     }
+    q = qAll.col(minInd);
+    
     // apply limits
     for( size_t i=0; i<6; i++ )
         q(i) = max( min( q(i), limits(i,1)), limits(i,0) );
@@ -925,21 +896,23 @@ bool Hubo::armAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev,
 
 
 bool Hubo::legAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev, size_t side) {
-    Eigen::ArrayXXd qAll(6,8);
+    q.resize(6,1);
+    BranchSolutions qAll;
     
     // Declarations
     TRANSFORM neck, neckInv, waist, waistInv, BInv;
     double nx, sx, ax, px;
     double ny, sy, ay, py;
-    double nz, sz, az, pz;
-    double q1, q2, q3, q4, q5, q6;
-    double C45, psi, q345;
+    double az, pz;
     Eigen::Matrix<int, 8, 3> m;
     
-    double S2, S4, S6;
-    double C2, C4, C5, C6;
+    BranchArray q1, q2, q3, q4, q5, q6;
+    BranchArray C45, psi, q345;
+    BranchArray S2, S4, S6;
+    BranchArray C2, C5, C6;
+    double C4;
     
-    Eigen::MatrixXd limits(6,2);
+    Eigen::Matrix<double, 6, 2> limits;
     SCREW offsets; offsets.setZero();
     
     // Parameters
@@ -978,7 +951,7 @@ bool Hubo::legAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev,
     
     nx = BInv(0,0); sx = BInv(0,1); ax = BInv(0,2); px = BInv(0,3);
     ny = BInv(1,0); sy = BInv(1,1); ay = BInv(1,2); py = BInv(1,3);
-    nz = BInv(2,0); sz = BInv(2,1); az = BInv(2,2); pz = BInv(2,3);
+    az = BInv(2,2); pz = BInv(2,3);
     
     m <<
     1,  1,  1,
@@ -990,136 +963,71 @@ bool Hubo::legAnalyticalIK(VectorXd& q, const TRANSFORM& B, const SCREW& qPrev,
     -1, -1,  1,
     -1, -1, -1;
     
-    for (size_t i = 0; i < 8; i++)
-    {
-        C4 = ((l6 + px)*(l6 + px) - l4*l4 - l5*l5 + py*py + pz*pz)/(2*l4*l5);
-        complex<double> radical = 1-C4*C4;
-        q4 = atan2(m(i,0)*real(sqrt(radical)),C4);
-        
-        S4 = sin(q4);
-        psi = atan2(S4*l4, C4*l4+l5);
-        radical = ((px+l6)*(px+l6)+(py*py));
-        q5 = wrapToPi(atan2(-pz, m(i,1)*real(sqrt(radical)))-psi);
-        
-        q6 = atan2(py, -px-l6);
-        C45 = cos(q4+q5);
-        C5 = cos(q5);
-        if (C45*l4 + C5*l5 < 0)
-        {
-            q6 = wrapToPi(q6 + M_PI);
-        }
-        
-        S6 = sin(q6);
-        C6 = cos(q6);
-        
-        S2 = C6*ay + S6*ax;
-        radical = 1-S2*S2;
-        q2 = atan2(S2,m(i,2)*real(sqrt(radical)));
-        
-        q1 = atan2(C6*sy + S6*sx,C6*ny + S6*nx);
-        C2 = cos(q2);
-        if (C2 < 0) {
-            q1 = wrapToPi(q1 + M_PI);
-        }
-        
-        q345 = atan2(-az/C2,-(C6*ax - S6*ay)/C2);
-        q3 = wrapToPi(q345-q4-q5);
-        
-        qAll(0,i) = q1;
-        qAll(1,i) = q2;
-        qAll(2,i) = q3;
-        qAll(3,i) = q4;
-        qAll(4,i) = q5;
-        qAll(5,i) = q6;
-    }
+    // Branch signs, one lane per row of m
+    BranchArray m0 = m.col(0).cast<double>().array();
+    BranchArray m1 = m.col(1).cast<double>().array();
+    BranchArray m2 = m.col(2).cast<double>().array();
     
-    // Set to offset
-    for (size_t i = 0; i < 6; i++) {
-        if (side==SIDE_RIGHT) {
-            q(i) = wrapToPi(q(i) + offsets(i));
-        } else {
-            q(i) = wrapToPi(q(i) + offsets(i));
-        }
-    }
+    // Calculate inverse kinematics for all eight branches
+    C4 = ((l6 + px)*(l6 + px) - l4*l4 - l5*l5 + py*py + pz*pz)/(2*l4*l5);
+    q4 = branchAtan2(m0*sqrt(max(1-C4*C4, 0.0)), BranchArray::Constant(C4));
+    
+    S4 = q4.sin();
+    psi = branchAtan2(S4*l4, BranchArray::Constant(C4*l4+l5));
+    q5 = branchWrapToPi(branchAtan2(BranchArray::Constant(-pz), m1*sqrt((px+l6)*(px+l6)+(py*py))) - psi);
+    
+    q6.setConstant(atan2(py, -px-l6));
+    C45 = (q4+q5).cos();
+    C5 = q5.cos();
+    q6 = (C45*l4 + C5*l5 < 0).select(branchWrapToPi(q6 + M_PI), q6);
+    
+    S6 = q6.sin();
+    C6 = q6.cos();
+    
+    S2 = C6*ay + S6*ax;
+    q2 = branchAtan2(S2, m2*(1-S2*S2).max(0.0).sqrt());
     
-    // Find best solution
-    Eigen::ArrayXd qDiff(6,1); qDiff.setZero();
-    Eigen::ArrayXd qDiffSum(8,1);
-    bool withinLim[8];
-    size_t minInd;
+    q1 = branchAtan2(C6*sy + S6*sx, C6*ny + S6*nx);
+    C2 = q2.cos();
+    q1 = (C2 < 0).select(branchWrapToPi(q1 + M_PI), q1);
+    
+    q345 = branchAtan2(-az/C2, -(C6*ax - S6*ay)/C2);
+    q3 = branchWrapToPi(q345-q4-q5);
+    
+    qAll.row(0) = q1.transpose();
+    qAll.row(1) = q2.transpose();
+    qAll.row(2) = q3.transpose();
+    qAll.row(3) = q4.transpose();
+    qAll.row(4) = q5.transpose();
+    qAll.row(5) = q6.transpose();
     
     // if any joint solution is infintesimal, set it to zero
-    for(size_t i=0; i<8; i++)
-        for(size_t j=0; j<6; j++)
-            if(qAll(j,i) < zeroSize && qAll(j,i) > -zeroSize)
-                qAll(j,i) = 0.0;
-    
-    // Initialize withinLim to all trues for all eight solutions
-    for(size_t i=0; i<8; i++)
-        withinLim[i] = true;
-    
-    // Check each set of solutions to see if any are outside the limits
-    for(size_t i=0; i<8; i++)
-        for(size_t j=0; j<6; j++)
-            if( limits(j,0) > qAll(j,i) || qAll(j,i) > limits(j,1) )
-                withinLim[i] = false;
-    
-    // Initialze anyWithin boolean array to all trues
-    bool anyWithin=false;
-    for(size_t i=0; i<8; i++)
-        if( withinLim[i] )
-            anyWithin = true;
-    
-    // If any solution has all joints within the limits...
-    if(anyWithin)
-    {
-        // for each solution...
-        for (size_t i = 0; i < 8; i++)
-        {
-            // if all the joints of solution i are within the limits...
-            if( withinLim[i] )
-            {
-                // calculate the differences between solution angles, j, and previous angles
-                for (size_t j=0; j < 6; j++)
-                {
-                    qDiff(j) = wrapToPi(qAll(j,i) - qPrev(j));
-                }
-                // sum the absolute values of the differences to get total difference
-                qDiffSum(i) = qDiff.abs().sum();
-            }
-            // if the solution doesn't have all the joints within the limits...
-            else
-                // set the difference for that solution to infinity
-                qDiffSum(i) = std::numeric_limits<double>::infinity();
-        }
-        // and take the solution closest to previous solution
-        qDiffSum.minCoeff(&minInd);
-        q = qAll.col(minInd);
-    }
+    qAll = (qAll.abs() < zeroSize).select(0.0, qAll);
+    
+    // take the solution within the limits that is closest to the previous solution
+    Eigen::Index minInd;
+    bool anyWithin = closestBranch(qAll, limits, qPrev, minInd);
     
     // if no solution has all the joints within the limits...
-    else
+    if(!anyWithin)
     {
+        Eigen::Array<double, 8, 1> qDiffSum;
         // then for each solution...
         for(size_t i=0; i<8; i++)
         {
-            // create a 6d vector of angles of solution i
-            SCREW qtemp = qAll.col(i).matrix();
-            // take the min of the angles and the joint upper limits
-            qtemp = qtemp.cwiseMin(limits.col(1));
-            // then take the max of those angles and the joint lower limits
-            qtemp = qtemp.cwiseMax(limits.col(0));
-            // create an TRANSFORM 4x4 matrix for the temp pose
-            TRANSFORM Btemp;
+            // clamp the angles of solution i to the joint limits
+            SCREW qtemp = qAll.col(i).matrix().cwiseMin(limits.col(1)).cwiseMax(limits.col(0));
             // find the pose associated with the temp angles
+            TRANSFORM Btemp;
             legFK( Btemp, qtemp, side );
             // calculate the distance from previous pose to temp pose locations
             qDiffSum(i) = (Btemp.translation() - B.translation()).norm();
         }
         // find the solution that's closest the previous position
         qDiffSum.minCoeff(&minInd);
-        q = qAll.col(minInd);
     }
+    q = qAll.col(minInd);
+    
     // set the final joint angles to the solution closest to the previous solution
     for( size_t i=0; i<6; i++)
         q(i) = max( min( q(i), limits(i,1)), limits(i,0) );
@@ -0,0 +1,76 @@
+/*
+ -------------------------------------------------------------------------------
+ IKWorkspace.cpp
+ Robot Library Project
+
+ Preallocated scratch storage for the iterative IK solvers.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "IKWorkspace.h"
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// IKWorkspace Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+IKWorkspace::IKWorkspace()
+    : damping(0),
+      iterations(0)
+{
+    resize(0);
+}
+
+IKWorkspace::IKWorkspace(size_t nJoints)
+    : damping(0),
+      iterations(0)
+{
+    resize(nJoints);
+}
+
+// Destructor
+IKWorkspace::~IKWorkspace()
+{
+
+}
+
+
+//------------------------------------------------------------------------------
+// IKWorkspace Public Member Functions
+//------------------------------------------------------------------------------
+void IKWorkspace::resize(size_t nJoints)
+{
+    joints.resize(nJoints);
+
+    J.resize(6, nJoints);
+    Jinv.resize(nJoints, 6);
+
+    delta.resize(nJoints);
+    nullErr.resize(nJoints);
+    deltaNull.resize(nJoints);
+    stored.resize(nJoints);
+
+    H.resize(nJoints, nJoints);
+    gradient.resize(nJoints);
+    lower.resize(nJoints);
+    upper.resize(nJoints);
+    qp.resize(nJoints);
+}
+
+size_t IKWorkspace::size() const { return joints.size(); }
@@ -0,0 +1,508 @@
+/*
+ -------------------------------------------------------------------------------
+ KinematicModel.cpp
+ Robot Library Project
+
+ Flat structure-of-arrays copy of a Robot's kinematic tree.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "KinematicModel.h"
+#include "Robot.h"
+#include "BatchKernels.h"
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// KinematicState Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+KinematicState::KinematicState()
+    : imposeLimits(true),
+      firstDirtyJoint_(0)
+{
+
+}
+
+KinematicState::KinematicState(const KinematicModel& model)
+    : imposeLimits(model.defaultImposeLimits()),
+      values_(model.defaultValues()),
+      frames_(model.nJoints()),
+      toolFrames_(model.nTools()),
+      dirty_(model.nJoints(), true),
+      firstDirtyJoint_(0)
+{
+    model.updateFrames(*this);
+}
+
+// Destructor
+KinematicState::~KinematicState()
+{
+
+}
+
+
+//------------------------------------------------------------------------------
+// KinematicState Public Member Functions
+//------------------------------------------------------------------------------
+const VectorXd& KinematicState::values() const { return values_; }
+double KinematicState::value(size_t jointIndex) const { return values_[jointIndex]; }
+
+const TRANSFORM& KinematicState::jointRespectToRobot(size_t jointIndex) const { return frames_[jointIndex]; }
+const TRANSFORM& KinematicState::toolRespectToRobot(size_t toolIndex) const { return toolFrames_[toolIndex]; }
+
+
+
+//------------------------------------------------------------------------------
+// KinematicModel Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+KinematicModel::KinematicModel()
+    : rootMass_(0),
+      rootCom_(TRANSLATION::Zero()),
+      defaultImposeLimits_(true)
+{
+
+}
+
+KinematicModel::KinematicModel(const Robot& robot)
+    : rootMass_(0),
+      rootCom_(TRANSLATION::Zero()),
+      defaultImposeLimits_(true)
+{
+    compile(robot);
+}
+
+// Destructor
+KinematicModel::~KinematicModel()
+{
+
+}
+
+void KinematicModel::compile(const Robot& robot)
+{
+    size_t nL = robot.linkages_.size();
+    size_t nJ = robot.joints_.size();
+
+    parents_.resize(nJ);
+    fixed_.resize(nJ);
+    axes_.resize(nJ);
+    axisTypes_.resize(nJ);
+    types_.resize(nJ);
+    min_.resize(nJ);
+    max_.resize(nJ);
+    masses_.resize(nJ);
+    coms_.resize(nJ);
+
+    toolParents_.resize(nL);
+    toolFixed_.resize(nL);
+    toolMasses_.resize(nL);
+    toolComs_.resize(nL);
+    linkageFirstJoints_.resize(nL);
+    linkageJointCounts_.resize(nL);
+
+    // For every linkage, the joint its base frame hangs off of and the
+    // offset from that joint's frame to the base frame
+    vector<int> baseParents(nL);
+    TRANSFORM_VECTOR baseFixed(nL);
+
+    for (size_t i = 0; i < nL; ++i) {
+        const Linkage* linkage = robot.linkages_[i];
+
+        if (linkage->parentLinkage_ == 0) {
+            baseParents[i] = -1;
+            baseFixed[i] = linkage->respectToFixed_;
+        } else {
+            size_t p = linkage->parentLinkage_->id();
+            baseParents[i] = toolParents_[p];
+            baseFixed[i] = toolFixed_[p] * linkage->respectToFixed_;
+        }
+
+        int parent = baseParents[i];
+        TRANSFORM offset = baseFixed[i];
+        linkageFirstJoints_[i] = robot.joints_.size();
+        linkageJointCounts_[i] = linkage->joints_.size();
+        if (linkage->joints_.size() > 0)
+            linkageFirstJoints_[i] = linkage->joints_[0]->id();
+        for (size_t j = 0; j < linkage->joints_.size(); ++j) {
+            const Joint* joint = linkage->joints_[j];
+            size_t k = joint->id();
+
+            parents_[k] = parent;
+            fixed_[k] = offset * joint->respectToFixed_;
+            axes_[k] = joint->jointAxis_;
+            axisTypes_[k] = joint->axisType_;
+            types_[k] = joint->jointType_;
+            min_[k] = joint->min_;
+            max_[k] = joint->max_;
+            masses_[k] = joint->link.mass();
+            coms_[k] = joint->link.const_com();
+
+            parent = static_cast<int>(k);
+            offset = TRANSFORM::Identity();
+        }
+
+        // Zero-joint linkages pass their base offset straight through to the tool
+        toolParents_[i] = parent;
+        toolFixed_[i] = offset * linkage->tool_.respectToFixed_;
+        toolMasses_[i] = linkage->tool_.massProperties.mass();
+        toolComs_[i] = linkage->tool_.massProperties.const_com();
+    }
+
+    rootMass_ = robot.rootLink.mass();
+    rootCom_ = robot.rootLink.const_com();
+
+    defaultValues_.resize(nJ);
+    for (size_t k = 0; k < nJ; ++k)
+        defaultValues_[k] = robot.joints_[k]->value_;
+
+    defaultImposeLimits_ = robot.imposeLimits;
+}
+
+
+//------------------------------------------------------------------------------
+// KinematicModel Public Member Functions
+//------------------------------------------------------------------------------
+size_t KinematicModel::nJoints() const { return parents_.size(); }
+size_t KinematicModel::nTools() const { return toolParents_.size(); }
+
+int KinematicModel::parentIndex(size_t jointIndex) const { return parents_[jointIndex]; }
+JointType KinematicModel::jointType(size_t jointIndex) const { return types_[jointIndex]; }
+const AXIS& KinematicModel::jointAxis(size_t jointIndex) const { return axes_[jointIndex]; }
+AxisType KinematicModel::axisType(size_t jointIndex) const { return axisTypes_[jointIndex]; }
+const TRANSFORM& KinematicModel::respectToParent(size_t jointIndex) const { return fixed_[jointIndex]; }
+double KinematicModel::min(size_t jointIndex) const { return min_[jointIndex]; }
+double KinematicModel::max(size_t jointIndex) const { return max_[jointIndex]; }
+
+int KinematicModel::toolParentIndex(size_t toolIndex) const { return toolParents_[toolIndex]; }
+
+void KinematicModel::linkageJointIndices(size_t linkageIndex, vector<size_t>& jointIndices) const
+{
+    // The joints of a linkage are numbered consecutively
+    jointIndices.resize(linkageJointCounts_[linkageIndex]);
+    for (size_t i = 0; i < jointIndices.size(); ++i)
+        jointIndices[i] = linkageFirstJoints_[linkageIndex] + i;
+}
+
+const VectorXd& KinematicModel::defaultValues() const { return defaultValues_; }
+bool KinematicModel::defaultImposeLimits() const { return defaultImposeLimits_; }
+
+void KinematicModel::values(KinematicState& state, const VectorXd& someValues) const
+{
+    if (someValues.size() != state.values_.size()) {
+        cerr << "ERROR! Number of values (" << someValues.size() << ") does not "
+             << "match the number of joints in the state (" << state.values_.size() << ")!" << endl;
+        return;
+    }
+
+    for (size_t k = 0; k < parents_.size(); ++k)
+        setJointValue(state, k, someValues[k]);
+
+    updateDirtyFrames(state);
+}
+
+void KinematicModel::values(KinematicState& state, const vector<size_t>& jointIndices,
+                            const VectorXd& jointValues) const
+{
+    if (jointIndices.size() != (size_t)jointValues.size()) {
+        cerr << "ERROR! Number of joint indices (" << jointIndices.size() << ") does not "
+             << "match the number of values (" << jointValues.size() << ")!" << endl;
+        return;
+    }
+
+    for (size_t i = 0; i < jointIndices.size(); ++i)
+        setJointValue(state, jointIndices[i], jointValues[i]);
+
+    updateDirtyFrames(state);
+}
+
+rk_result_t KinematicModel::setJointValue(KinematicState& state, size_t jointIndex, double val) const
+{
+    // Mirrors Joint::value(), but leaves the frames for updateFrames()
+    rk_result_t result = RK_SOLVED;
+    if (val < min_[jointIndex]) {
+        result = RK_HIT_LOWER_LIMIT;
+        if (state.imposeLimits)
+            val = min_[jointIndex];
+    } else if (val > max_[jointIndex]) {
+        result = RK_HIT_UPPER_LIMIT;
+        if (state.imposeLimits)
+            val = max_[jointIndex];
+    }
+
+    if (state.values_[jointIndex] != val) {
+        state.values_[jointIndex] = val;
+        state.dirty_[jointIndex] = true;
+        if (jointIndex < state.firstDirtyJoint_)
+            state.firstDirtyJoint_ = jointIndex;
+    }
+    return result;
+}
+
+void KinematicModel::updateFrames(KinematicState& state) const
+{
+    std::fill(state.dirty_.begin(), state.dirty_.end(), true);
+    state.firstDirtyJoint_ = 0;
+
+    // Tools on the robot base never move, so only a full update sets them
+    for (size_t i = 0; i < toolParents_.size(); ++i)
+        if (toolParents_[i] < 0)
+            state.toolFrames_[i] = toolFixed_[i];
+
+    updateDirtyFrames(state);
+}
+
+void KinematicModel::updateDirtyFrames(KinematicState& state) const
+{
+    // Parents always come before their children, so one pass from the first
+    // changed joint reaches everything downstream of it. Joints in that range
+    // whose value and parent are unchanged keep their frames.
+    size_t first = state.firstDirtyJoint_;
+    for (size_t k = first; k < parents_.size(); ++k) {
+        int parent = parents_[k];
+        if (parent >= 0 && state.dirty_[parent])
+            state.dirty_[k] = true;
+        if (!state.dirty_[k])
+            continue;
+
+        TRANSFORM local;
+        jointTransform(local, fixed_[k], types_[k], axisTypes_[k], axes_[k], state.values_[k]);
+
+        if (parent < 0)
+            state.frames_[k] = local;
+        else
+            state.frames_[k] = state.frames_[parent] * local;
+    }
+
+    for (size_t i = 0; i < toolParents_.size(); ++i) {
+        int parent = toolParents_[i];
+        if (parent >= (int)first && state.dirty_[parent])
+            state.toolFrames_[i] = state.frames_[parent] * toolFixed_[i];
+    }
+
+    for (size_t k = first; k < parents_.size(); ++k)
+        state.dirty_[k] = false;
+    state.firstDirtyJoint_ = parents_.size();
+}
+
+template<typename JacobianType>
+void KinematicModel::chainJacobian(JacobianType& J, const KinematicState& state,
+                                   const vector<size_t>& jointIndices, const TRANSLATION& location) const
+{ // Same convention as Robot::jacobian()
+    J.resize(6, jointIndices.size());
+
+    for (size_t i = 0; i < jointIndices.size(); ++i) {
+        size_t k = jointIndices[i];
+        const TRANSFORM& frame = state.frames_[k];
+        AXIS z_i = frame.linear()*axes_[k];
+
+        if (types_[k] == REVOLUTE) {
+            J.template block<3,1>(0,i) = z_i.cross(location - frame.translation());
+            J.template block<3,1>(3,i) = z_i;
+        } else if (types_[k] == PRISMATIC) {
+            J.template block<3,1>(0,i) = z_i;
+            J.template block<3,1>(3,i).setZero();
+        } else {
+            J.col(i).setZero();
+        }
+    }
+}
+
+void KinematicModel::jacobian(MatrixXd& J, const KinematicState& state,
+                              const vector<size_t>& jointIndices, const TRANSLATION& location) const
+{
+    chainJacobian(J, state, jointIndices, location);
+}
+
+void KinematicModel::jacobian(Matrix6Xd& J, const KinematicState& state,
+                              const vector<size_t>& jointIndices, const TRANSLATION& location) const
+{
+    chainJacobian(J, state, jointIndices, location);
+}
+
+template void KinematicModel::chainJacobian(Matrix<double, 6, 6>&, const KinematicState&,
+                                            const vector<size_t>&, const TRANSLATION&) const;
+template void KinematicModel::chainJacobian(Matrix<double, 6, 7>&, const KinematicState&,
+                                            const vector<size_t>&, const TRANSLATION&) const;
+template void KinematicModel::chainJacobian(Matrix6Xd&, const KinematicState&,
+                                            const vector<size_t>&, const TRANSLATION&) const;
+
+double KinematicModel::mass() const
+{
+    double result = rootMass_;
+    for (size_t k = 0; k < masses_.size(); ++k)
+        result += masses_[k];
+    for (size_t i = 0; i < toolMasses_.size(); ++i)
+        result += toolMasses_[i];
+
+    return result;
+}
+
+TRANSLATION KinematicModel::centerOfMass(const KinematicState& state) const
+{
+    TRANSLATION com = rootCom_*rootMass_;
+    for (size_t k = 0; k < masses_.size(); ++k)
+        com += (state.frames_[k]*coms_[k])*masses_[k];
+    for (size_t i = 0; i < toolMasses_.size(); ++i)
+        com += (state.toolFrames_[i]*toolComs_[i])*toolMasses_[i];
+
+    double totalMass = mass();
+    if (totalMass > 0)
+        return com/totalMass;
+    else
+        return TRANSLATION::Zero();
+}
+
+//------------------------------------------------------------------------------
+// Batch forward kinematics
+//------------------------------------------------------------------------------
+static void batchConstant(const BatchKernelSet& kernels, POSE_BATCH& poses, const TRANSFORM& A)
+{
+    const Eigen::Matrix3d a = A.linear();
+    const TRANSLATION b = A.translation();
+    kernels.constant(poses.data(), poses.cols(), a.data(), b.data());
+}
+
+rk_result_t KinematicModel::forwardKinematicsBatch(const KinematicState& state, const vector<size_t>& jointIndices,
+                                                   const MatrixXd& configurations, POSE_BATCH& poses,
+                                                   const TRANSFORM& finalTransform) const
+{
+    if (jointIndices.size() == 0) {
+        cerr << "ERROR! No joints were given for batch forward kinematics!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    return batchToTip(state, jointIndices.back(), finalTransform, jointIndices, configurations, poses);
+}
+
+rk_result_t KinematicModel::forwardKinematicsBatch(const KinematicState& state, size_t linkageIndex,
+                                                   const MatrixXd& configurations, POSE_BATCH& poses) const
+{
+    if (linkageIndex >= toolParents_.size()) {
+        cerr << "ERROR! Linkage index (" << linkageIndex << ") is out of range!" << endl;
+        return RK_INVALID_LINKAGE;
+    }
+
+    vector<size_t> jointIndices;
+    linkageJointIndices(linkageIndex, jointIndices);
+
+    return batchToTip(state, toolParents_[linkageIndex], toolFixed_[linkageIndex],
+                      jointIndices, configurations, poses);
+}
+
+TRANSFORM KinematicModel::batchPose(const POSE_BATCH& poses, size_t sample)
+{
+    TRANSFORM pose = TRANSFORM::Identity();
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c)
+            pose.linear()(r,c) = poses(3*c+r, sample);
+        pose.translation()[r] = poses(9+r, sample);
+    }
+    return pose;
+}
+
+rk_result_t KinematicModel::batchToTip(const KinematicState& state, int tip, const TRANSFORM& tipOffset,
+                                       const vector<size_t>& jointIndices,
+                                       const MatrixXd& configurations, POSE_BATCH& poses) const
+{
+    if (configurations.rows() != (int)jointIndices.size()) {
+        cerr << "ERROR! Number of configuration rows (" << configurations.rows() << ") does not "
+             << "match the number of joints (" << jointIndices.size() << ")!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // Joints from the robot base out to the tip
+    vector<int> path;
+    for (int k = tip; k >= 0; k = parents_[k])
+        path.push_back(k);
+    reverse(path.begin(), path.end());
+
+    // Row of configurations that drives each joint on the path, or -1 if the
+    // joint keeps its value from state
+    vector<int> rows(path.size(), -1);
+    size_t first = path.size();
+    for (size_t i = 0; i < jointIndices.size(); ++i) {
+        size_t p = 0;
+        while (p < path.size() && path[p] != (int)jointIndices[i])
+            ++p;
+
+        if (p == path.size()) {
+            cerr << "ERROR! Joint " << jointIndices[i] << " is not on the way to the tip!" << endl;
+            return RK_INVALID_JOINT;
+        }
+
+        rows[p] = i;
+        if (p < first)
+            first = p;
+    }
+
+    // Everything upstream of the first batched joint is the same for every sample
+    TRANSFORM start = TRANSFORM::Identity();
+    if (first < path.size() && parents_[path[first]] >= 0)
+        start = state.frames_[parents_[path[first]]];
+    else if (first == path.size() && tip >= 0)
+        start = state.frames_[tip];
+
+    const size_t n = configurations.cols();
+    poses.resize(12, n);
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r)
+            poses.row(3*c+r).setConstant(start.linear()(r,c));
+    for (int r = 0; r < 3; ++r)
+        poses.row(9+r).setConstant(start.translation()[r]);
+
+    const BatchKernelSet& kernels = batchKernels();
+    double* T = poses.data();
+
+    ArrayXd q(n), cq(n), sq(n);
+    for (size_t p = first; p < path.size(); ++p) {
+        int k = path[p];
+
+        if (rows[p] < 0) {
+            TRANSFORM local;
+            jointTransform(local, fixed_[k], types_[k], axisTypes_[k], axes_[k], state.values_[k]);
+            batchConstant(kernels, poses, local);
+            continue;
+        }
+
+        q = configurations.row(rows[p]).transpose().array();
+        if (state.imposeLimits)
+            q = q.max(min_[k]).min(max_[k]);
+
+        batchConstant(kernels, poses, fixed_[k]);
+        if (types_[k] == REVOLUTE) {
+            // The trigonometry stays scalar; the kernels vectorize the products
+            cq = q.cos();
+            sq = q.sin();
+            int i = axisIndex(axisTypes_[k]);
+            if (i >= 0)
+                kernels.revoluteCoordinate(T, n, i, axisSign(axisTypes_[k]), cq.data(), sq.data());
+            else
+                kernels.revolute(T, n, axes_[k].data(), cq.data(), sq.data());
+        } else if (types_[k] == PRISMATIC) {
+            kernels.prismatic(T, n, axes_[k].data(), q.data());
+        }
+    }
+
+    batchConstant(kernels, poses, tipOffset);
+
+    return RK_SOLVED;
+}
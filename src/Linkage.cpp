@@ -16,6 +16,7 @@
 //------------------------------------------------------------------------------
 #include "Linkage.h"
 #include "Robot.h"
+#include <limits>
 
 
 //------------------------------------------------------------------------------
@@ -42,23 +43,34 @@ Joint& Joint::operator =( const Joint& joint )
 
     jointType_ = joint.jointType_;
     jointAxis_ = joint.jointAxis_;
+    axisType_ = joint.axisType_;
     min_ = joint.min_;
     max_ = joint.max_;
+    maxVelocity_ = joint.maxVelocity_;
 
-    value(joint.value_);
+    // The value already fits the copied limits, so only the transform and
+    // the linkage need to hear about it
+    value_ = joint.value_;
+    updateTransform();
 
     link = joint.link;
+
+    return *this;
 }
 
 Joint::Joint(const Joint &joint)
     : Frame::Frame(joint.respectToFixed_, joint.name(), joint.id(), JOINT),
-      respectToFixedTransformed_(joint.respectToFixedTransformed_),
+      link(joint.link),
+      value_(joint.value_),
       jointType_(joint.jointType_),
-      jointAxis_(joint.jointAxis_),
       min_(joint.min_),
       max_(joint.max_),
-      link(joint.link)
+      maxVelocity_(joint.maxVelocity_),
+      jointAxis_(joint.jointAxis_),
+      axisType_(joint.axisType_),
+      respectToFixedTransformed_(joint.respectToFixedTransformed_)
 {
+    link.frame_ = this;
     value(joint.value_);
 }
 
@@ -69,13 +81,15 @@ Joint::Joint(TRANSFORM respectToFixed,
                       AXIS axis,
                       double minValue, double maxValue)
             : Frame::Frame(respectToFixed, name, id, JOINT),
-              respectToFixedTransformed_(respectToFixed),
-              respectToLinkage_(respectToFixed),
+              value_(0),
               jointType_(jointType),
               min_(minValue),
               max_(maxValue),
-              value_(0)
+              maxVelocity_(numeric_limits<double>::infinity()),
+              respectToFixedTransformed_(respectToFixed),
+              respectToLinkage_(respectToFixed)
 {
+    link.frame_ = this;
     setJointAxis(axis);
     value(value_);
 }
@@ -88,37 +102,76 @@ Joint::~Joint()
 }
 
 Link::Link()
-    : mass_(0),
+    : massProvided(false),
+      tensorProvided(false),
+      mass_(0),
       com_(TRANSLATION::Zero()),
       tensor_(Eigen::Matrix3d::Zero()),
-      massProvided(false),
-      tensorProvided(false)
+      frame_(NULL)
 {
 
 }
 
 Link::Link(double newMass, TRANSLATION newCom)
-    : mass_(newMass),
+    : massProvided(true),
+      tensorProvided(false),
+      mass_(newMass),
       com_(newCom),
-      massProvided(true),
       tensor_(Eigen::Matrix3d::Zero()),
-      tensorProvided(false)
+      frame_(NULL)
 {
 
 }
 
 Link::Link(double newMass, TRANSLATION newCom, Eigen::Matrix3d newInertiaTensor)
-    : mass_(newMass),
+    : massProvided(true),
+      tensorProvided(true),
+      mass_(newMass),
       com_(newCom),
-      massProvided(true),
       tensor_(newInertiaTensor),
-      tensorProvided(true)
+      frame_(NULL)
+{
+
+}
+
+// The copy belongs to whichever frame it is copied into
+Link::Link(const Link& link)
+    : massProvided(link.massProvided),
+      tensorProvided(link.tensorProvided),
+      mass_(link.mass_),
+      com_(link.com_),
+      tensor_(link.tensor_),
+      frame_(NULL)
+{
+
+}
+
+Link& Link::operator=(const Link& link)
+{
+    mass_ = link.mass_;
+    com_ = link.com_;
+    tensor_ = link.tensor_;
+    massProvided = link.massProvided;
+    tensorProvided = link.tensorProvided;
+    massChanged();
+
+    return *this;
+}
+
+void Link::massChanged()
 {
+    if(NULL == frame_)
+        return;
 
+    if(frame_->hasLinkage)
+        frame_->linkage_->linksChanged();
+    else if(ROBOT == frame_->frameType_)
+        static_cast<Robot*>(frame_)->linksRevision_++;
 }
 
 void Link::setMass(double newMass, TRANSLATION newCom)
 {
+    massChanged();
     mass_ = newMass;
     com_ = newCom;
     massProvided = true;
@@ -127,13 +180,24 @@ void Link::setMass(double newMass, TRANSLATION newCom)
 double Link::mass() const { return mass_; }
 
 const TRANSLATION& Link::const_com() const { return com_; }
-TRANSLATION& Link::com() { return com_; }
+// The caller may write through the reference, so the cached mass sums are
+// dropped up front
+TRANSLATION& Link::com()
+{
+    massChanged();
+    return com_;
+}
 
 const Eigen::Matrix3d& Link::const_tensor() const { return tensor_; }
-Eigen::Matrix3d& Link::tensor() { return tensor_; }
+Eigen::Matrix3d& Link::tensor()
+{
+    massChanged();
+    return tensor_;
+}
 
 void Link::setInertiaTensor(Eigen::Matrix3d newInertiaTensor)
 {
+    massChanged();
     tensor_ = newInertiaTensor;
     tensorProvided = true;
 }
@@ -154,15 +218,27 @@ void Joint::setJointAxis(AXIS axis)
 {
     jointAxis_ = axis;
     jointAxis_.normalize();
+
+    axisType_ = classifyAxis(jointAxis_);
+    if(axisType_ != AXIS_ARBITRARY)
+    {
+        // Snap away the round-off so both paths agree exactly
+        jointAxis_.setZero();
+        jointAxis_[axisIndex(axisType_)] = axisSign(axisType_);
+    }
+
+    updateTransform();
 }
 
 AXIS Joint::getJointAxis() { return jointAxis_; }
+AxisType Joint::getAxisType() const { return axisType_; }
 
 // Joint Methods
 double Joint::value() const { return value_; }
 rk_result_t Joint::value(double newValue)
 {
     rk_result_t result = RK_SOLVED;
+    double previousValue = value_;
 
     if(newValue < min_)
     {
@@ -183,19 +259,50 @@ rk_result_t Joint::value(double newValue)
         if(!robot_->imposeLimits)
             value_ = newValue;
 
-    if (jointType_ == REVOLUTE) {
-        respectToFixedTransformed_ = respectToFixed_ * Eigen::AngleAxisd(value_, jointAxis_);
-    } else if(jointType_ == PRISMATIC){
-        respectToFixedTransformed_ = respectToFixed_ * Eigen::Translation3d(value_*jointAxis_);
-    } else {
-        respectToFixedTransformed_ = respectToFixed_;
-    }
+    // Rewriting the same value leaves the downstream frames valid
+    if(value_ != previousValue)
+        updateTransform();
+
+    return result;
+}
+
+void Joint::updateTransform()
+{
+    jointTransform(respectToFixedTransformed_, respectToFixed_, jointType_,
+                   axisType_, jointAxis_, value_);
 
-    // TODO: Decide if it is efficient to have this here
     if ( hasLinkage )
-        linkage_->updateFrames();
+        linkage_->markFramesDirty(localID_);
+}
 
-    return result;
+SCREW Joint::jacobianColumn(const TRANSLATION& location) const
+{
+    SCREW column;
+    AXIS z = respectToLinkage_.linear()*jointAxis_;
+
+    if (jointType_ == REVOLUTE)
+        column << z.cross(location - respectToLinkage_.translation()), z;
+    else if (jointType_ == PRISMATIC)
+        column << z, AXIS::Zero();
+    else
+        column.setZero();
+
+    return column;
+}
+
+SCREW Joint::jacobianColumn(const TRANSLATION& location, const TRANSFORM& linkageFrame) const
+{
+    SCREW column;
+    AXIS z = linkageFrame.linear()*(respectToLinkage_.linear()*jointAxis_);
+
+    if (jointType_ == REVOLUTE)
+        column << z.cross(location - linkageFrame*respectToLinkage_.translation()), z;
+    else if (jointType_ == PRISMATIC)
+        column << z, AXIS::Zero();
+    else
+        column.setZero();
+
+    return column;
 }
 
 JointType Joint::getJointType(){ return jointType_; }
@@ -209,7 +316,7 @@ void Joint::min(double newMin)
         max_ = min_;
 
     if(value_ < min_)
-        value_ = min_;
+        value(min_);
 }
 
 double Joint::max() const { return max_; }
@@ -221,9 +328,12 @@ void Joint::max(double newMax)
         min_ = max_;
 
     if(value_ > max_)
-        value_ = max_;
+        value(max_);
 }
 
+double Joint::maxVelocity() const { return maxVelocity_; }
+void Joint::maxVelocity(double newMaxVelocity) { maxVelocity_ = fabs(newMaxVelocity); }
+
 
 size_t Joint::localID() const
 {
@@ -235,7 +345,7 @@ const TRANSFORM& Joint::respectToFixed() const { return respectToFixed_; }
 void Joint::respectToFixed(TRANSFORM aCoordinate)
 {
     respectToFixed_ = aCoordinate;
-    value(value_);
+    updateTransform();
 }
 
 const TRANSFORM& Joint::respectToFixedTransformed() const
@@ -324,22 +434,24 @@ Tool& Tool::operator =(const Tool& tool)
     frameType_ = tool.frameType_;
 
     massProperties = tool.massProperties;
+
+    return *this;
 }
 
 
 Tool::Tool(const Tool &tool)
     : Frame::Frame(tool.respectToFixed_, tool.name_, tool.id_, TOOL),
-      respectToLinkage_(tool.respectToLinkage_),
-      massProperties(tool.massProperties)
+      massProperties(tool.massProperties),
+      respectToLinkage_(tool.respectToLinkage_)
 {
-
+    massProperties.frame_ = this;
 }
 
 Tool::Tool(TRANSFORM respectToFixed, string name, size_t id)
     : Frame::Frame(respectToFixed, name, id, TOOL),
       respectToLinkage_(respectToFixed)
 {
-
+    massProperties.frame_ = this;
 }
 
 // Tool Destructor
@@ -354,7 +466,7 @@ void Tool::respectToFixed(TRANSFORM aCoordinate)
 {
     respectToFixed_ = aCoordinate;
     if(hasLinkage)
-        linkage_->updateFrames();
+        linkage_->markFramesDirty(linkage_->nJoints());
 }
 
 const TRANSFORM& Tool::respectToLinkage() const
@@ -584,8 +696,11 @@ Linkage& Linkage::operator =( const Linkage& linkage )
     for(size_t i=0; i<linkage.joints_.size(); i++)
         addJoint(*(linkage.joints_[i]));
     setTool(linkage.tool_);
+    analyticalIK = linkage.analyticalIK;
     
     updateFrames();
+
+    return *this;
 }
 
 Linkage::Linkage(const Linkage &linkage)
@@ -593,14 +708,23 @@ Linkage::Linkage(const Linkage &linkage)
                    linkage.id_, linkage.frameType_),
       respectToRobot_(linkage.respectToRobot_),
       tool_(linkage.tool_),
-      initializing_(false),
       hasParent(false),
-      hasChildren(false)
+      hasChildren(false),
+      initializing_(false),
+      deferUpdates_(false),
+      framesDirty_(false),
+      firstDirtyJoint_(0),
+      framesMoved_(false),
+      linksRevision_(0),
+      massRevision_(-1),
+      framesRevision_(0),
+      momentRevision_(-1)
 {
     for(size_t i=0; i<linkage.joints_.size(); i++)
         addJoint(*(linkage.joints_[i]));
 
     setTool(linkage.tool_);
+    analyticalIK = linkage.analyticalIK;
     
     updateFrames();
 }
@@ -608,9 +732,17 @@ Linkage::Linkage(const Linkage &linkage)
 Linkage::Linkage()
     : Frame::Frame(TRANSFORM::Identity(), "", 0, LINKAGE),
       respectToRobot_(TRANSFORM::Identity()),
-      initializing_(false),
       hasParent(false),
-      hasChildren(false)
+      hasChildren(false),
+      initializing_(false),
+      deferUpdates_(false),
+      framesDirty_(false),
+      firstDirtyJoint_(0),
+      framesMoved_(false),
+      linksRevision_(0),
+      massRevision_(-1),
+      framesRevision_(0),
+      momentRevision_(-1)
 {
     analyticalIK = Linkage::defaultAnalyticalIK;
 }
@@ -618,9 +750,17 @@ Linkage::Linkage()
 Linkage::Linkage(TRANSFORM respectToFixed, string name, size_t id)
     : Frame::Frame(respectToFixed, name, id, LINKAGE),
       respectToRobot_(TRANSFORM::Identity()),
-      initializing_(false),
       hasParent(false),
-      hasChildren(false)
+      hasChildren(false),
+      initializing_(false),
+      deferUpdates_(false),
+      framesDirty_(false),
+      firstDirtyJoint_(0),
+      framesMoved_(false),
+      linksRevision_(0),
+      massRevision_(-1),
+      framesRevision_(0),
+      momentRevision_(-1)
 {
     analyticalIK = Linkage::defaultAnalyticalIK;
 }
@@ -629,9 +769,17 @@ Linkage::Linkage(TRANSFORM respectToFixed, string name, size_t id)
 Linkage::Linkage(TRANSFORM respectToFixed, string name, size_t id, Joint joint, Tool tool)
     : Frame::Frame(respectToFixed, name, id, LINKAGE),
       respectToRobot_(respectToFixed),
-      initializing_(false),
       hasParent(false),
-      hasChildren(false)
+      hasChildren(false),
+      initializing_(false),
+      deferUpdates_(false),
+      framesDirty_(false),
+      firstDirtyJoint_(0),
+      framesMoved_(false),
+      linksRevision_(0),
+      massRevision_(-1),
+      framesRevision_(0),
+      momentRevision_(-1)
 {
     analyticalIK = Linkage::defaultAnalyticalIK;
     vector<Joint> joints(1);
@@ -642,9 +790,17 @@ Linkage::Linkage(TRANSFORM respectToFixed, string name, size_t id, Joint joint,
 Linkage::Linkage(TRANSFORM respectToFixed, string name, size_t id, vector<Joint> joints, Tool tool)
     : Frame::Frame(respectToFixed, name, id, LINKAGE),
       respectToRobot_(respectToFixed),
-      initializing_(false),
       hasParent(false),
-      hasChildren(false)
+      hasChildren(false),
+      initializing_(false),
+      deferUpdates_(false),
+      framesDirty_(false),
+      firstDirtyJoint_(0),
+      framesMoved_(false),
+      linksRevision_(0),
+      massRevision_(-1),
+      framesRevision_(0),
+      momentRevision_(-1)
 {
     analyticalIK = Linkage::defaultAnalyticalIK;
     initialize(joints, tool);
@@ -776,10 +932,14 @@ bool Linkage::values(const VectorXd& someValues)
 {    
     if(someValues.size() == nJoints())
     {
+        bool wasDeferring = deferUpdates_;
+        deferUpdates_ = true;
         for (size_t i = 0; i < nJoints(); ++i) {
             joints_[i]->value(someValues(i));
         }
-        updateFrames();
+        deferUpdates_ = wasDeferring;
+        if(framesDirty_ && !deferringUpdates())
+            updateStaleFrames();
         return true;
     }
     
@@ -792,7 +952,12 @@ const TRANSFORM& Linkage::respectToFixed() const { return respectToFixed_; }
 void Linkage::respectToFixed(TRANSFORM aCoordinate)
 {
     respectToFixed_ = aCoordinate;
-    updateFrames();
+    if(hasParent)
+        respectToRobot_ = parentLinkage_->tool_.respectToRobot() * respectToFixed_;
+    else
+        respectToRobot_ = respectToFixed_;
+    framesChanged();
+    markFramesDirty(nJoints());
 }
 
 
@@ -812,40 +977,7 @@ TRANSFORM Linkage::respectToWorld() const
 
 void Linkage::jacobian(MatrixXd& J, TRANSLATION location, const Frame* refFrame) const
 { // location should be specified respect to linkage coordinate frame
-    
-    size_t nCols = nJoints();
-    J.resize(6, nCols);
-    
-    TRANSLATION o_i, d_i, z_i; // Joint i location, offset, axis
-    
-    for (size_t i = 0; i < nCols; ++i) {
-        
-        o_i = joints_[i]->respectToLinkage_.translation(); // Joint i location
-//        d_i = o_i - location; // Vector from location to joint i
-        d_i = location - o_i; // Changing convention so that the position vector points away from the joint axis
-//        z_i = joints_[i]->respectToLinkage_.rotation().col(2); // Joint i joint axis
-        z_i = joints_[i]->respectToLinkage_.rotation()*joints_[i]->jointAxis_;
-
-        // Set column i of Jocabian
-        if (joints_[i]->jointType_ == REVOLUTE) {
-//            J.block(0, i, 3, 1) = d_i.cross(z_i);
-            J.block(0, i, 3, 1) = z_i.cross(d_i); // Changing convention to (w x r)
-            J.block(3, i, 3, 1) = z_i;
-        } else if(joints_[i]->jointType_ == PRISMATIC) {
-            J.block(0, i, 3, 1) = z_i;
-            J.block(3, i, 3, 1) = TRANSLATION::Zero();
-        } else {
-            J.block(0, i, 3, 1) = TRANSLATION::Zero();
-            J.block(3, i, 3, 1) = TRANSLATION::Zero();
-        }
-        
-    }
-    
-    // Jacobian transformation
-    Matrix3d r(refFrame->respectToWorld().rotation().inverse() * respectToWorld().rotation());
-    MatrixXd R(6,6);
-    R << r, Matrix3d::Zero(), Matrix3d::Zero(), r;
-    J = R * J;
+    jacobian(J, joints_, location, refFrame);
 }
 
 void Linkage::jacobian(MatrixXd& J, const vector<Joint*>& jointFrames, TRANSLATION location, const Frame* refFrame) const
@@ -854,36 +986,41 @@ void Linkage::jacobian(MatrixXd& J, const vector<Joint*>& jointFrames, TRANSLATI
     size_t nCols = jointFrames.size();
     J.resize(6, nCols);
 
-    TRANSLATION o_i, d_i, z_i; // Joint i location, offset, axis
+    for (size_t i = 0; i < nCols; ++i)
+        J.block<6,1>(0, i) = jointFrames[i]->jacobianColumn(location);
 
+    // Jacobian transformation, applied blockwise so no 6x6 temporary is needed
+    if(refFrame == this)
+        return;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld().linear());
     for (size_t i = 0; i < nCols; ++i) {
+        J.block<3,1>(0, i) = r * J.block<3,1>(0, i);
+        J.block<3,1>(3, i) = r * J.block<3,1>(3, i);
+    }
+}
 
-        o_i = jointFrames[i]->respectToLinkage_.translation(); // Joint i location
-//        d_i = o_i - location; // Vector from location to joint i
-        d_i = location - o_i; // Changing convention so that the position vector points away from the joint axis
-//        z_i = jointFrames[i]->respectToLinkage_.rotation().col(2); // Joint i joint axis
-        z_i = jointFrames[i]->respectToLinkage_.rotation()*jointFrames[i]->jointAxis_;
-
-        // Set column i of Jocabian
-        if (jointFrames[i]->jointType_ == REVOLUTE) {
-//            J.block(0, i, 3, 1) = d_i.cross(z_i);
-            J.block(0, i, 3, 1) = z_i.cross(d_i); // Changing convention to (w x r)
-            J.block(3, i, 3, 1) = z_i;
-        } else if(jointFrames[i]->jointType_ == PRISMATIC) {
-            J.block(0, i, 3, 1) = z_i;
-            J.block(3, i, 3, 1) = TRANSLATION::Zero();
-        } else {
-            J.block(0, i, 3, 1) = TRANSLATION::Zero();
-            J.block(3, i, 3, 1) = TRANSLATION::Zero();
-        }
+void Linkage::jacobian(Matrix6Xd& J, const TRANSLATION& location, const Frame* refFrame) const
+{
+    jacobian(J, joints_, location, refFrame);
+}
 
-    }
+void Linkage::jacobian(Matrix6Xd& J, const vector<Joint*>& jointFrames, const TRANSLATION& location, const Frame* refFrame) const
+{
+    size_t nCols = jointFrames.size();
+    J.resize(6, nCols);
+
+    for (size_t i = 0; i < nCols; ++i)
+        J.col(i) = jointFrames[i]->jacobianColumn(location);
 
-    // Jacobian transformation
-    Matrix3d r(refFrame->respectToWorld().rotation().inverse() * respectToWorld().rotation());
-    MatrixXd R(6,6);
-    R << r, Matrix3d::Zero(), Matrix3d::Zero(), r;
-    J = R * J;
+    if(refFrame == this)
+        return;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld().linear());
+    for (size_t i = 0; i < nCols; ++i) {
+        J.block<3,1>(0, i) = r * J.block<3,1>(0, i);
+        J.block<3,1>(3, i) = r * J.block<3,1>(3, i);
+    }
 }
 
 
@@ -937,6 +1074,7 @@ void Linkage::initialize(vector<Joint> joints, Tool tool)
 
 void Linkage::addJoint(Joint newJoint)
 {
+    linksChanged();
     Joint* tempJoint = new Joint(newJoint);
     size_t newIndex = joints_.size();
     joints_.push_back(tempJoint);
@@ -967,6 +1105,8 @@ void Linkage::setTool(Tool newTool)
     if(hasRobot)
         tool_.Tool::robot_ = robot_;
     tool_.Tool::hasRobot = hasRobot;
+
+    linksChanged();
 }
 
 rk_result_t Linkage::setJointValue(size_t jointIndex, double val){ return joint(jointIndex).value(val); }
@@ -977,22 +1117,70 @@ rk_result_t Linkage::setJointValue(string jointName, double val){ return joint(j
 void Linkage::updateFrames()
 {
     if (~initializing_) {
-        for (size_t i = 0; i < joints_.size(); ++i) {
-            if (i == 0) {
-                joints_[i]->respectToLinkage_ = joints_[i]->respectToFixedTransformed_;
-                
-            } else {
-                joints_[i]->respectToLinkage_ = joints_[i-1]->respectToLinkage_ * joints_[i]->respectToFixedTransformed_;
-            }
+        firstDirtyJoint_ = 0;
+        updateStaleFrames();
+    }
+}
+
+void Linkage::updateStaleFrames()
+{
+    updateJointFrames();
+
+    if(hasChildren)
+        updateChildLinkage();
+}
+
+void Linkage::updateJointFrames()
+{
+    // Everything upstream of the first modified joint is still valid
+    for (size_t i = firstDirtyJoint_; i < joints_.size(); ++i) {
+        if (i == 0) {
+            joints_[i]->respectToLinkage_ = joints_[i]->respectToFixedTransformed_;
+
+        } else {
+            joints_[i]->respectToLinkage_ = joints_[i-1]->respectToLinkage_ * joints_[i]->respectToFixedTransformed_;
         }
-        if(joints_.size() > 0)
-            tool_.respectToLinkage_ = joints_[joints_.size()-1]->respectToLinkage_ * tool_.respectToFixed_;
-        else
-            tool_.respectToLinkage_ = tool_.respectToFixed_;
-        
-        if(hasChildren)
-            updateChildLinkage();
     }
+    if(joints_.size() > 0)
+        tool_.respectToLinkage_ = joints_[joints_.size()-1]->respectToLinkage_ * tool_.respectToFixed_;
+    else
+        tool_.respectToLinkage_ = tool_.respectToFixed_;
+
+    framesDirty_ = false;
+    firstDirtyJoint_ = joints_.size();
+    framesChanged();
+}
+
+void Linkage::framesChanged()
+{
+    framesRevision_++;
+    if(hasRobot)
+        robot_->frameRevision_++;
+}
+
+void Linkage::linksChanged()
+{
+    linksRevision_++;
+    if(hasRobot)
+        robot_->linksRevision_++;
+}
+
+void Linkage::markFramesDirty(size_t fromJoint)
+{
+    framesDirty_ = true;
+    if(fromJoint < firstDirtyJoint_)
+        firstDirtyJoint_ = fromJoint;
+
+    // The robot or a bulk write will pick up the stale frames in one pass
+    if(deferringUpdates())
+        return;
+
+    updateStaleFrames();
+}
+
+bool Linkage::deferringUpdates() const
+{
+    return deferUpdates_ || (hasRobot && robot_->deferUpdates_);
 }
 
 
@@ -1005,23 +1193,29 @@ void Linkage::updateChildLinkage()
     }
 }
 
-bool Linkage::defaultAnalyticalIK(VectorXd& q, const TRANSFORM& B, const VectorXd& qPrev) {
+bool Linkage::defaultAnalyticalIK(Robot&, VectorXd& q, const TRANSFORM&, const VectorXd& qPrev) {
     // This function is just a place holder and should not be used. The analyticalIK function pointer should be set to the real analytical IK function.
     q = NAN * qPrev;
     return false;
 }
 
+bool Linkage::hasAnalyticalIK() const {
+    typedef bool (*Placeholder)(Robot&, VectorXd&, const TRANSFORM&, const VectorXd&);
+    const Placeholder* target = analyticalIK.target<Placeholder>();
+    return analyticalIK && !(target != NULL && *target == &Linkage::defaultAnalyticalIK);
+}
+
 
 // Mass returns
 
 TRANSLATION Joint::centerOfMass(FrameType withRespectTo)
 {
     if(WORLD == withRespectTo)
-        return respectToWorld()*link.com();
+        return respectToWorld()*link.const_com();
     else if(ROBOT == withRespectTo)
-        return respectToRobot()*link.com();
+        return respectToRobot()*link.const_com();
     else if(LINKAGE == withRespectTo)
-        return respectToLinkage()*link.com();
+        return respectToLinkage()*link.const_com();
 
     cerr << "Invalid Frame type for center of mass calculation: "
             << FrameType_to_string(withRespectTo) << endl;
@@ -1032,11 +1226,11 @@ double Joint::mass() { return link.mass(); }
 TRANSLATION Tool::centerOfMass(FrameType withRespectTo)
 {
     if(WORLD == withRespectTo)
-        return respectToWorld()*massProperties.com();
+        return respectToWorld()*massProperties.const_com();
     else if(ROBOT == withRespectTo)
-        return respectToRobot()*massProperties.com();
+        return respectToRobot()*massProperties.const_com();
     else if(LINKAGE == withRespectTo)
-        return respectToLinkage()*massProperties.com();
+        return respectToLinkage()*massProperties.const_com();
 
     cerr << "Invalid index type for center of mass calculation: "
             << FrameType_to_string(withRespectTo) << endl;
@@ -0,0 +1,204 @@
+/*
+ -------------------------------------------------------------------------------
+ ParallelIK.cpp
+ Robot Library Project
+
+ Multi-start inverse kinematics on a pool of threads.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "ParallelIK.h"
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// ParallelIK Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+ParallelIK::ParallelIK(const KinematicModel& model, size_t nThreads)
+    : model_(model),
+      generation_(0),
+      busy_(0),
+      shutdown_(false),
+      jobState_(NULL),
+      jobIndices_(NULL),
+      jobValues_(NULL),
+      jobTarget_(NULL),
+      jobConstraints_(NULL),
+      jobAttempts_(0),
+      jobSeed_(0),
+      nextAttempt_(0),
+      cancel_(false),
+      bestResult_(RK_SOLVER_NOT_READY),
+      bestError_(0),
+      bestAttempt_(-1)
+{
+    if(nThreads == 0)
+        nThreads = thread::hardware_concurrency();
+    if(nThreads == 0)
+        nThreads = 1;
+
+    workers_.resize(nThreads);
+    for(size_t i=0; i<nThreads; i++)
+        workers_[i] = new Worker(model_);
+
+    for(size_t i=0; i<nThreads; i++)
+        workers_[i]->thread = thread(&ParallelIK::work, this, workers_[i]);
+}
+
+// Destructor
+ParallelIK::~ParallelIK()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    wake_.notify_all();
+
+    for(size_t i=0; i<workers_.size(); i++)
+    {
+        workers_[i]->thread.join();
+        delete workers_[i];
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// ParallelIK Public Member Functions
+//------------------------------------------------------------------------------
+rk_result_t ParallelIK::dampedLeastSquaresIK_chain(KinematicState& state, const vector<size_t>& jointIndices,
+                                                   VectorXd& jointValues, const TRANSFORM& target,
+                                                   const Constraints& constraints)
+{
+    if(jointIndices.size() == 0 || (size_t)jointValues.size() != jointIndices.size())
+    {
+        cerr << "ERROR! Chain has " << jointIndices.size() << " joints but "
+             << jointValues.size() << " values were given!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    size_t maxAttempts = 1;
+    if(constraints.useIterativeJacobianSeed)
+        maxAttempts = constraints.maxAttempts;
+
+    unique_lock<mutex> lock(mutex_);
+
+    jobState_ = &state;
+    jobIndices_ = &jointIndices;
+    jobValues_ = &jointValues;
+    jobTarget_ = &target;
+    jobConstraints_ = &constraints;
+    jobAttempts_ = maxAttempts;
+    jobSeed_ = state.random();
+    nextAttempt_.store(0);
+    cancel_.store(false);
+
+    bestResult_ = RK_DIVERGED;
+    bestError_ = numeric_limits<double>::infinity();
+    bestAttempt_ = -1;
+
+    busy_ = workers_.size();
+    generation_++;
+    wake_.notify_all();
+
+    while(busy_ > 0)
+        finished_.wait(lock);
+
+    jobState_ = NULL;
+    jobIndices_ = NULL;
+    jobValues_ = NULL;
+    jobTarget_ = NULL;
+    jobConstraints_ = NULL;
+
+    if(bestAttempt_ >= 0)
+    {
+        jointValues = bestValues_;
+        model_.values(state, jointIndices, jointValues);
+    }
+
+    return bestResult_;
+}
+
+size_t ParallelIK::threads() const { return workers_.size(); }
+int ParallelIK::lastAttempt() const { return bestAttempt_; }
+double ParallelIK::lastError() const { return bestError_; }
+
+// Every worker takes one ticket past the end before it stops
+size_t ParallelIK::attemptsStarted() const { return std::min(nextAttempt_.load(), jobAttempts_); }
+
+
+//------------------------------------------------------------------------------
+// ParallelIK Protected Member Functions
+//------------------------------------------------------------------------------
+void ParallelIK::work(Worker* worker)
+{
+    size_t generation = 0;
+
+    while(true)
+    {
+        {
+            unique_lock<mutex> lock(mutex_);
+            while(!shutdown_ && generation == generation_)
+                wake_.wait(lock);
+
+            if(shutdown_)
+                return;
+
+            generation = generation_;
+        }
+
+        // Sizes match after the first solve, so these copies do not allocate
+        worker->state = *jobState_;
+
+        size_t attempt;
+        while(!cancel_.load(memory_order_relaxed)
+              && (attempt = nextAttempt_.fetch_add(1)) < jobAttempts_)
+        {
+            worker->values = *jobValues_;
+            worker->state.random.seed(jobSeed_ + attempt);
+
+            double error;
+            rk_result_t result = model_.dampedLeastSquaresIK_attempt(worker->state, *jobIndices_, worker->values,
+                                                                     *jobTarget_, *jobConstraints_,
+                                                                     worker->workspace, attempt, error, &cancel_);
+
+            lock_guard<mutex> lock(mutex_);
+            if(bestResult_ == RK_SOLVED)
+                continue;
+
+            if(result == RK_SOLVED || error < bestError_)
+            {
+                bestResult_ = result;
+                bestError_ = error;
+                bestAttempt_ = (int)attempt;
+                bestValues_ = worker->values;
+            }
+
+            if(result == RK_SOLVED)
+                cancel_.store(true);
+        }
+
+        lock_guard<mutex> lock(mutex_);
+        busy_--;
+        if(busy_ == 0)
+            finished_.notify_all();
+    }
+}
@@ -33,21 +33,43 @@ using namespace RobotKin;
 // Constructors
 Robot::Robot()
         : Frame::Frame(TRANSFORM::Identity()),
+          imposeLimits(true),
           respectToWorld_(TRANSFORM::Identity()),
           initializing_(false),
-          imposeLimits(true)
+          deferUpdates_(false),
+          frameRevision_(0),
+          linksRevision_(0),
+          massCache_(0),
+          massRevision_(-1),
+          momentCache_(TRANSLATION::Zero()),
+          momentRevision_(-1),
+          momentFrameRevision_(-1),
+          subtreeRevision_(-1),
+          subtreeFrameRevision_(-1)
 {
     linkages_.resize(0);
     frameType_ = ROBOT;
+    rootLink.frame_ = this;
 }
 
 Robot::Robot(vector<Linkage> linkageObjs, vector<int> parentIndices)
         : Frame::Frame(TRANSFORM::Identity()),
+          imposeLimits(true),
           respectToWorld_(TRANSFORM::Identity()),
           initializing_(false),
-          imposeLimits(true)
+          deferUpdates_(false),
+          frameRevision_(0),
+          linksRevision_(0),
+          massCache_(0),
+          massRevision_(-1),
+          momentCache_(TRANSLATION::Zero()),
+          momentRevision_(-1),
+          momentFrameRevision_(-1),
+          subtreeRevision_(-1),
+          subtreeFrameRevision_(-1)
 {
     frameType_ = ROBOT;
+    rootLink.frame_ = this;
     
     linkages_.resize(0);
     initialize(linkageObjs, parentIndices);
@@ -56,9 +78,21 @@ Robot::Robot(vector<Linkage> linkageObjs, vector<int> parentIndices)
 #ifdef HAVE_URDF_PARSE
 Robot::Robot(string filename, string name, size_t id)
     : Frame::Frame(TRANSFORM::Identity(), name, id, ROBOT),
+      imposeLimits(true),
       respectToWorld_(TRANSFORM::Identity()),
-      initializing_(false)
+      initializing_(false),
+      deferUpdates_(false),
+      frameRevision_(0),
+      linksRevision_(0),
+      massCache_(0),
+      massRevision_(-1),
+      momentCache_(TRANSLATION::Zero()),
+      momentRevision_(-1),
+      momentFrameRevision_(-1),
+      subtreeRevision_(-1),
+      subtreeFrameRevision_(-1)
 {
+    rootLink.frame_ = this;
     // TODO: Test to make sure filename ends with ".urdf"
     linkages_.resize(0);
     loadURDF(filename);
@@ -76,21 +110,34 @@ bool Robot::loadURDFString(string filename)
 #else  // HAVE_URDF_PARSE
 Robot::Robot(string filename, string name, size_t id)
     : Frame::Frame(TRANSFORM::Identity(), name, id, ROBOT),
+      imposeLimits(true),
       respectToWorld_(TRANSFORM::Identity()),
       initializing_(false),
-      imposeLimits(true)
+      deferUpdates_(false),
+      frameRevision_(0),
+      linksRevision_(0),
+      massCache_(0),
+      massRevision_(-1),
+      momentCache_(TRANSLATION::Zero()),
+      momentRevision_(-1),
+      momentFrameRevision_(-1),
+      subtreeRevision_(-1),
+      subtreeFrameRevision_(-1)
 {
+    rootLink.frame_ = this;
     std::cerr << "There was no URDF Parser installed when you compiled RobotKin!" << std::endl;
 }
 
 bool Robot::loadURDF(string filename)
 {
     std::cerr << "There was no URDF Parser installed when you compiled RobotKin!" << std::endl;
+    return false;
 }
 
 bool Robot::loadURDFString(string filename)
 {
     std::cerr << "There was no URDF Parser installed when you compiled RobotKin!" << std::endl;
+    return false;
 }
 
 #endif // HAVE_URDF_PARSE
@@ -248,10 +295,14 @@ void Robot::values(const VectorXd& someValues) {
 
     if(someValues.size() == nJoints())
     {
+        bool wasDeferring = deferUpdates_;
+        deferUpdates_ = true;
         for (size_t i = 0; i < nJoints(); ++i) {
             joints_[i]->value(someValues(i));
         }
-        updateFrames();
+        deferUpdates_ = wasDeferring;
+        if(!deferUpdates_)
+            updateStaleFrames();
     }
     else
         cerr << "Invalid number of joint values: " << someValues.size()
@@ -264,9 +315,13 @@ void Robot::values(const vector<size_t>& jointIndices, const VectorXd& jointValu
 {
     if( jointIndices.size() == jointValues.size() )
     {
+        bool wasDeferring = deferUpdates_;
+        deferUpdates_ = true;
         for(size_t i=0; i<jointIndices.size(); i++)
             joints_[jointIndices[i]]->value(jointValues[i]);
-        updateFrames();
+        deferUpdates_ = wasDeferring;
+        if(!deferUpdates_)
+            updateStaleFrames();
     }
     else
         cerr << "Invalid number of joint values: " << jointValues.size()
@@ -295,36 +350,149 @@ void Robot::jacobian(MatrixXd& J, const vector<Joint*>& jointFrames, TRANSLATION
 { // location should be specified in respect to robot coordinates
     size_t nCols = jointFrames.size();
     J.resize(6, nCols);
-    
-    TRANSLATION o_i, d_i; AXIS z_i; // Joint i location, offset, axis
-    
+
+    // Each joint's cached frame in its linkage is placed by the linkage's
+    // frame, instead of building the full joint transform per column
+    for (size_t i = 0; i < nCols; i++)
+        J.block<6,1>(0, i) = jointFrames[i]->jacobianColumn(location, jointFrames[i]->linkage_->respectToRobot_);
+
+    // Jacobian transformation, applied blockwise so no 6x6 temporary is needed
+    if(refFrame == this)
+        return;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld_.linear());
     for (size_t i = 0; i < nCols; i++) {
+        J.block<3,1>(0, i) = r * J.block<3,1>(0, i);
+        J.block<3,1>(3, i) = r * J.block<3,1>(3, i);
+    }
+}
 
-        o_i = jointFrames[i]->respectToRobot().translation(); // Joint i location
-        d_i = location - o_i; // Changing convention so that the position vector points away from the joint axis
-        z_i = jointFrames[i]->respectToRobot().rotation()*jointFrames[i]->jointAxis_;
-
-//        cout << jointFrames[i]->name() << " " << d_i.transpose() << " : " << z_i.transpose() << endl;
-        
-        // Set column i of Jocabian
-        if (jointFrames[i]->jointType_ == REVOLUTE) {
-            J.block(0, i, 3, 1) = z_i.cross(d_i);
-            J.block(3, i, 3, 1) = z_i;
-        } else if(jointFrames[i]->jointType_ == PRISMATIC) {
-            J.block(0, i, 3, 1) = z_i;
-            J.block(3, i, 3, 1) = AXIS::Zero();
-        } else {
-            J.block(0, i, 3, 1) = AXIS::Zero();
-            J.block(3, i, 3, 1) = AXIS::Zero();
-        }
-        
+template<int N>
+void Robot::jacobian(Matrix<double, 6, N>& J, const vector<Joint*>& jointFrames,
+                     const TRANSLATION& location) const
+{
+    J.resize(6, jointFrames.size());
+
+    for (size_t i = 0; i < jointFrames.size(); i++)
+        J.col(i) = jointFrames[i]->jacobianColumn(location, jointFrames[i]->linkage_->respectToRobot_);
+}
+
+template<int N>
+void Robot::jacobian(Matrix<double, 6, N>& J, const vector<Joint*>& jointFrames,
+                     const TRANSLATION& location, const Frame* refFrame) const
+{
+    jacobian<N>(J, jointFrames, location);
+
+    if(refFrame == this)
+        return;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld_.linear());
+    for (size_t i = 0; i < jointFrames.size(); i++) {
+        J.template block<3,1>(0, i) = r * J.template block<3,1>(0, i);
+        J.template block<3,1>(3, i) = r * J.template block<3,1>(3, i);
     }
-    
-    // Jacobian transformation
-    Matrix3d r(refFrame->respectToWorld().rotation().inverse() * respectToWorld_.rotation());
-    MatrixXd R(6,6);
-    R << r, Matrix3d::Zero(), Matrix3d::Zero(), r;
-    J = R * J;
+}
+
+template void Robot::jacobian<6>(Matrix<double, 6, 6>&, const vector<Joint*>&, const TRANSLATION&) const;
+template void Robot::jacobian<7>(Matrix<double, 6, 7>&, const vector<Joint*>&, const TRANSLATION&) const;
+template void Robot::jacobian<Dynamic>(Matrix6Xd&, const vector<Joint*>&, const TRANSLATION&) const;
+template void Robot::jacobian<6>(Matrix<double, 6, 6>&, const vector<Joint*>&, const TRANSLATION&, const Frame*) const;
+template void Robot::jacobian<7>(Matrix<double, 6, 7>&, const vector<Joint*>&, const TRANSLATION&, const Frame*) const;
+template void Robot::jacobian<Dynamic>(Matrix6Xd&, const vector<Joint*>&, const TRANSLATION&, const Frame*) const;
+
+template<int N>
+rk_result_t Robot::jacobianDerivative(Matrix<double, 6, N>& J, Matrix<double, 6, N>& Jdot,
+                                      const vector<Joint*>& jointFrames, const TRANSLATION& location,
+                                      const VectorXd& jointVelocities, const Frame* refFrame) const
+{
+    size_t nCols = jointFrames.size();
+    if((size_t)jointVelocities.size() != nCols)
+    {
+        cerr << "ERROR! Jacobian derivative needs " << nCols << " joint velocities but got "
+             << jointVelocities.size() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    J.resize(6, nCols);
+    Jdot.resize(6, nCols);
+
+    // omega and v are the angular velocity of the body carrying joint i and
+    // the velocity that body alone gives location. Each column is a twist
+    // fixed in that body, so its derivative is omega x column, plus the
+    // motion of location relative to the body, added once v is complete.
+    AXIS omega = AXIS::Zero();
+    TRANSLATION v = TRANSLATION::Zero();
+    for (size_t i = 0; i < nCols; i++) {
+        J.col(i) = jointFrames[i]->jacobianColumn(location, jointFrames[i]->linkage_->respectToRobot_);
+
+        Jdot.template block<3,1>(0, i) = omega.cross(J.template block<3,1>(0, i))
+                                       - J.template block<3,1>(3, i).cross(v);
+        Jdot.template block<3,1>(3, i) = omega.cross(J.template block<3,1>(3, i));
+
+        v += J.template block<3,1>(0, i)*jointVelocities[i];
+        omega += J.template block<3,1>(3, i)*jointVelocities[i];
+    }
+
+    for (size_t i = 0; i < nCols; i++)
+        Jdot.template block<3,1>(0, i) += J.template block<3,1>(3, i).cross(v);
+
+    if(refFrame == this)
+        return RK_SOLVED;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld_.linear());
+    for (size_t i = 0; i < nCols; i++) {
+        J.template block<3,1>(0, i) = r * J.template block<3,1>(0, i);
+        J.template block<3,1>(3, i) = r * J.template block<3,1>(3, i);
+        Jdot.template block<3,1>(0, i) = r * Jdot.template block<3,1>(0, i);
+        Jdot.template block<3,1>(3, i) = r * Jdot.template block<3,1>(3, i);
+    }
+
+    return RK_SOLVED;
+}
+
+template rk_result_t Robot::jacobianDerivative<6>(Matrix<double, 6, 6>&, Matrix<double, 6, 6>&, const vector<Joint*>&,
+                                                  const TRANSLATION&, const VectorXd&, const Frame*) const;
+template rk_result_t Robot::jacobianDerivative<7>(Matrix<double, 6, 7>&, Matrix<double, 6, 7>&, const vector<Joint*>&,
+                                                  const TRANSLATION&, const VectorXd&, const Frame*) const;
+template rk_result_t Robot::jacobianDerivative<Dynamic>(Matrix6Xd&, Matrix6Xd&, const vector<Joint*>&,
+                                                        const TRANSLATION&, const VectorXd&, const Frame*) const;
+
+rk_result_t Robot::jacobianDerivativeTimesVelocity(SCREW& JdotQd, const vector<Joint*>& jointFrames,
+                                                   const TRANSLATION& location, const VectorXd& jointVelocities,
+                                                   const Frame* refFrame) const
+{
+    if((size_t)jointVelocities.size() != jointFrames.size())
+    {
+        cerr << "ERROR! Jacobian derivative needs " << jointFrames.size() << " joint velocities but got "
+             << jointVelocities.size() << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // Same recursion as jacobianDerivative(), summed as it goes. The terms
+    // that need the final velocity of location add up to omega x v.
+    AXIS omega = AXIS::Zero();
+    TRANSLATION v = TRANSLATION::Zero();
+    JdotQd.setZero();
+    for (size_t i = 0; i < jointFrames.size(); i++) {
+        SCREW column = jointFrames[i]->jacobianColumn(location, jointFrames[i]->linkage_->respectToRobot_);
+        double qd = jointVelocities[i];
+
+        JdotQd.head<3>() += (omega.cross(column.head<3>()) - column.tail<3>().cross(v))*qd;
+        JdotQd.tail<3>() += omega.cross(column.tail<3>())*qd;
+
+        v += column.head<3>()*qd;
+        omega += column.tail<3>()*qd;
+    }
+    JdotQd.head<3>() += omega.cross(v);
+
+    if(refFrame == this)
+        return RK_SOLVED;
+
+    Matrix3d r(refFrame->respectToWorld().linear().transpose() * respectToWorld_.linear());
+    JdotQd.head<3>() = r * JdotQd.head<3>();
+    JdotQd.tail<3>() = r * JdotQd.tail<3>();
+
+    return RK_SOLVED;
 }
 
 void Robot::printInfo() const
@@ -391,6 +559,8 @@ void Robot::initialize(vector<Linkage> linkages, vector<int> parentIndices)
 
 void Robot::addLinkage(Linkage linkage, int parentIndex, string name)
 {
+    linksRevision_++;
+
     // Get the linkage adjusted to its new home
     size_t newIndex = linkages_.size();
 
@@ -461,6 +631,8 @@ void Robot::addLinkage(int parentIndex, string name)
 void Robot::updateFrames()
 {
 //    if (~initializing_) { // TODO: Decide if this is necessary
+        // Parents are always added before their children, so a single sweep
+        // sees every parent tool frame before it is needed
         for (vector<Linkage*>::iterator linkageIt = linkages_.begin();
              linkageIt != linkages_.end(); ++linkageIt) {
             
@@ -469,10 +641,44 @@ void Robot::updateFrames()
             } else {
                 (*linkageIt)->respectToRobot_ = (*linkageIt)->parentLinkage_->tool_.respectToRobot() * (*linkageIt)->respectToFixed_;
             }
+
+            if ((*linkageIt)->framesDirty_)
+                (*linkageIt)->updateJointFrames();
         }
 //    }
 }
 
+void Robot::updateStaleFrames()
+{
+    for (vector<Linkage*>::iterator linkageIt = linkages_.begin();
+         linkageIt != linkages_.end(); ++linkageIt) {
+
+        Linkage* linkage = *linkageIt;
+        linkage->framesMoved_ = false;
+
+        // Only linkages hanging off a tool that moved need a new base frame
+        if (linkage->parentLinkage_ != 0 && linkage->parentLinkage_->framesMoved_) {
+            linkage->respectToRobot_ = linkage->parentLinkage_->tool_.respectToRobot() * linkage->respectToFixed_;
+            linkage->framesMoved_ = true;
+        }
+
+        if (linkage->framesDirty_) {
+            linkage->updateJointFrames();
+            linkage->framesMoved_ = true;
+        }
+    }
+}
+
+void Robot::deferFrameUpdates() { deferUpdates_ = true; }
+
+void Robot::commitFrameUpdates()
+{
+    deferUpdates_ = false;
+    updateStaleFrames();
+}
+
+bool Robot::deferringFrameUpdates() const { return deferUpdates_; }
+
 
 
 
@@ -1,7 +1,11 @@
 
 #include "Robot.h"
+#include "KinematicModel.h"
+#include "IKWorkspace.h"
 #include <eigen3/Eigen/SVD>
 #include <eigen3/Eigen/QR>
+#include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace Eigen;
@@ -41,7 +45,7 @@ void RobotKin::clampMag(TRANSLATION& v, double clamp)
 }
 
 
-void RobotKin::clampMaxAbs(VectorXd& v, double clamp)
+void RobotKin::clampMaxAbs(Ref<VectorXd> v, double clamp)
 {
     int max=0;
     for(int i=0; i<v.size(); i++)
@@ -97,6 +101,27 @@ void RobotKin::wrapToJointLimits(Robot& robot, const vector<size_t>& jointIndice
 
 
 
+void RobotKin::wrapToJointLimits(const KinematicModel& model, const vector<size_t>& jointIndices, VectorXd& jointValues)
+{
+    for(int i=0; i<jointIndices.size(); i++)
+    {
+        size_t k = jointIndices[i];
+        if(model.jointType(k)==RobotKin::REVOLUTE)
+        {
+            if( !(model.min(k) <= jointValues[i] && jointValues[i] <= model.max(k)) )
+            {
+                if( fabs(wrapToPi(jointValues[i]-model.min(k))) <
+                        fabs(wrapToPi(jointValues[i]-model.max(k))) )
+                    jointValues[i] = model.min(k);
+                else
+                    jointValues[i] = model.max(k);
+            }
+        }
+    }
+}
+
+
+
 // Derived from code by Yohann Solaro ( http://listengine.tuxfamily.org/lists.tuxfamily.org/eigen/2010/01/msg00187.html )
 void pinv(const MatrixXd &b, MatrixXd &a_pinv)
 {
@@ -166,32 +191,38 @@ void pinv(const MatrixXd &b, MatrixXd &a_pinv)
 
 TRANSLATION Robot::centerOfMass(FrameType withRespectTo)
 {
-    TRANSLATION com; com.setZero();
-    for(int i=0; i<nLinkages(); i++)
+    if(momentRevision_ != linksRevision_ || momentFrameRevision_ != frameRevision_)
     {
-        com += linkage(i).centerOfMass(withRespectTo)*linkage(i).mass();
-        if(com(0) != com(0)
-                || com(1) != com(1)
-                || com(2) != com(2))
-            cerr << "NaN at linkage " << linkage(i).name() << " (" << linkage(i).id() << ")" << endl;
-    }
+        momentCache_ = rootLink.const_com()*rootLink.mass();
+        for(size_t i=0; i<linkages_.size(); i++)
+        {
+            Linkage& L = *linkages_[i];
+            L.updateMassCache();
+            momentCache_ += L.respectToRobot_.linear()*(L.momentSuffix_[0] + L.toolMoment_)
+                    + L.respectToRobot_.translation()*L.mass();
+            if(momentCache_(0) != momentCache_(0)
+                    || momentCache_(1) != momentCache_(1)
+                    || momentCache_(2) != momentCache_(2))
+                cerr << "NaN at linkage " << L.name() << " (" << L.id() << ")" << endl;
+        }
 
-    if(WORLD == withRespectTo)
-        com += respectToWorld()*rootLink.com()*rootLink.mass();
-    else if(ROBOT == withRespectTo)
-        com += rootLink.com()*rootLink.mass();
-    else
-    {
-        cerr << "Invalid reference frame type for center of mass calculation: "
-             << FrameType_to_string(withRespectTo) << endl;
-        cerr << " -- Must be WORLD or ROBOT" << endl;
+        momentRevision_ = linksRevision_;
+        momentFrameRevision_ = frameRevision_;
     }
 
     double tempMass = mass();
-    if(tempMass>0)
-        return com/tempMass;
-    else
+    if(tempMass <= 0)
         return TRANSLATION::Zero();
+
+    if(WORLD == withRespectTo)
+        return respectToWorld()*(momentCache_/tempMass);
+    else if(ROBOT == withRespectTo)
+        return momentCache_/tempMass;
+
+    cerr << "Invalid reference frame type for center of mass calculation: "
+         << FrameType_to_string(withRespectTo) << endl;
+    cerr << " -- Must be WORLD or ROBOT" << endl;
+    return TRANSLATION::Zero();
 }
 
 TRANSLATION Robot::centerOfMass(const vector<size_t> &indices, FrameType typeOfIndex, FrameType withRespectTo)
@@ -295,28 +326,68 @@ double Robot::mass(const std::vector<std::string> &names, FrameType typeOfIndex)
 
 double Robot::mass()
 {
-    double result = 0;
-    for(int i=0; i<nLinkages(); i++)
-        result += linkage(i).mass();
-    result += rootLink.mass();
+    if(massRevision_ != linksRevision_)
+    {
+        massCache_ = rootLink.mass();
+        for(size_t i=0; i<linkages_.size(); i++)
+            massCache_ += linkages_[i]->mass();
 
-    return result;
+        massRevision_ = linksRevision_;
+    }
+
+    return massCache_;
 }
 
-TRANSLATION Linkage::centerOfMass(FrameType withRespectTo)
+void Linkage::updateMassCache()
 {
-    TRANSLATION com; com.setZero();
-    for(int i=0; i<nJoints(); i++)
-        com += joint(i).centerOfMass(withRespectTo)*joint(i).mass();
+    size_t n = joints_.size();
 
+    if(massSuffix_.size() != n+1 || massRevision_ != linksRevision_)
+    {
+        massSuffix_.resize(n+1);
+        momentSuffix_.resize(n+1);
 
-    com += tool().centerOfMass(withRespectTo)*tool().mass();
+        massSuffix_[n] = 0;
+        for(int i=n-1; i>=0; i--)
+            massSuffix_[i] = massSuffix_[i+1] + joints_[i]->mass();
 
-    double tempMass = mass();
-    if(tempMass>0)
-        return com/tempMass;
-    else
+        massRevision_ = linksRevision_;
+        momentRevision_ = framesRevision_ - 1;
+    }
+
+    if(momentRevision_ != framesRevision_)
+    {
+        momentSuffix_[n].setZero();
+        for(int i=n-1; i>=0; i--)
+            momentSuffix_[i] = momentSuffix_[i+1]
+                    + joints_[i]->respectToLinkage_*joints_[i]->link.const_com()*joints_[i]->mass();
+
+        toolMoment_ = tool_.respectToLinkage_*tool_.massProperties.const_com()*tool_.mass();
+        momentRevision_ = framesRevision_;
+    }
+}
+
+TRANSLATION Linkage::centerOfMassFromMoment(double mass, const TRANSLATION& moment, FrameType withRespectTo)
+{
+    if(mass <= 0)
         return TRANSLATION::Zero();
+
+    if(LINKAGE == withRespectTo)
+        return moment/mass;
+    else if(ROBOT == withRespectTo)
+        return respectToRobot_*(moment/mass);
+    else if(WORLD == withRespectTo)
+        return respectToWorld()*(moment/mass);
+
+    cerr << "Invalid Frame type for center of mass calculation: "
+         << FrameType_to_string(withRespectTo) << endl;
+    return TRANSLATION::Zero();
+}
+
+TRANSLATION Linkage::centerOfMass(FrameType withRespectTo)
+{
+    updateMassCache();
+    return centerOfMassFromMoment(mass(), momentSuffix_[0] + toolMoment_, withRespectTo);
 }
 
 TRANSLATION Linkage::centerOfMass(const std::vector<size_t> &indices, bool includeTool, FrameType withRespectTo)
@@ -339,33 +410,19 @@ TRANSLATION Linkage::centerOfMass(size_t fromJoint, bool downstream, bool includ
 {
     if(fromJoint < nJoints())
     {
+        updateMassCache();
+
+        TRANSLATION moment;
         if(downstream)
         {
-            TRANSLATION com; com.setZero();
-            for(int i=fromJoint; i<nJoints(); i++)
-                com += joint(i).centerOfMass(withRespectTo)*joint(i).mass();
-
+            moment = momentSuffix_[fromJoint];
             if(includeTool)
-                com += tool().centerOfMass(withRespectTo)*tool().mass();
-
-            double tempMass = mass(fromJoint, downstream, includeTool);
-            if(tempMass>0)
-                return com/tempMass;
-            else
-                return TRANSLATION::Zero();
+                moment += toolMoment_;
         }
         else
-        {
-            TRANSLATION com; com.setZero();
-            for(int i=fromJoint-1; i>=0; i--)
-                com += joint(i).centerOfMass(withRespectTo)*joint(i).mass();
+            moment = momentSuffix_[0] - momentSuffix_[fromJoint];
 
-            double tempMass = mass(fromJoint, !downstream, includeTool);
-            if(tempMass>0)
-                return com/tempMass;
-            else
-                return TRANSLATION::Zero();
-        }
+        return centerOfMassFromMoment(mass(fromJoint, downstream, includeTool), moment, withRespectTo);
     }
 
     cerr << "Index (" << fromJoint << ") out of bounds for CoM calculation of " << name() << endl;
@@ -382,24 +439,12 @@ double Linkage::mass(size_t fromJoint, bool downstream, bool includeTool)
 {
     if(fromJoint < nJoints())
     {
-        if(downstream)
-        {
-            double mass = 0;
-            for(int i=fromJoint; i<nJoints(); i++)
-                mass += joint(i).mass();
+        updateMassCache();
 
-            if(includeTool)
-                mass += tool().mass();
-            return mass;
-        }
+        if(downstream)
+            return massSuffix_[fromJoint] + (includeTool ? tool_.mass() : 0);
         else
-        {
-            double mass = 0;
-            for(int i=fromJoint-1; i>=0; i--)
-                mass += joint(i).mass();
-
-            return mass;
-        }
+            return massSuffix_[0] - massSuffix_[fromJoint];
     }
 
     cerr << "Index (" << fromJoint << ") out of bounds for mass calculation of " << name() << endl;
@@ -422,21 +467,12 @@ TRANSLATION Linkage::centerOfMass(size_t fromJoint, size_t toJoint, FrameType wi
         return TRANSLATION::Zero();
     }
 
-    TRANSLATION com; com.setZero();
-
-    if(fromJoint <= toJoint)
-        for(int i=fromJoint; i<toJoint; i++)
-            com += joint(i).centerOfMass(withRespectTo)*joint(i).mass();
-
-    else if(toJoint < fromJoint)
-        for(int i=toJoint; i<fromJoint; i++)
-            com += joint(i).centerOfMass(withRespectTo)*joint(i).mass();
+    updateMassCache();
 
-    double tempMass = mass(fromJoint, toJoint);
-    if(tempMass>0)
-        return com/tempMass;
-    else
-        return TRANSLATION::Zero();
+    size_t first = std::min(fromJoint, toJoint);
+    size_t last = std::max(fromJoint, toJoint);
+    return centerOfMassFromMoment(mass(fromJoint, toJoint),
+                                  momentSuffix_[first] - momentSuffix_[last], withRespectTo);
 }
 
 TRANSLATION Linkage::centerOfMass(string fromJoint, string toJoint, FrameType withRespectTo)
@@ -454,17 +490,11 @@ double Linkage::mass(size_t fromJoint, size_t toJoint)
         return 0;
     }
 
-    double mass = 0;
+    updateMassCache();
 
-    if(fromJoint <= toJoint)
-        for(int i=fromJoint; i<toJoint; i++)
-            mass += joint(i).mass();
-
-    else if(toJoint < fromJoint)
-        for(int i=toJoint; i<fromJoint; i++)
-            mass += joint(i).mass();
-
-    return mass;
+    size_t first = std::min(fromJoint, toJoint);
+    size_t last = std::max(fromJoint, toJoint);
+    return massSuffix_[first] - massSuffix_[last];
 }
 
 double Linkage::mass(string fromJoint, string toJoint)
@@ -487,13 +517,8 @@ TRANSLATION Linkage::centerOfMass(const std::vector<string> &names, bool include
 
 double Linkage::mass()
 {
-    double result = 0;
-    for(int i=0; i<nJoints(); i++)
-        result += joint(i).mass();
-
-    result += tool().mass();
-
-    return result;
+    updateMassCache();
+    return massSuffix_[0] + tool_.mass();
 }
 
 double Linkage::mass(const vector<size_t> &indices, bool includeTool)
@@ -508,92 +533,230 @@ double Linkage::mass(const vector<size_t> &indices, bool includeTool)
     return result;
 }
 
-void gravityTorqueHelper(Robot& robot, size_t startLinkage, size_t nextLinkage, TRANSLATION& com, double& mass)
+double Joint::gravityTorque(bool downstream)
 {
-    double newMass = robot.linkage(nextLinkage).mass();
-    com  += robot.linkage(nextLinkage).centerOfMass()*newMass;
-    mass += newMass;
-
-    for(int i=0; i<robot.linkage(nextLinkage).nChildren(); i++)
-        if(robot.linkage(nextLinkage).childLinkage(i).id() != startLinkage)
-            gravityTorqueHelper(robot, nextLinkage,
-                                robot.linkage(nextLinkage).childLinkage(i).id(),
-                                com, mass);
+    // The robot's subtree sums keep this in step with gravityJointTorques()
+    if(hasRobot)
+        return robot_->gravityJointTorque(id(), downstream);
+
+    // Without a robot only this joint's own linkage can hang off of it
+    double m_mass = 0;
+    TRANSLATION com = TRANSLATION::Zero();
+    if(hasLinkage)
+    {
+        m_mass = linkage_->mass(localID(), downstream, true);
+        com = linkage_->centerOfMass(localID(), downstream, true)*m_mass;
+    }
+    else if(downstream)
+    {
+        m_mass = mass();
+        com = centerOfMass()*m_mass;
+    }
 
-    if(robot.linkage(nextLinkage).parentLinkage().id() != startLinkage)
-        gravityTorqueHelper(robot, nextLinkage,
-                            robot.linkage(nextLinkage).parentLinkage().id(),
-                            com, mass);
+    return gravityTorque(m_mass, com, downstream);
 }
 
-double Joint::gravityTorque(bool downstream)
+double Joint::gravityTorque(double mass, const TRANSLATION& moment, bool downstream) const
 {
-    TRANSLATION com; com.setZero();
-    double m_mass=0;
+    if(mass <= 0)
+        return 0;
 
-    m_mass += linkage().mass(localID(), downstream, true);
-    com  += linkage().centerOfMass(localID(), downstream, true)*m_mass;
-
-    if(downstream)
-        for(int i=0; i<linkage().nChildren(); i++)
-            gravityTorqueHelper(robot(), linkage().id(), linkage().childLinkage(i).id(), com, m_mass);
+    TRANSLATION lever = moment/mass - respectToRobot().translation();
+    TRANSLATION Fz = TRANSLATION::UnitZ()*gravity_constant*mass;
+    AXIS axis = respectToRobot().rotation()*jointAxis_;
 
+    double sign = downstream ? 1 : -1;
+    if(jointType_ == REVOLUTE)
+        return sign*lever.cross(Fz).dot(axis);
+    else if(jointType_ == PRISMATIC)
+        return sign*Fz.dot(axis);
     else
-        if(linkage().hasParent)
-            gravityTorqueHelper(robot(), linkage().id(), linkage().parentLinkage().id(), com, m_mass);
+        return 0;
+}
 
 
-    if(m_mass>0)
-        com = com/m_mass;
-    else
-        return 0; // TODO: Put assertive warning
 
+void Robot::gravityJointTorques(const vector<size_t> &jointIndices, Eigen::VectorXd &torques, bool downstream)
+{
+    gravityJointTorques(gravityTorques_, downstream);
+
+    torques.resize(jointIndices.size());
+    for(size_t i=0; i<jointIndices.size(); i++)
+        torques[i] = gravityTorques_[jointIndices[i]];
+}
+
+void Robot::updateSubtreeMasses()
+{
+    size_t nJ = joints_.size();
+    size_t nL = linkages_.size();
 
-    TRANSLATION lever = com - respectToRobot().translation();
-    TRANSLATION Fz;
-    Fz = TRANSLATION::UnitZ()*gravity_constant*m_mass;
+    if(subtreeRevision_ == linksRevision_ && subtreeFrameRevision_ == frameRevision_
+            && subtreeJointMass_.size() == nJ && subtreeLinkageMass_.size() == nL)
+        return;
 
+    subtreeJointMass_.resize(nJ);
+    subtreeJointMoment_.resize(nJ);
+    subtreeLinkageMass_.resize(nL);
+    subtreeLinkageMoment_.resize(nL);
 
-    if(downstream)
+    // Linkages are stored parents first, so walking them backwards finishes
+    // every child subtree before its parent needs it
+    for(int l=nL-1; l>=0; l--)
     {
-        if(jointType_ == REVOLUTE)
-            return lever.cross(Fz).dot(respectToRobot().rotation()*jointAxis_);
-        else if(jointType_ == PRISMATIC)
-            return Fz.dot(respectToRobot().rotation()*jointAxis_);
-        else
-            return 0;
+        Linkage& L = *linkages_[l];
+
+        double mass = L.tool_.mass();
+        TRANSLATION moment = L.tool_.centerOfMass(ROBOT)*mass;
+
+        for(size_t c=0; c<L.childLinkages_.size(); c++)
+        {
+            size_t child = L.childLinkages_[c]->id();
+            mass += subtreeLinkageMass_[child];
+            moment += subtreeLinkageMoment_[child];
+        }
+
+        for(int j=L.joints_.size()-1; j>=0; j--)
+        {
+            Joint& joint = *L.joints_[j];
+            mass += joint.mass();
+            moment += joint.centerOfMass(ROBOT)*joint.mass();
+
+            subtreeJointMass_[joint.id()] = mass;
+            subtreeJointMoment_[joint.id()] = moment;
+        }
+
+        subtreeLinkageMass_[l] = mass;
+        subtreeLinkageMoment_[l] = moment;
     }
-    else
+
+    subtreeRevision_ = linksRevision_;
+    subtreeFrameRevision_ = frameRevision_;
+}
+
+void Robot::gravityJointTorques(Eigen::VectorXd &torques, bool downstream)
+{
+    size_t nJ = joints_.size();
+    size_t nL = linkages_.size();
+
+    updateSubtreeMasses();
+    torques.resize(nJ);
+
+    const vector<double>* jointMass = &subtreeJointMass_;
+    const vector<TRANSLATION>* jointMoment = &subtreeJointMoment_;
+
+    // Upstream of a joint is the rest of its tree
+    if(!downstream)
     {
-        if(jointType_ == REVOLUTE)
-            return -lever.cross(Fz).dot(respectToRobot().rotation()*jointAxis_);
-        else if(jointType_ == PRISMATIC)
-            return -Fz.dot(respectToRobot().rotation()*jointAxis_);
-        else
-            return 0;
+        gravityJointMass_.resize(nJ);
+        gravityJointMoment_.resize(nJ);
+        gravityLinkageRoot_.resize(nL);
+
+        for(size_t l=0; l<nL; l++)
+            gravityLinkageRoot_[l] = linkages_[l]->hasParent ?
+                        gravityLinkageRoot_[linkages_[l]->parentLinkage_->id()] : l;
+
+        for(size_t k=0; k<nJ; k++)
+        {
+            size_t root = gravityLinkageRoot_[joints_[k]->linkage_->id()];
+            gravityJointMass_[k] = subtreeLinkageMass_[root] - subtreeJointMass_[k];
+            gravityJointMoment_[k] = subtreeLinkageMoment_[root] - subtreeJointMoment_[k];
+        }
+
+        jointMass = &gravityJointMass_;
+        jointMoment = &gravityJointMoment_;
     }
+
+    for(size_t k=0; k<nJ; k++)
+        torques[k] = joints_[k]->gravityTorque((*jointMass)[k], (*jointMoment)[k], downstream);
 }
 
+double Robot::gravityJointTorque(size_t jointIndex, bool downstream)
+{
+    updateSubtreeMasses();
 
+    Joint& joint = *joints_[jointIndex];
+    if(downstream)
+        return joint.gravityTorque(subtreeJointMass_[jointIndex], subtreeJointMoment_[jointIndex], true);
 
-void Robot::gravityJointTorques(const vector<size_t> &jointIndices, Eigen::VectorXd &torques, bool downstream)
-{
-    // TODO: Perhaps make this more efficient by using something besides gravityTorque()
-    // If CoM and mass results were recycled, it could perhaps be made more efficient
-    // but it would require dynamic allocation
+    // Upstream of a joint is the rest of its tree
+    const Linkage* root = joint.linkage_;
+    while(root->hasParent)
+        root = root->parentLinkage_;
 
-    torques.resize(jointIndices.size());
-    for(int i=0; i<jointIndices.size(); i++)
-        torques[i] = joint(jointIndices[i]).gravityTorque(downstream);
+    return joint.gravityTorque(subtreeLinkageMass_[root->id()] - subtreeJointMass_[jointIndex],
+                               subtreeLinkageMoment_[root->id()] - subtreeJointMoment_[jointIndex], false);
 }
 
 void Linkage::gravityJointTorques(Eigen::VectorXd &torques, bool downstream)
 {
-    // TODO: Same todo as Robot::gravityJointTorques
-
     torques.resize(nJoints());
-    for(int i=0; i<nJoints(); i++)
-        torques[i] = joint(i).gravityTorque(downstream);
+
+    if(!hasRobot)
+    {
+        for(int i=0; i<nJoints(); i++)
+            torques[i] = joint(i).gravityTorque(downstream);
+        return;
+    }
+
+    robot_->gravityJointTorques(robot_->gravityTorques_, downstream);
+    for(size_t i=0; i<joints_.size(); i++)
+        torques[i] = robot_->gravityTorques_[joints_[i]->id()];
+}
+
+void Robot::centerOfMassJacobian(Eigen::Matrix3Xd &J, FrameType withRespectTo)
+{
+    comJacobianIndices_.resize(joints_.size());
+    for(size_t k=0; k<joints_.size(); k++)
+        comJacobianIndices_[k] = k;
+
+    centerOfMassJacobian(comJacobianIndices_, J, withRespectTo);
+}
+
+void Robot::centerOfMassJacobian(const vector<size_t> &jointIndices, Eigen::Matrix3Xd &J, FrameType withRespectTo)
+{
+    J.resize(3, jointIndices.size());
+
+    Matrix3d rotation = Matrix3d::Identity();
+    if(WORLD == withRespectTo)
+        rotation = respectToWorld().rotation();
+    else if(ROBOT != withRespectTo)
+        cerr << "Invalid reference frame type for center of mass Jacobian: "
+             << FrameType_to_string(withRespectTo) << endl
+             << " -- Must be WORLD or ROBOT" << endl;
+
+    updateSubtreeMasses();
+
+    double total = rootLink.mass();
+    for(size_t l=0; l<linkages_.size(); l++)
+        if(!linkages_[l]->hasParent)
+            total += subtreeLinkageMass_[l];
+
+    if(total <= 0)
+    {
+        J.setZero();
+        return;
+    }
+
+    // Moving a joint carries the mass downstream of it, which is that share
+    // of the whole robot's mass moving with its center of mass
+    for(size_t i=0; i<jointIndices.size(); i++)
+    {
+        size_t k = jointIndices[i];
+        Joint& joint = *joints_[k];
+        double mass = subtreeJointMass_[k];
+
+        TRANSFORM frame = joint.respectToRobot();
+        AXIS axis = frame.rotation()*joint.jointAxis_;
+
+        if(mass <= 0)
+            J.col(i).setZero();
+        else if(joint.jointType_ == REVOLUTE)
+            J.col(i) = rotation*axis.cross(subtreeJointMoment_[k]/mass - frame.translation())*mass/total;
+        else if(joint.jointType_ == PRISMATIC)
+            J.col(i) = rotation*axis*mass/total;
+        else
+            J.col(i).setZero();
+    }
 }
 
 
@@ -973,248 +1136,388 @@ rk_result_t Robot::jacobianTransposeIK_linkage(const string linkageName, VectorX
 rk_result_t Robot::dampedLeastSquaresIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
                                               const TRANSFORM &target, Constraints& constraints )
 {
-    bool verbose = false;
-    bool storedImposeLimits = imposeLimits;
+    IKWorkspace workspace(jointIndices.size());
+    return dampedLeastSquaresIK_chain(jointIndices, jointValues, target, constraints, workspace);
+}
 
-    vector<Joint*> pJoints;
-    pJoints.resize(jointIndices.size());
-    // FIXME: Add in safety checks
-    for(int i=0; i<pJoints.size(); i++)
-        pJoints[i] = joints_[jointIndices[i]];
+rk_result_t Robot::dampedLeastSquaresIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                              const TRANSFORM &target, Constraints& constraints,
+                                              IKWorkspace& workspace)
+{
+    // Chains with a precompiled length get fully fixed-size linear algebra
+    switch(jointIndices.size())
+    {
+        case 6:
+            return dampedLeastSquaresIK_chain<6>(jointIndices, jointValues, target, constraints, workspace);
+        case 7:
+            return dampedLeastSquaresIK_chain<7>(jointIndices, jointValues, target, constraints, workspace);
+        default:
+            return dampedLeastSquaresIK_chain<Dynamic>(jointIndices, jointValues, target, constraints, workspace);
+    }
+}
 
-    // ~~ Declarations ~~
-    MatrixXd J;
-    MatrixXd Jinv;
-    TRANSFORM pose;
-    AngleAxisd aagoal(target.rotation());
-    AngleAxisd aastate;
-    AngleAxisd aaerr;
-    TRANSLATION Terr;
-    TRANSLATION Rerr;
-    SCREW err;
-    VectorXd nullErr(jointValues.size());
-    VectorXd delta(jointValues.size());
-    VectorXd stored(jointValues.size());
-    VectorXd f(jointValues.size());
-    double rotAngle=0;
+// Storage for the chain sized parts of the solver. Fixed chain lengths keep
+// it on the stack; dynamic ones borrow it from the workspace.
+template<int N>
+struct DampedLeastSquaresStorage
+{
+    Matrix<double, 6, N> J;
+    Matrix<double, N, 6> Jinv;
+    Matrix<double, N, 1> delta;
+    Matrix<double, N, 1> deltaNull;
 
-    VectorXd deltaNull(jointValues.size());
+    DampedLeastSquaresStorage(IKWorkspace&) { }
+};
 
+template<>
+struct DampedLeastSquaresStorage<Dynamic>
+{
+    Matrix6Xd& J;
+    Matrix<double, Dynamic, 6>& Jinv;
+    VectorXd& delta;
+    VectorXd& deltaNull;
+
+    DampedLeastSquaresStorage(IKWorkspace& workspace)
+        : J(workspace.J), Jinv(workspace.Jinv),
+          delta(workspace.delta), deltaNull(workspace.deltaNull) { }
+};
+
+// A chain of Robot joints for dampedLeastSquaresAttempt()
+class RobotChain
+{
+public:
+    RobotChain(Robot& robot, Constraints& constraints, const vector<Joint*>& joints)
+        : robot_(robot), constraints_(constraints), joints_(joints) { }
 
-    stored = jointValues;
+    bool imposeLimits() const { return robot_.imposeLimits; }
+    void imposeLimits(bool impose) { robot_.imposeLimits = impose; }
 
-    double tolerance = constraints.convergenceTolerance;
-    int maxIterations = constraints.maxIterations; // TODO: Put this in the constructor so the user can set it arbitrarily
-    double damp = constraints.dampingConstant;
+    // The Robot seed turns wrapping off itself when it lifts the limits
+    bool wrapsToJointLimits() const { return constraints_.wrapToJointLimits; }
 
+    void seed(size_t attempt, const vector<size_t>& jointIndices, VectorXd& jointValues)
+    { constraints_.iterativeJacobianSeed(robot_, attempt, jointIndices, jointValues); }
 
-    size_t maxAttempts = 1;
-    if(constraints.useIterativeJacobianSeed)
-        maxAttempts = constraints.maxAttempts;
+    void errorClamp(const vector<size_t>& jointIndices, SCREW& err)
+    { constraints_.errorClamp(robot_, jointIndices, err); }
 
-    for(size_t attempt=0; attempt<maxAttempts; attempt++)
-    {
-        if(constraints.useIterativeJacobianSeed)
-            constraints.iterativeJacobianSeed(*this, attempt, jointIndices, jointValues);
+    void nullSpaceTask(const vector<size_t>& jointIndices, const VectorXd& jointValues,
+                       VectorXd& nullErr, const IKWorkspace& workspace)
+    { constraints_.nullSpaceTask(robot_, jointIndices, jointValues, nullErr, workspace); }
 
-        values(jointIndices, jointValues);
+    void wrap(const vector<size_t>& jointIndices, VectorXd& jointValues)
+    { wrapToJointLimits(robot_, jointIndices, jointValues); }
 
-        pose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
-//        pose = constraints.finalTransform*joint(jointIndices.back()).respectToRobot();
-        aastate = pose.rotation();
+    void values(const vector<size_t>& jointIndices, const VectorXd& jointValues)
+    { robot_.values(jointIndices, jointValues); }
 
-//        aaerr = pose.rotation().transpose()*target.rotation(); // FAILED
-//        aaerr = target.rotation().transpose()*pose.rotation(); // FAILED
-//        aaerr = pose.rotation()*target.rotation().transpose(); // FAILED
-        aaerr = target.rotation()*pose.rotation().transpose();
-        if(fabs(aaerr.angle()) <= M_PI)
-            Rerr = aaerr.angle()*aaerr.axis();
-        else
-            Rerr = (aaerr.angle()-2*M_PI)*aaerr.axis();
+    double value(size_t i) const { return joints_[i]->value(); }
+    TRANSFORM tip() const { return joints_.back()->respectToRobot(); }
 
-        Terr = target.translation()-pose.translation();
+    template<int N>
+    void jacobian(Matrix<double, 6, N>& J, const TRANSLATION& location) const
+    { robot_.jacobian<N>(J, joints_, location); }
 
-    //    Rerr.setZero();
-        err << Terr, Rerr;//*constraints.rotationScale;
+private:
+    Robot& robot_;
+    Constraints& constraints_;
+    const vector<Joint*>& joints_;
+};
 
-        size_t iterations = 0;
-        do {
+// The same chain inside a KinematicState. Nothing here changes the model
+// or the constraints, so several of these can share them.
+class ModelChain
+{
+public:
+    ModelChain(const KinematicModel& model, KinematicState& state,
+               const Constraints& constraints, const vector<size_t>& jointIndices)
+        : model_(model), state_(state), constraints_(constraints), jointIndices_(jointIndices) { }
 
-            if(constraints.performErrorClamp)
-            {
-                clampMag(Terr, constraints.translationClamp);
-                clampMag(Rerr, constraints.rotationClamp);
-            }
-            err << Terr, Rerr;//*constraints.rotationScale;
+    bool imposeLimits() const { return state_.imposeLimits; }
+    void imposeLimits(bool impose) { state_.imposeLimits = impose; }
 
-            if(constraints.customErrorClamp)
-                constraints.errorClamp(*this, jointIndices, err);
+    // Once a seed lifts the joint limits there is nothing left to wrap to
+    bool wrapsToJointLimits() const { return constraints_.wrapToJointLimits && state_.imposeLimits; }
 
-            if(verbose)
-            {
-                cout << "Clamped Error: " << err.transpose() << endl;
+    void seed(size_t attempt, const vector<size_t>& jointIndices, VectorXd& jointValues)
+    { constraints_.iterativeJacobianSeed(model_, state_, attempt, jointIndices, jointValues); }
 
-                cout << "-----------------------------------" << endl;
-            }
+    void errorClamp(const vector<size_t>& jointIndices, SCREW& err)
+    { constraints_.errorClamp(model_, state_, jointIndices, err); }
 
-//            jacobian(J, pJoints, pJoints.back()->respectToRobot().translation()+constraints.finalTransform.translation(), this);
-            jacobian(J, pJoints, pose.translation(), this);
+    void nullSpaceTask(const vector<size_t>& jointIndices, const VectorXd& jointValues,
+                       VectorXd& nullErr, const IKWorkspace&)
+    { constraints_.nullSpaceTask(model_, state_, jointIndices, jointValues, nullErr); }
 
-            /////////////////////////////////////////////////////////////////////////
-            /////////////////////////  STANDARD APPROACH  ///////////////////////////
-            /////////////////////////////////////////////////////////////////////////
+    void wrap(const vector<size_t>& jointIndices, VectorXd& jointValues)
+    { wrapToJointLimits(model_, jointIndices, jointValues); }
 
-//            f = (J*J.transpose() + damp*damp*Matrix6d::Identity()).colPivHouseholderQr().solve(err);
-//            delta = J.transpose()*f;
+    void values(const vector<size_t>& jointIndices, const VectorXd& jointValues)
+    { model_.values(state_, jointIndices, jointValues); }
 
-            /////////////////////////////////////////////////////////////////////////
-            /////////////////////////////////////////////////////////////////////////
+    double value(size_t i) const { return state_.value(jointIndices_[i]); }
+    const TRANSFORM& tip() const { return state_.jointRespectToRobot(jointIndices_.back()); }
 
+    template<int N>
+    void jacobian(Matrix<double, 6, N>& J, const TRANSLATION& location) const
+    { model_.chainJacobian(J, state_, jointIndices_, location); }
 
+private:
+    const KinematicModel& model_;
+    KinematicState& state_;
+    const Constraints& constraints_;
+    const vector<size_t>& jointIndices_;
+};
 
+static void poseError(const TRANSFORM& pose, const TRANSFORM& target,
+                      TRANSLATION& Terr, TRANSLATION& Rerr)
+{
+    AngleAxisd aaerr(target.rotation()*pose.rotation().transpose());
+    if(fabs(aaerr.angle()) <= M_PI)
+        Rerr = aaerr.angle()*aaerr.axis();
+    else
+        Rerr = (aaerr.angle()-2*M_PI)*aaerr.axis();
 
-            ///////////////////////////////////////////////////////////////////
-            ///////////////////////  NULL SPACE APPROACH //////////////////////
-            ///////////////////////////////////////////////////////////////////
+    Terr = target.translation()-pose.translation();
+}
 
-            Jinv = J.transpose()*(J*J.transpose() + damp*damp*Matrix6d::Identity()).inverse();
+// One seed attempt of the damped least squares solver, shared by Robot and
+// KinematicModel. The workspace must already be sized for the chain. error
+// receives the norm of the remaining pose error. Stops early once cancel
+// is set.
+template<int N, class Chain>
+static rk_result_t dampedLeastSquaresAttempt(Chain& chain, const vector<size_t>& jointIndices,
+                                             VectorXd& jointValues, const TRANSFORM& target,
+                                             const Constraints& constraints, IKWorkspace& workspace,
+                                             size_t attempt, double& error,
+                                             const std::atomic<bool>* cancel)
+{
+    bool storedImposeLimits = chain.imposeLimits();
 
-            delta = Jinv*err;
+    // ~~ Declarations ~~
+    DampedLeastSquaresStorage<N> storage(workspace);
+    Matrix<double, 6, N>& J = storage.J;
+    Matrix<double, N, 6>& Jinv = storage.Jinv;
+    Matrix<double, N, 1>& delta = storage.delta;
+    Matrix<double, N, 1>& deltaNull = storage.deltaNull;
+    VectorXd& nullErr = workspace.nullErr;
+    SCREW& err = workspace.err;
+    TRANSFORM pose;
+    TRANSLATION Terr;
+    TRANSLATION Rerr;
 
-            if(constraints.performDeltaClamp)
-                clampMaxAbs(delta, constraints.deltaClamp);
+    double tolerance = constraints.convergenceTolerance;
+    int maxIterations = constraints.maxIterations;
+    double damp = constraints.dampingConstant;
 
+    if(constraints.useIterativeJacobianSeed)
+        chain.seed(attempt, jointIndices, jointValues);
 
-            if(constraints.performNullSpaceTask)
-                constraints.nullSpaceTask(*this, jointIndices, jointValues, nullErr);
-            else
-                nullErr.setZero();
+    bool wrap = chain.wrapsToJointLimits();
 
-            // Try pure nullspace first
-            deltaNull = (Matrix6d::Identity() - J.transpose()*(J*J.transpose()).inverse()*J)*nullErr;
+    chain.values(jointIndices, jointValues);
 
-            // The damped nullspace is much better for avoiding NaNs
-            for(int n=0; n<deltaNull.size(); n++)
-            {
-                if(deltaNull[n] != deltaNull[n])
-                {
-                    deltaNull = (Matrix6d::Identity() - Jinv*J)*nullErr;
-                    cout << "NaN in the Nullspace!!" << endl;
-                    break;
-                }
-            }
+    pose = chain.tip()*constraints.finalTransform;
+    poseError(pose, target, Terr, Rerr);
 
-            delta += deltaNull;
+    int iterations = 0;
+    do {
 
-            ///////////////////////////////////////////////////////////////////
+        if(cancel != NULL && cancel->load(std::memory_order_relaxed))
+            break;
 
+        if(constraints.performErrorClamp)
+        {
+            clampMag(Terr, constraints.translationClamp);
+            clampMag(Rerr, constraints.rotationClamp);
+        }
+        err << Terr, Rerr;
 
-            jointValues += delta;
+        if(constraints.customErrorClamp)
+            chain.errorClamp(jointIndices, err);
 
-            if(constraints.wrapToJointLimits)
-                wrapToJointLimits(*this, jointIndices, jointValues);
+        chain.template jacobian<N>(J, pose.translation());
 
+        ///////////////////////////////////////////////////////////////////
+        ///////////////////////  NULL SPACE APPROACH //////////////////////
+        ///////////////////////////////////////////////////////////////////
 
-            values(jointIndices, jointValues);
+        // All products go into preallocated storage, and the 6x6
+        // inverses are fixed-size, so nothing here touches the heap.
+        // For a fixed N Eigen unrolls all of it.
+        workspace.JJt.noalias() = J*J.transpose();
+        workspace.dampedInverse = (workspace.JJt + damp*damp*Matrix6d::Identity()).inverse();
+        Jinv.noalias() = J.transpose()*workspace.dampedInverse;
 
-            // Catch any joint limits
-            for(int k=0; k<jointIndices.size(); k++)
-                jointValues(k) = joint(jointIndices[k]).value();
+        delta.noalias() = Jinv*err;
+
+        if(constraints.performDeltaClamp)
+            clampMaxAbs(delta, constraints.deltaClamp);
+
+
+        if(constraints.performNullSpaceTask)
+        {
+            chain.nullSpaceTask(jointIndices, jointValues, nullErr, workspace);
 
-            pose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
-//            pose = constraints.finalTransform*joint(jointIndices.back()).respectToRobot();
+            // Project onto the null space of J: nullErr - J^T (J J^T)^-1 J nullErr
+            workspace.Jnull.noalias() = J*nullErr;
 
-            if(verbose)
+            // Try pure nullspace first. With fewer than 6 joints J J^T is
+            // always singular, so go straight to the damped version.
+            bool pureNullSpace = jointIndices.size() >= 6;
+            if(pureNullSpace)
             {
-                cout << "req delta: " << delta.transpose() << endl;
-                cout << "act delta: " << (jointValues-stored).transpose() << endl;
-                cout << "angles: " << jointValues.transpose() << endl;
-                cout << "Limits: ";
-                for(int k=0; k<jointIndices.size(); k++)
-                    cout << "(" << joint(jointIndices[k]).min() << ", "
-                         << joint(jointIndices[k]).max() << ")\t";
-                cout << endl;
-                cout << pose.matrix() << endl;
-                cout << "Rotation needed: " << endl;
-                cout << (pose.rotation().transpose()*target.rotation()).matrix() << endl;
+                workspace.JJtInverse = workspace.JJt.inverse();
+                workspace.f.noalias() = workspace.JJtInverse*workspace.Jnull;
+                deltaNull = nullErr;
+                deltaNull.noalias() -= J.transpose()*workspace.f;
+                pureNullSpace = deltaNull.allFinite();
             }
-            
-            
-            Terr = target.translation()-pose.translation();
 
-//            aaerr = pose.rotation().transpose()*target.rotation(); // FAILED
-//            aaerr = target.rotation().transpose()*pose.rotation(); // FAILED
-//            aaerr = pose.rotation()*target.rotation().transpose();
-            aaerr = target.rotation()*pose.rotation().transpose();
+            // The damped nullspace is much better for avoiding NaNs
+            if(!pureNullSpace)
+            {
+                deltaNull = nullErr;
+                deltaNull.noalias() -= Jinv*workspace.Jnull;
+            }
 
-//            cout << "Angle-Axis: (" << aaerr.angle()/M_PI*180 << ")\t" << aaerr.axis().transpose() << endl;
+            delta += deltaNull;
+        }
 
-            if(aaerr.angle() > 2*M_PI || aaerr.angle() < 0)
-                cout << "BROKEN ANGLE AXIS: " << aaerr.angle() << endl
-                     << " -- Please contact mxgrey@gatech.edu and report this." << endl;
-                
-            if(fabs(aaerr.angle()) <= M_PI)
-                Rerr = aaerr.angle()*aaerr.axis();
-            else
-                Rerr = (aaerr.angle()-2*M_PI)*aaerr.axis();
+        ///////////////////////////////////////////////////////////////////
 
-//            rotAngle = wrapToPi(aaerr.angle()); // This failed badly
-//            Rerr = rotAngle*aaerr.axis();
 
-            err << Terr, Rerr;
+        jointValues += delta;
 
-            if(verbose)
-            {
-                cout << "Error: " << err.transpose() << endl;
-            }
+        if(wrap)
+            chain.wrap(jointIndices, jointValues);
 
-            iterations++;
+        chain.values(jointIndices, jointValues);
 
+        // Catch any joint limits
+        for(size_t k=0; k<jointIndices.size(); k++)
+            jointValues(k) = chain.value(k);
 
-//        } while(err.norm() > tolerance && iterations < maxIterations);
-        } while( (Terr.norm() > tolerance || Rerr.norm() > tolerance) && iterations < maxIterations);
+        pose = chain.tip()*constraints.finalTransform;
+        poseError(pose, target, Terr, Rerr);
 
-        if(verbose)
-        {
-            cout << "Iterations: -- " << iterations << endl;
-        }
+        iterations++;
 
+    } while( (Terr.norm() > tolerance || Rerr.norm() > tolerance) && iterations < maxIterations);
 
-        if(constraints.wrapSolutionToJointLimits)
-            wrapToJointLimits(*this, jointIndices, jointValues);
 
-        imposeLimits = storedImposeLimits;
-        values(jointIndices, jointValues);
+    if(constraints.wrapSolutionToJointLimits)
+        chain.wrap(jointIndices, jointValues);
 
+    chain.imposeLimits(storedImposeLimits);
+    chain.values(jointIndices, jointValues);
 
-        pose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
-//        pose = constraints.finalTransform*joint(jointIndices.back()).respectToRobot();
-        
-        
-//        aaerr = pose.rotation().transpose()*target.rotation(); // FAILED
-//        aaerr = target.rotation().transpose()*pose.rotation(); // FAILED
-//        aaerr = pose.rotation()*target.rotation().transpose(); // FAILED
-        aaerr = target.rotation()*pose.rotation().transpose();
-        if(fabs(aaerr.angle()) <= M_PI)
-            Rerr = aaerr.angle()*aaerr.axis();
-        else
-            Rerr = (aaerr.angle()-2*M_PI)*aaerr.axis();
-        
-        Terr = target.translation()-pose.translation();
-//            Rerr = -aaerr.angle()*aaerr.axis();
+    pose = chain.tip()*constraints.finalTransform;
+    poseError(pose, target, Terr, Rerr);
 
-        err << Terr, Rerr;
+    error = sqrt(Terr.squaredNorm() + Rerr.squaredNorm());
 
+    if(Terr.norm() <= tolerance && Rerr.norm() <= tolerance)
+        return RK_SOLVED;
 
-        if(Terr.norm() <= tolerance && Rerr.norm() <= tolerance)
+    return RK_DIVERGED;
+}
+
+template<int N>
+rk_result_t Robot::dampedLeastSquaresIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                              const TRANSFORM &target, Constraints& constraints,
+                                              IKWorkspace& workspace)
+{
+    if(N != Dynamic && jointIndices.size() != (size_t)N)
+    {
+        cerr << "ERROR! Chain has " << jointIndices.size() << " joints but the solver was "
+             << "compiled for " << N << "!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // Only allocates if the workspace was sized for a different chain
+    if(workspace.size() != jointIndices.size())
+        workspace.resize(jointIndices.size());
+
+    vector<Joint*>& pJoints = workspace.joints;
+    // FIXME: Add in safety checks
+    for(size_t i=0; i<pJoints.size(); i++)
+        pJoints[i] = joints_[jointIndices[i]];
+
+    RobotChain chain(*this, constraints, pJoints);
+
+    size_t maxAttempts = 1;
+    if(constraints.useIterativeJacobianSeed)
+        maxAttempts = constraints.maxAttempts;
+
+    double error;
+    for(size_t attempt=0; attempt<maxAttempts; attempt++)
+    {
+        if(dampedLeastSquaresAttempt<N>(chain, jointIndices, jointValues, target, constraints,
+                                        workspace, attempt, error, NULL) == RK_SOLVED)
             return RK_SOLVED;
     }
 
+    return RK_DIVERGED;
+}
 
+template rk_result_t Robot::dampedLeastSquaresIK_chain<6>(const vector<size_t>&, VectorXd&,
+                                                           const TRANSFORM&, Constraints&, IKWorkspace&);
+template rk_result_t Robot::dampedLeastSquaresIK_chain<7>(const vector<size_t>&, VectorXd&,
+                                                           const TRANSFORM&, Constraints&, IKWorkspace&);
+template rk_result_t Robot::dampedLeastSquaresIK_chain<Dynamic>(const vector<size_t>&, VectorXd&,
+                                                                 const TRANSFORM&, Constraints&, IKWorkspace&);
 
+rk_result_t KinematicModel::dampedLeastSquaresIK_chain(KinematicState& state, const vector<size_t>& jointIndices,
+                                                       VectorXd& jointValues, const TRANSFORM& target,
+                                                       const Constraints& constraints) const
+{
+    IKWorkspace workspace(jointIndices.size());
+    return dampedLeastSquaresIK_chain(state, jointIndices, jointValues, target, constraints, workspace);
+}
+
+rk_result_t KinematicModel::dampedLeastSquaresIK_chain(KinematicState& state, const vector<size_t>& jointIndices,
+                                                       VectorXd& jointValues, const TRANSFORM& target,
+                                                       const Constraints& constraints, IKWorkspace& workspace) const
+{
+    size_t maxAttempts = 1;
+    if(constraints.useIterativeJacobianSeed)
+        maxAttempts = constraints.maxAttempts;
+
+    double error;
+    for(size_t attempt=0; attempt<maxAttempts; attempt++)
+    {
+        if(dampedLeastSquaresIK_attempt(state, jointIndices, jointValues, target,
+                                        constraints, workspace, attempt, error) == RK_SOLVED)
+            return RK_SOLVED;
+    }
 
     return RK_DIVERGED;
+}
 
+rk_result_t KinematicModel::dampedLeastSquaresIK_attempt(KinematicState& state, const vector<size_t>& jointIndices,
+                                                         VectorXd& jointValues, const TRANSFORM& target,
+                                                         const Constraints& constraints, IKWorkspace& workspace,
+                                                         size_t attempt, double& error,
+                                                         const std::atomic<bool>* cancel) const
+{
+    if(workspace.size() != jointIndices.size())
+        workspace.resize(jointIndices.size());
+
+    ModelChain chain(*this, state, constraints, jointIndices);
+
+    switch(jointIndices.size())
+    {
+        case 6:
+            return dampedLeastSquaresAttempt<6>(chain, jointIndices, jointValues, target, constraints,
+                                                workspace, attempt, error, cancel);
+        case 7:
+            return dampedLeastSquaresAttempt<7>(chain, jointIndices, jointValues, target, constraints,
+                                                workspace, attempt, error, cancel);
+        default:
+            return dampedLeastSquaresAttempt<Dynamic>(chain, jointIndices, jointValues, target, constraints,
+                                                      workspace, attempt, error, cancel);
+    }
 }
 
 rk_result_t Robot::dampedLeastSquaresIK_chain(const vector<string> &jointNames, VectorXd &jointValues,
@@ -1242,10 +1545,449 @@ rk_result_t Robot::dampedLeastSquaresIK_linkage(const string linkageName, Vector
 
     constraints.finalTransform = linkage(linkageName).tool().respectToFixed();
 
+    if(constraints.useAnalyticalIK && linkage(linkageName).hasAnalyticalIK()
+       && analyticalIK_linkage(linkageName, jointValues, target, TRANSFORM::Identity(),
+                               constraints.convergenceTolerance) == RK_SOLVED)
+        return RK_SOLVED;
+
     return dampedLeastSquaresIK_chain(jointIndices, jointValues, target, constraints);
 }
 
 
+rk_result_t Robot::dampedLeastSquaresIK_trajectory(const vector<size_t> &jointIndices, const TRANSFORM_VECTOR& targets,
+                                                   MatrixXd& trajectory, vector<rk_result_t>& results,
+                                                   vector<size_t>& jumps, Constraints& constraints, double maxJump)
+{
+    size_t n = jointIndices.size();
+    trajectory.resize(n, targets.size());
+    results.resize(targets.size());
+    jumps.clear();
+
+    if(n == 0)
+    {
+        cerr << "ERROR! Cannot solve a trajectory for an empty chain!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // One workspace for the whole path, so the waypoints do not allocate
+    IKWorkspace workspace(n);
+    VectorXd jointValues(n), solved(n), previous(n);
+    for(size_t k=0; k<n; k++)
+        jointValues(k) = joint(jointIndices[k]).value();
+    solved = jointValues;
+    previous = jointValues;
+
+    bool wrapToJointLimits = constraints.wrapToJointLimits;
+    rk_result_t result = RK_SOLVED;
+
+    for(size_t w=0; w<targets.size(); w++)
+    {
+        // A fallback seed may have switched this off for the last waypoint
+        constraints.wrapToJointLimits = wrapToJointLimits;
+
+        // Warm start from the last waypoint that was solved
+        jointValues = solved;
+        results[w] = dampedLeastSquaresIK_chain(jointIndices, jointValues, targets[w], constraints, workspace);
+
+        if(results[w] == RK_SOLVED)
+            solved = jointValues;
+        else
+            result = results[w];
+
+        if((jointValues-previous).cwiseAbs().maxCoeff() > maxJump)
+            jumps.push_back(w);
+
+        trajectory.col(w) = jointValues;
+        previous = jointValues;
+    }
+
+    constraints.wrapToJointLimits = wrapToJointLimits;
+
+    return result;
+}
+
+rk_result_t Robot::dampedLeastSquaresIK_trajectory(const string linkageName, const TRANSFORM_VECTOR& targets,
+                                                   MatrixXd& trajectory, vector<rk_result_t>& results,
+                                                   vector<size_t>& jumps, Constraints& constraints, double maxJump)
+{
+    if(linkage(linkageName).name().compare("invalid")==0)
+        return RK_INVALID_LINKAGE;
+
+    Linkage& chain = linkage(linkageName);
+    vector<size_t> jointIndices(chain.joints_.size());
+    for(size_t i=0; i<chain.joints_.size(); i++)
+        jointIndices[i] = chain.joints_[i]->id();
+
+    constraints.finalTransform = chain.tool().respectToFixed();
+
+    return dampedLeastSquaresIK_trajectory(jointIndices, targets, trajectory, results, jumps, constraints, maxJump);
+}
+
+
+
+
+
+
+
+
+rk_result_t Robot::levenbergMarquardtIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                              const TRANSFORM &target, Constraints& constraints)
+{
+    IKWorkspace workspace(jointIndices.size());
+    return levenbergMarquardtIK_chain(jointIndices, jointValues, target, constraints, workspace);
+}
+
+rk_result_t Robot::levenbergMarquardtIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                              const TRANSFORM &target, Constraints& constraints,
+                                              IKWorkspace& workspace)
+{
+    bool storedImposeLimits = imposeLimits;
+    size_t n = jointIndices.size();
+
+    if(workspace.size() != n)
+        workspace.resize(n);
+
+    vector<Joint*>& pJoints = workspace.joints;
+    for(size_t i=0; i<n; i++)
+        pJoints[i] = joints_[jointIndices[i]];
+
+    Matrix6Xd& J = workspace.J;
+    VectorXd& delta = workspace.delta;
+    VectorXd& stored = workspace.stored;
+    SCREW& err = workspace.err;
+    SCREW& predicted = workspace.predictedErr;
+    SCREW& trialErr = workspace.trialErr;
+    TRANSFORM pose;
+    TRANSLATION Terr;
+    TRANSLATION Rerr;
+
+    double tolerance = constraints.convergenceTolerance;
+    int maxIterations = constraints.maxIterations;
+
+    // Damping on J J^T, so this is the square of the DLS damping constant
+    double lambda = constraints.dampingConstant*constraints.dampingConstant;
+    double lambdaMax = 1e10;
+
+    size_t maxAttempts = 1;
+    if(constraints.useIterativeJacobianSeed)
+        maxAttempts = constraints.maxAttempts;
+
+    workspace.iterations = 0;
+
+    for(size_t attempt=0; attempt<maxAttempts; attempt++)
+    {
+        if(constraints.useIterativeJacobianSeed)
+            constraints.iterativeJacobianSeed(*this, attempt, jointIndices, jointValues);
+
+        lambda = constraints.dampingConstant*constraints.dampingConstant;
+        double nu = 2;
+
+        values(jointIndices, jointValues);
+        for(size_t k=0; k<n; k++)
+            jointValues(k) = joint(jointIndices[k]).value();
+
+        pose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
+        poseError(pose, target, Terr, Rerr);
+
+        // The adaptive damping already limits the step size, so the
+        // translation, rotation and delta clamps are not applied here. A
+        // custom error clamp is part of the error being minimized, so the
+        // cost of every pose, tried or accepted, goes through it.
+        err << Terr, Rerr;
+        if(constraints.customErrorClamp)
+            constraints.errorClamp(*this, jointIndices, err);
+        double cost = err.squaredNorm();
+
+        int iterations = 0;
+        while( (Terr.norm() > tolerance || Rerr.norm() > tolerance)
+               && iterations < maxIterations && lambda < lambdaMax )
+        {
+            iterations++;
+
+            jacobian<Dynamic>(J, pJoints, pose.translation());
+
+            workspace.JJt.noalias() = J*J.transpose();
+            workspace.dampedInverse = (workspace.JJt + lambda*Matrix6d::Identity()).inverse();
+            workspace.dampedErr.noalias() = workspace.dampedInverse*err;
+            delta.noalias() = J.transpose()*workspace.dampedErr;
+
+            // The linear model predicts the error err - J*delta
+            predicted = err;
+            predicted.noalias() -= J*delta;
+            double predictedReduction = cost - predicted.squaredNorm();
+
+            stored = jointValues;
+            jointValues += delta;
+
+            if(constraints.wrapToJointLimits)
+                wrapToJointLimits(*this, jointIndices, jointValues);
+
+            values(jointIndices, jointValues);
+            for(size_t k=0; k<n; k++)
+                jointValues(k) = joint(jointIndices[k]).value();
+
+            TRANSFORM trialPose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
+            TRANSLATION trialTerr, trialRerr;
+            poseError(trialPose, target, trialTerr, trialRerr);
+            trialErr << trialTerr, trialRerr;
+            if(constraints.customErrorClamp)
+                constraints.errorClamp(*this, jointIndices, trialErr);
+            double trialCost = trialErr.squaredNorm();
+
+            double rho = predictedReduction > 0 ? (cost - trialCost)/predictedReduction : -1;
+
+            if(rho > 0)
+            {
+                // Accept, and relax the damping when the model was accurate
+                pose = trialPose;
+                Terr = trialTerr;
+                Rerr = trialRerr;
+                err = trialErr;
+                cost = trialCost;
+
+                double r = 2*rho - 1;
+                lambda *= std::max(1.0/3.0, 1 - r*r*r);
+                nu = 2;
+            }
+            else
+            {
+                // Reject, and stiffen the damping faster each time in a row
+                jointValues = stored;
+                values(jointIndices, jointValues);
+
+                lambda *= nu;
+                nu *= 2;
+            }
+        }
+
+        workspace.iterations += iterations;
+
+        if(constraints.wrapSolutionToJointLimits)
+            wrapToJointLimits(*this, jointIndices, jointValues);
+
+        imposeLimits = storedImposeLimits;
+        values(jointIndices, jointValues);
+
+        pose = joint(jointIndices.back()).respectToRobot()*constraints.finalTransform;
+        poseError(pose, target, Terr, Rerr);
+
+        workspace.damping = sqrt(lambda);
+
+        if(Terr.norm() <= tolerance && Rerr.norm() <= tolerance)
+            return RK_SOLVED;
+    }
+
+    return RK_DIVERGED;
+}
+
+rk_result_t Robot::levenbergMarquardtIK_linkage(const string linkageName, VectorXd &jointValues,
+                                                const TRANSFORM &target, Constraints& constraints)
+{
+    if(linkage(linkageName).name().compare("invalid")==0)
+        return RK_INVALID_LINKAGE;
+
+    Linkage& chain = linkage(linkageName);
+    vector<size_t> jointIndices(chain.joints_.size());
+    for(size_t i=0; i<chain.joints_.size(); i++)
+        jointIndices[i] = chain.joints_[i]->id();
+
+    constraints.finalTransform = chain.tool().respectToFixed();
+
+    if(constraints.useAnalyticalIK && chain.hasAnalyticalIK()
+       && analyticalIK_linkage(linkageName, jointValues, target, TRANSFORM::Identity(),
+                               constraints.convergenceTolerance) == RK_SOLVED)
+        return RK_SOLVED;
+
+    return levenbergMarquardtIK_chain(jointIndices, jointValues, target, constraints);
+}
+
+rk_result_t Robot::boxConstrainedIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                          const TRANSFORM &target, Constraints& constraints)
+{
+    IKWorkspace workspace(jointIndices.size());
+    return boxConstrainedIK_chain(jointIndices, jointValues, target, constraints, workspace);
+}
+
+rk_result_t Robot::boxConstrainedIK_chain(const vector<size_t> &jointIndices, VectorXd &jointValues,
+                                          const TRANSFORM &target, Constraints& constraints,
+                                          IKWorkspace& workspace)
+{
+    bool storedImposeLimits = imposeLimits;
+    bool storedWrapToJointLimits = constraints.wrapToJointLimits;
+    size_t n = jointIndices.size();
+
+    if(workspace.size() != n)
+        workspace.resize(n);
+
+    vector<Joint*>& pJoints = workspace.joints;
+    for(size_t i=0; i<n; i++)
+        pJoints[i] = joints_[jointIndices[i]];
+
+    Matrix6Xd& J = workspace.J;
+    MatrixXd& H = workspace.H;
+    VectorXd& gradient = workspace.gradient;
+    VectorXd& lower = workspace.lower;
+    VectorXd& upper = workspace.upper;
+    VectorXd& delta = workspace.delta;
+    SCREW& err = workspace.err;
+    BoxQP& qp = workspace.qp;
+    TRANSFORM pose;
+    TRANSLATION Terr;
+    TRANSLATION Rerr;
+
+    double tolerance = constraints.convergenceTolerance;
+    int maxIterations = constraints.maxIterations;
+    double damp = constraints.dampingConstant;
+
+    // The QP needs a positive definite Hessian even when J loses rank
+    double regularization = std::max(damp*damp, 1e-12);
+
+    size_t maxAttempts = 1;
+    if(constraints.useIterativeJacobianSeed)
+        maxAttempts = constraints.maxAttempts;
+
+    for(size_t attempt=0; attempt<maxAttempts; attempt++)
+    {
+        if(constraints.useIterativeJacobianSeed && attempt > 0)
+        {
+            // The seeds are fine as starting points, but they do not get to
+            // lift the limits here
+            constraints.iterativeJacobianSeed(*this, attempt, jointIndices, jointValues);
+            imposeLimits = storedImposeLimits;
+            constraints.wrapToJointLimits = storedWrapToJointLimits;
+
+            // A new starting point has nothing to do with the last active set
+            qp.reset();
+        }
+
+        values(jointIndices, jointValues);
+        for(size_t k=0; k<n; k++)
+            jointValues(k) = pJoints[k]->value();
+
+        pose = pJoints.back()->respectToRobot()*constraints.finalTransform;
+        poseError(pose, target, Terr, Rerr);
+
+        int iterations = 0;
+        while( (Terr.norm() > tolerance || Rerr.norm() > tolerance)
+               && iterations < maxIterations )
+        {
+            iterations++;
+
+            if(constraints.performErrorClamp)
+            {
+                clampMag(Terr, constraints.translationClamp);
+                clampMag(Rerr, constraints.rotationClamp);
+            }
+            err << Terr, Rerr;
+
+            if(constraints.customErrorClamp)
+                constraints.errorClamp(*this, jointIndices, err);
+
+            jacobian<Dynamic>(J, pJoints, pose.translation());
+
+            // Damped least squares, 1/2 |J delta - err|^2 + 1/2 damp^2 |delta|^2
+            H.noalias() = J.transpose()*J;
+            H.diagonal().array() += regularization;
+            gradient.noalias() = -J.transpose()*err;
+
+            for(size_t k=0; k<n; k++)
+            {
+                const Joint* joint = pJoints[k];
+                double q = jointValues(k);
+
+                double reach = numeric_limits<double>::infinity();
+                if(constraints.performDeltaClamp)
+                    reach = constraints.deltaClamp;
+                if(constraints.timeStep > 0)
+                    reach = std::min(reach, joint->maxVelocity()*constraints.timeStep);
+
+                lower(k) = std::max(joint->min() - q, -reach);
+                upper(k) = std::min(joint->max() - q, reach);
+
+                // Only possible when the joint starts outside its limits with
+                // imposeLimits off. Head back towards them as fast as allowed.
+                if(lower(k) > upper(k))
+                    lower(k) = upper(k) = q < joint->min() ? reach : -reach;
+            }
+
+            if(qp.solve(H, gradient, lower, upper, delta) == RK_NO_SOLUTION)
+                break;
+
+            // Pinned against the limits with nowhere left to go
+            if(delta.norm() < 1e-3*tolerance)
+                break;
+
+            jointValues += delta;
+            values(jointIndices, jointValues);
+            for(size_t k=0; k<n; k++)
+                jointValues(k) = pJoints[k]->value();
+
+            pose = pJoints.back()->respectToRobot()*constraints.finalTransform;
+            poseError(pose, target, Terr, Rerr);
+        }
+
+        if(Terr.norm() <= tolerance && Rerr.norm() <= tolerance)
+            return RK_SOLVED;
+    }
+
+    return RK_DIVERGED;
+}
+
+rk_result_t Robot::boxConstrainedIK_linkage(const string linkageName, VectorXd &jointValues,
+                                            const TRANSFORM &target, Constraints& constraints)
+{
+    if(linkage(linkageName).name().compare("invalid")==0)
+        return RK_INVALID_LINKAGE;
+
+    Linkage& chain = linkage(linkageName);
+    vector<size_t> jointIndices(chain.joints_.size());
+    for(size_t i=0; i<chain.joints_.size(); i++)
+        jointIndices[i] = chain.joints_[i]->id();
 
+    constraints.finalTransform = chain.tool().respectToFixed();
 
+    return boxConstrainedIK_chain(jointIndices, jointValues, target, constraints);
+}
 
+rk_result_t Robot::analyticalIK_linkage(const string linkageName, VectorXd &jointValues,
+                                        const TRANSFORM &target, const TRANSFORM &finalTF, double tolerance)
+{
+    if(linkage(linkageName).name().compare("invalid")==0)
+        return RK_INVALID_LINKAGE;
+
+    Linkage& chain = linkage(linkageName);
+    if(!chain.hasAnalyticalIK())
+        return RK_SOLVER_NOT_READY;
+
+    if((size_t)jointValues.size() != chain.nJoints())
+    {
+        cerr << "ERROR! Linkage " << linkageName << " has " << chain.nJoints()
+             << " joints but " << jointValues.size() << " values were given!" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // The closed-form solvers work on the tool with respect to the linkage
+    TRANSFORM B = chain.respectToRobot().inverse()*target*finalTF.inverse();
+
+    VectorXd q;
+    if(!chain.analyticalIK(*this, q, B, jointValues))
+        return RK_NO_SOLUTION;
+
+    if(q.size() != jointValues.size() || !q.allFinite())
+        return RK_NO_SOLUTION;
+
+    // Trust the answer only once forward kinematics agrees with it
+    VectorXd stored = chain.values();
+    chain.values(q);
+
+    TRANSLATION Terr, Rerr;
+    poseError(chain.tool().respectToRobot()*finalTF, target, Terr, Rerr);
+    if(Terr.norm() > tolerance || Rerr.norm() > tolerance)
+    {
+        chain.values(stored);
+        return RK_NO_SOLUTION;
+    }
+
+    jointValues = chain.values();
+    return RK_SOLVED;
+}
@@ -0,0 +1,340 @@
+/*
+ -------------------------------------------------------------------------------
+ WholeBodyJacobian.cpp
+ Robot Library Project
+
+ Stacked end effector Jacobians stored as blocks over their ancestor joints.
+
+ Version 1.0
+ -------------------------------------------------------------------------------
+ */
+
+
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "WholeBodyJacobian.h"
+#include "Robot.h"
+#include <iostream>
+#include <algorithm>
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+
+//------------------------------------------------------------------------------
+// WholeBodyJacobian Lifecycle
+//------------------------------------------------------------------------------
+// Constructors
+WholeBodyJacobian::WholeBodyJacobian(Robot& robot)
+    : robot_(robot),
+      rows_(0)
+{
+
+}
+
+// Destructor
+WholeBodyJacobian::~WholeBodyJacobian()
+{
+
+}
+
+
+//------------------------------------------------------------------------------
+// WholeBodyJacobian Public Member Functions
+//------------------------------------------------------------------------------
+rk_result_t WholeBodyJacobian::addJoint(size_t jointIndex)
+{
+    if(jointIndex >= robot_.joints_.size())
+    {
+        cerr << "ERROR! Invalid joint index: (" << jointIndex << ")" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    // The joints above it in its linkage, the joint itself, and everything
+    // its linkage hangs from
+    const Joint* joint = robot_.joints_[jointIndex];
+    vector<size_t> columns;
+    linkageAncestorJoints(joint->linkage_->id(), columns);
+    for(size_t j=0; j<=joint->localID_; j++)
+        columns.push_back(joint->linkage_->joints_[j]->id());
+    sort(columns.begin(), columns.end());
+
+    addTask((int)jointIndex, -1, 6, columns);
+    return RK_SOLVED;
+}
+
+rk_result_t WholeBodyJacobian::addJoint(const string& jointName)
+{
+    map<string, size_t>::const_iterator j = robot_.jointNameToIndex_.find(jointName);
+    if(j == robot_.jointNameToIndex_.end())
+    {
+        cerr << "ERROR! Invalid joint name: (" << jointName << ")" << endl;
+        return RK_INVALID_JOINT;
+    }
+
+    return addJoint(j->second);
+}
+
+rk_result_t WholeBodyJacobian::addTool(size_t linkageIndex)
+{
+    if(linkageIndex >= robot_.linkages_.size())
+    {
+        cerr << "ERROR! Invalid linkage index: (" << linkageIndex << ")" << endl;
+        return RK_INVALID_LINKAGE;
+    }
+
+    const Linkage* linkage = robot_.linkages_[linkageIndex];
+    vector<size_t> columns;
+    linkageAncestorJoints(linkageIndex, columns);
+    for(size_t j=0; j<linkage->joints_.size(); j++)
+        columns.push_back(linkage->joints_[j]->id());
+    sort(columns.begin(), columns.end());
+
+    addTask(-1, (int)linkageIndex, 6, columns);
+    return RK_SOLVED;
+}
+
+rk_result_t WholeBodyJacobian::addTool(const string& linkageName)
+{
+    map<string, size_t>::const_iterator l = robot_.linkageNameToIndex_.find(linkageName);
+    if(l == robot_.linkageNameToIndex_.end())
+    {
+        cerr << "ERROR! Invalid linkage name: (" << linkageName << ")" << endl;
+        return RK_INVALID_LINKAGE;
+    }
+
+    return addTool(l->second);
+}
+
+rk_result_t WholeBodyJacobian::addCenterOfMass()
+{
+    // Every link moves the center of mass, so this block is dense
+    vector<size_t> columns(robot_.joints_.size());
+    for(size_t j=0; j<columns.size(); j++)
+        columns[j] = j;
+
+    addTask(-1, -1, 3, columns);
+    return RK_SOLVED;
+}
+
+void WholeBodyJacobian::clear()
+{
+    taskJoints_.clear();
+    taskLinkages_.clear();
+    taskRows_.clear();
+    taskColumns_.clear();
+    taskBlocks_.clear();
+    shared_.clear();
+    activeJoints_.clear();
+    rows_ = 0;
+}
+
+void WholeBodyJacobian::update(FrameType withRespectTo)
+{
+    // Shared joints first, each computed once no matter how many tasks use it
+    for(size_t k=0; k<activeJoints_.size(); k++)
+    {
+        size_t j = activeJoints_[k];
+        const Joint* joint = robot_.joints_[j];
+        const TRANSFORM& linkageFrame = joint->linkage_->respectToRobot_;
+
+        axes_.col(j) = linkageFrame.linear()*(joint->respectToLinkage_.linear()*joint->jointAxis_);
+        origins_.col(j) = linkageFrame*joint->respectToLinkage_.translation();
+    }
+
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+    {
+        const vector<size_t>& columns = taskColumns_[t];
+        MatrixXd& block = taskBlocks_[t];
+
+        if(taskJoints_[t] < 0 && taskLinkages_[t] < 0)
+        {
+            robot_.centerOfMassJacobian(comJacobian_, ROBOT);
+            block = comJacobian_;
+            continue;
+        }
+
+        TRANSLATION location;
+        if(taskJoints_[t] >= 0)
+        {
+            const Joint* joint = robot_.joints_[taskJoints_[t]];
+            location = joint->linkage_->respectToRobot_*joint->respectToLinkage_.translation();
+        }
+        else
+        {
+            const Linkage* linkage = robot_.linkages_[taskLinkages_[t]];
+            location = linkage->respectToRobot_*linkage->tool_.respectToLinkage_.translation();
+        }
+
+        for(size_t c=0; c<columns.size(); c++)
+        {
+            size_t j = columns[c];
+            JointType type = robot_.joints_[j]->jointType_;
+
+            if(type == REVOLUTE)
+            {
+                block.block<3,1>(0, c) = axes_.col(j).cross(location - origins_.col(j));
+                block.block<3,1>(3, c) = axes_.col(j);
+            }
+            else if(type == PRISMATIC)
+            {
+                block.block<3,1>(0, c) = axes_.col(j);
+                block.block<3,1>(3, c).setZero();
+            }
+            else
+                block.col(c).setZero();
+        }
+    }
+
+    if(withRespectTo != WORLD)
+        return;
+
+    Matrix3d r(robot_.respectToWorld_.linear());
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+    {
+        MatrixXd& block = taskBlocks_[t];
+        for(Index c=0; c<block.cols(); c++)
+            for(Index i=0; i<block.rows(); i+=3)
+                block.block<3,1>(i, c) = r*block.block<3,1>(i, c);
+    }
+}
+
+size_t WholeBodyJacobian::rows() const { return rows_; }
+size_t WholeBodyJacobian::cols() const { return robot_.joints_.size(); }
+
+size_t WholeBodyJacobian::nonZeros() const
+{
+    size_t n = 0;
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+        n += taskBlocks_[t].size();
+    return n;
+}
+
+size_t WholeBodyJacobian::nTasks() const { return taskBlocks_.size(); }
+size_t WholeBodyJacobian::taskRow(size_t task) const { return taskRows_[task]; }
+const vector<size_t>& WholeBodyJacobian::taskColumns(size_t task) const { return taskColumns_[task]; }
+const MatrixXd& WholeBodyJacobian::taskBlock(size_t task) const { return taskBlocks_[task]; }
+
+void WholeBodyJacobian::multiply(const VectorXd& x, VectorXd& y) const
+{
+    y.setZero(rows_);
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+    {
+        const vector<size_t>& columns = taskColumns_[t];
+        const MatrixXd& block = taskBlocks_[t];
+        for(size_t c=0; c<columns.size(); c++)
+            y.segment(taskRows_[t], block.rows()) += block.col(c)*x[columns[c]];
+    }
+}
+
+void WholeBodyJacobian::multiplyTranspose(const VectorXd& y, VectorXd& x) const
+{
+    x.setZero(cols());
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+    {
+        const vector<size_t>& columns = taskColumns_[t];
+        const MatrixXd& block = taskBlocks_[t];
+        for(size_t c=0; c<columns.size(); c++)
+            x[columns[c]] += block.col(c).dot(y.segment(taskRows_[t], block.rows()));
+    }
+}
+
+void WholeBodyJacobian::outerProduct(MatrixXd& JJt) const
+{
+    JJt.setZero(rows_, rows_);
+    for(size_t b=0; b<taskBlocks_.size(); b++)
+    {
+        const MatrixXd& Jb = taskBlocks_[b];
+        for(size_t a=0; a<=b; a++)
+        {
+            const MatrixXd& Ja = taskBlocks_[a];
+            const vector<pair<size_t, size_t> >& shared = shared_[b*(b+1)/2 + a];
+
+            Block<MatrixXd> block = JJt.block(taskRows_[a], taskRows_[b], Ja.rows(), Jb.rows());
+            for(size_t s=0; s<shared.size(); s++)
+                block.noalias() += Ja.col(shared[s].first)*Jb.col(shared[s].second).transpose();
+
+            if(a != b)
+                JJt.block(taskRows_[b], taskRows_[a], Jb.rows(), Ja.rows()) = block.transpose();
+        }
+    }
+}
+
+void WholeBodyJacobian::toDense(MatrixXd& J) const
+{
+    J.setZero(rows_, cols());
+    for(size_t t=0; t<taskBlocks_.size(); t++)
+    {
+        const vector<size_t>& columns = taskColumns_[t];
+        const MatrixXd& block = taskBlocks_[t];
+        for(size_t c=0; c<columns.size(); c++)
+            J.block(taskRows_[t], columns[c], block.rows(), 1) = block.col(c);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// WholeBodyJacobian Protected Member Functions
+//------------------------------------------------------------------------------
+void WholeBodyJacobian::addTask(int jointIndex, int linkageIndex, size_t nRows, const vector<size_t>& columns)
+{
+    size_t b = taskBlocks_.size();
+
+    taskJoints_.push_back(jointIndex);
+    taskLinkages_.push_back(linkageIndex);
+    taskRows_.push_back(rows_);
+    taskColumns_.push_back(columns);
+    taskBlocks_.push_back(MatrixXd::Zero(nRows, columns.size()));
+    rows_ += nRows;
+
+    // Both column lists are sorted, so the shared joints come out of a merge
+    for(size_t a=0; a<=b; a++)
+    {
+        const vector<size_t>& other = taskColumns_[a];
+        vector<pair<size_t, size_t> > shared;
+        size_t i = 0, k = 0;
+        while(i < other.size() && k < columns.size())
+        {
+            if(other[i] < columns[k])
+                i++;
+            else if(columns[k] < other[i])
+                k++;
+            else
+                shared.push_back(make_pair(i++, k++));
+        }
+        shared_.push_back(shared);
+    }
+
+    // Frame tasks need the axes and origins of their joints
+    if(jointIndex >= 0 || linkageIndex >= 0)
+    {
+        vector<size_t> merged;
+        set_union(activeJoints_.begin(), activeJoints_.end(), columns.begin(), columns.end(),
+                  back_inserter(merged));
+        activeJoints_.swap(merged);
+    }
+
+    axes_.setZero(3, robot_.joints_.size());
+    origins_.setZero(3, robot_.joints_.size());
+}
+
+void WholeBodyJacobian::linkageAncestorJoints(size_t linkageIndex, vector<size_t>& columns) const
+{
+    // A child linkage hangs from its parent's tool, so it moves with every
+    // joint of every linkage above it
+    const Linkage* linkage = robot_.linkages_[linkageIndex];
+    while(linkage->hasParent)
+    {
+        linkage = linkage->parentLinkage_;
+        for(size_t j=0; j<linkage->joints_.size(); j++)
+            columns.push_back(linkage->joints_[j]->id());
+    }
+}
@@ -0,0 +1,414 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include "Robot.h"
+#include "Hubo.h"
+
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+void giveMass(Robot& robot);
+bool check(string name, double error, double tolerance);
+void massMatrixFromInverseDynamics(Robot& robot, const VectorXd& q, MatrixXd& M);
+bool inverseDynamicsTest();
+bool massMatrixTest();
+bool forwardDynamicsTest();
+bool centerOfMassJacobianTest();
+bool massCacheTest();
+bool jacobianDerivativeTest();
+bool jointGravityTorqueTest();
+
+
+
+
+
+
+
+int main(int argc, char *argv[])
+{
+    srand(3);
+
+    bool passed = true;
+    passed &= inverseDynamicsTest();
+    passed &= massMatrixTest();
+    passed &= forwardDynamicsTest();
+    passed &= centerOfMassJacobianTest();
+    passed &= massCacheTest();
+    passed &= jacobianDerivativeTest();
+    passed &= jointGravityTorqueTest();
+
+    return passed ? 0 : 1;
+}
+
+
+
+
+
+
+// Hubo comes without mass properties, so make some up
+void giveMass(Robot& robot)
+{
+    for(size_t k=0; k<robot.nJoints(); k++)
+    {
+        Vector3d d = Vector3d::Random().cwiseAbs()*0.02 + Vector3d::Constant(0.005);
+        robot.joint(k).link.setMass(0.5 + rand()%100/50.0, TRANSLATION::Random()*0.1);
+        robot.joint(k).link.setInertiaTensor(d.asDiagonal());
+    }
+
+    for(size_t l=0; l<robot.nLinkages(); l++)
+        robot.linkage(l).tool().massProperties.setMass(0.3 + rand()%10/10.0, TRANSLATION::Random()*0.05);
+}
+
+bool check(string name, double error, double tolerance)
+{
+    bool passed = error < tolerance;
+    cout << (passed ? "PASSED " : "FAILED ") << name << ": " << error << endl;
+    return passed;
+}
+
+void massMatrixFromInverseDynamics(Robot& robot, const VectorXd& q, MatrixXd& M)
+{
+    size_t n = robot.nJoints();
+    VectorXd zero = VectorXd::Zero(n), qdd = VectorXd::Zero(n), g, tau;
+
+    robot.inverseDynamics(q, zero, zero, g);
+    M.resize(n, n);
+    for(size_t j=0; j<n; j++)
+    {
+        qdd[j] = 1;
+        robot.inverseDynamics(q, zero, qdd, tau);
+        M.col(j) = tau - g;
+        qdd[j] = 0;
+    }
+}
+
+bool inverseDynamicsTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Recursive Newton-Euler ID  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n), qd = VectorXd::Random(n), qdd = VectorXd::Random(n);
+    VectorXd zero = VectorXd::Zero(n), tau, g, gravity;
+
+    // At rest only gravity is left
+    hubo.inverseDynamics(q, zero, zero, tau);
+    hubo.gravityJointTorques(gravity);
+    passed &= check("static torques match gravityJointTorques()", (tau - gravity).norm(), 1e-10);
+
+    // The mass matrix read off column by column must be symmetric and
+    // positive definite
+    MatrixXd M;
+    massMatrixFromInverseDynamics(hubo, q, M);
+    passed &= check("mass matrix symmetry", (M - M.transpose()).norm(), 1e-10);
+    bool definite = M.ldlt().vectorD().minCoeff() > 0;
+    cout << (definite ? "PASSED " : "FAILED ") << "mass matrix positive definite" << endl;
+    passed &= definite;
+
+    // Rate of change of kinetic energy is the power of the non-gravity torques
+    double dt = 1e-6;
+    MatrixXd Mplus, Mminus;
+    massMatrixFromInverseDynamics(hubo, q + qd*dt, Mplus);
+    massMatrixFromInverseDynamics(hubo, q - qd*dt, Mminus);
+    VectorXd qdPlus = qd + qdd*dt, qdMinus = qd - qdd*dt;
+    double energyRate = (0.5*qdPlus.dot(Mplus*qdPlus) - 0.5*qdMinus.dot(Mminus*qdMinus))/(2*dt);
+
+    hubo.inverseDynamics(q, zero, zero, g);
+    hubo.inverseDynamics(q, qd, qdd, tau);
+    double power = qd.dot(tau - g);
+    passed &= check("kinetic energy rate matches power", fabs(energyRate - power)/fabs(power), 1e-6);
+
+    // Joint limits do not move the configuration the torques are for
+    VectorXd outside = q + VectorXd::Constant(n, 4.0), limitedTau;
+    hubo.inverseDynamics(outside, qd, qdd, tau);
+    hubo.imposeLimits = true;
+    hubo.inverseDynamics(outside, qd, qdd, limitedTau);
+    passed &= check("imposeLimits does not clamp q", (tau - limitedTau).norm(), 1e-12);
+    passed &= check("q is left in the joints", (hubo.values() - outside).norm(), 1e-15);
+
+    return passed;
+}
+
+bool massMatrixTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Composite Rigid Body M(q)  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n);
+    MatrixXd M, reference;
+    hubo.massMatrix(q, M);
+    massMatrixFromInverseDynamics(hubo, q, reference);
+    passed &= check("CRBA matches inverse dynamics", (M - reference).norm()/reference.norm(), 1e-12);
+
+    // Outside the joint limits, still at the given q
+    MatrixXd limitedM;
+    VectorXd outside = q + VectorXd::Constant(n, 4.0);
+    hubo.massMatrix(outside, reference);
+    hubo.imposeLimits = true;
+    hubo.massMatrix(outside, limitedM);
+    hubo.imposeLimits = false;
+    passed &= check("imposeLimits does not clamp q", (limitedM - reference).norm(), 1e-12);
+
+    // The two legs hang off the base separately
+    Linkage& left = hubo.linkage("LEFT_LEG");
+    Linkage& right = hubo.linkage("RIGHT_LEG");
+    double coupling = M.block(left.joint(0).id(), right.joint(0).id(), left.nJoints(), right.nJoints()).norm();
+    passed &= check("legs are not coupled", coupling, 1e-12);
+
+    MatrixXd L = M;
+    hubo.factorMassMatrix(L);
+    passed &= check("L^T L reproduces M", (L.transpose()*L - M).norm()/M.norm(), 1e-12);
+
+    VectorXd b = VectorXd::Random(n), x = b;
+    hubo.massMatrixSolve(L, x);
+    passed &= check("solve", (M*x - b).norm()/b.norm(), 1e-10);
+
+    MatrixXd Minv;
+    hubo.massMatrixInverse(L, Minv);
+    passed &= check("inverse", (M*Minv - MatrixXd::Identity(n, n)).norm(), 1e-9);
+
+    return passed;
+}
+
+bool forwardDynamicsTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Articulated Body Algorithm |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n), qd = VectorXd::Random(n), qdd = VectorXd::Random(n);
+    VectorXd zero = VectorXd::Zero(n), tau, result;
+
+    hubo.inverseDynamics(q, qd, qdd, tau);
+    hubo.forwardDynamics(q, qd, tau, result);
+    passed &= check("inverse then forward dynamics", (result - qdd).norm()/qdd.norm(), 1e-10);
+
+    // Outside the joint limits, still at the given q
+    VectorXd outside = q + VectorXd::Constant(n, 4.0), limited;
+    hubo.forwardDynamics(outside, qd, tau, result);
+    hubo.imposeLimits = true;
+    hubo.forwardDynamics(outside, qd, tau, limited);
+    hubo.imposeLimits = false;
+    passed &= check("imposeLimits does not clamp q", (limited - result).norm(), 1e-12);
+
+    // Holding against gravity keeps the robot still
+    VectorXd gravity, start = q;
+    qd.setZero();
+    for(int i=0; i<100; i++)
+    {
+        hubo.inverseDynamics(q, zero, zero, gravity);
+        hubo.stepDynamics(q, qd, gravity, 0.001);
+    }
+    passed &= check("gravity compensated robot stays put", (q - start).norm() + qd.norm(), 1e-10);
+
+    return passed;
+}
+
+bool centerOfMassJacobianTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Center of Mass Jacobian    |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n);
+    hubo.values(q);
+
+    Matrix3Xd J, numerical(3, n);
+    hubo.centerOfMassJacobian(J);
+
+    double dq = 1e-6;
+    for(size_t k=0; k<n; k++)
+    {
+        hubo.joint(k).value(q[k] + dq);
+        TRANSLATION plus = hubo.centerOfMass(ROBOT);
+        hubo.joint(k).value(q[k] - dq);
+        TRANSLATION minus = hubo.centerOfMass(ROBOT);
+        hubo.joint(k).value(q[k]);
+        numerical.col(k) = (plus - minus)/(2*dq);
+    }
+    passed &= check("matches finite differences", (J - numerical).norm()/numerical.norm(), 1e-8);
+
+    vector<size_t> legs;
+    Linkage& leg = hubo.linkage("LEFT_LEG");
+    for(size_t j=0; j<leg.nJoints(); j++)
+        legs.push_back(leg.joint(j).id());
+
+    Matrix3Xd Jlegs;
+    hubo.centerOfMassJacobian(legs, Jlegs);
+    double subsetError = 0;
+    for(size_t i=0; i<legs.size(); i++)
+        subsetError += (Jlegs.col(i) - J.col(legs[i])).norm();
+    passed &= check("joint subset", subsetError, 1e-15);
+
+    return passed;
+}
+
+bool massCacheTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Mass Cache Invalidation    |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo, other;
+    giveMass(hubo);
+    giveMass(other);
+
+    bool passed = true;
+
+    // Prime both caches, then change a link of one robot only
+    double massBefore = hubo.mass();
+    double armBefore = hubo.linkage("LEFT_ARM").mass();
+    double otherMass = other.mass();
+    TRANSLATION otherCom = other.centerOfMass(ROBOT);
+
+    Joint& joint = hubo.joint("LEP");
+    double extra = 2.0;
+    joint.link.setMass(joint.link.mass() + extra, joint.link.const_com());
+    passed &= check("setMass reaches the robot", fabs(hubo.mass() - massBefore - extra), 1e-12);
+    passed &= check("setMass reaches the linkage", fabs(hubo.linkage("LEFT_ARM").mass() - armBefore - extra), 1e-12);
+
+    Tool& hand = hubo.linkage("RIGHT_ARM").tool();
+    hand.massProperties.setMass(hand.massProperties.mass() + extra, hand.massProperties.const_com());
+    passed &= check("tool setMass", fabs(hubo.mass() - massBefore - 2*extra), 1e-12);
+
+    hubo.rootLink.setMass(extra, TRANSLATION::Zero());
+    passed &= check("root link setMass", fabs(hubo.mass() - massBefore - 3*extra), 1e-12);
+
+    // Writing through the mutable accessor counts as a change too
+    double total = hubo.mass();
+    TRANSLATION comBefore = hubo.centerOfMass(ROBOT);
+    TRANSLATION shift(0.1, -0.2, 0.05);
+    joint.link.com() += shift;
+    TRANSLATION expected = comBefore + joint.respectToRobot().linear()*shift*joint.link.mass()/total;
+    passed &= check("com() write reaches centerOfMass", (hubo.centerOfMass(ROBOT) - expected).norm(), 1e-12);
+
+    passed &= check("other robot untouched", fabs(other.mass() - otherMass)
+                    + (other.centerOfMass(ROBOT) - otherCom).norm(), 1e-15);
+
+    return passed;
+}
+
+bool jacobianDerivativeTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Jacobian Time Derivative   |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+
+    bool passed = true;
+
+    // Torso and left arm, out to the hand
+    vector<Joint*> chain;
+    chain.push_back(&hubo.joint("TOR"));
+    Linkage& arm = hubo.linkage("LEFT_ARM");
+    for(size_t j=0; j<arm.nJoints(); j++)
+        chain.push_back(&arm.joint(j));
+
+    size_t n = chain.size();
+    VectorXd q = VectorXd::Random(n), qd = VectorXd::Random(n);
+
+    // The hand moves with the chain, so it is looked up at each step
+    Matrix<double, 6, 7> J, Jdot, Jplus, Jminus;
+    double dt = 1e-6;
+    for(size_t k=0; k<n; k++)
+        chain[k]->value(q[k] + qd[k]*dt);
+    hubo.jacobian<7>(Jplus, chain, arm.tool().respectToRobot().translation());
+    for(size_t k=0; k<n; k++)
+        chain[k]->value(q[k] - qd[k]*dt);
+    hubo.jacobian<7>(Jminus, chain, arm.tool().respectToRobot().translation());
+    for(size_t k=0; k<n; k++)
+        chain[k]->value(q[k]);
+
+    TRANSLATION hand = arm.tool().respectToRobot().translation();
+    hubo.jacobianDerivative<7>(J, Jdot, chain, hand, qd, &hubo);
+    passed &= check("matches finite differences", ((Jplus - Jminus)/(2*dt) - Jdot).norm()/Jdot.norm(), 1e-8);
+
+    SCREW JdotQd;
+    hubo.jacobianDerivativeTimesVelocity(JdotQd, chain, hand, qd, &hubo);
+    passed &= check("Jdot*qd shortcut", (JdotQd - Jdot*qd).norm(), 1e-12);
+
+    // The arm frame turns with the torso joint, and Jdot is only rotated into it
+    Matrix<double, 6, 7> Jarm, JdotArm;
+    hubo.jacobianDerivative<7>(Jarm, JdotArm, chain, hand, qd, &arm);
+    Matrix3d r = arm.respectToRobot().linear().transpose();
+    double rotationError = 0;
+    for(size_t i=0; i<n; i++)
+        rotationError += (JdotArm.block<3,1>(0, i) - r*Jdot.block<3,1>(0, i)).norm()
+                       + (JdotArm.block<3,1>(3, i) - r*Jdot.block<3,1>(3, i)).norm();
+    passed &= check("refFrame rotation", rotationError, 1e-12);
+
+    return passed;
+}
+
+bool jointGravityTorqueTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Joint Gravity Torque       |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    giveMass(hubo);
+    hubo.imposeLimits = false;
+    hubo.values(VectorXd::Random(hubo.nJoints()));
+
+    bool passed = true;
+
+    // Each joint on its own agrees with the whole body pass, both ways,
+    // including the joints of the root linkage
+    for(int downstream=1; downstream>=0; downstream--)
+    {
+        VectorXd torques;
+        hubo.gravityJointTorques(torques, downstream);
+
+        double error = 0;
+        for(size_t k=0; k<hubo.nJoints(); k++)
+            error = std::max(error, fabs(hubo.joint(k).gravityTorque(downstream) - torques[k]));
+
+        passed &= check(downstream ? "downstream matches gravityJointTorques()"
+                                   : "upstream matches gravityJointTorques()",
+                        error/torques.cwiseAbs().maxCoeff(), 1e-12);
+    }
+
+    return passed;
+}
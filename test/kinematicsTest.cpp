@@ -0,0 +1,533 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include "Robot.h"
+#include "Hubo.h"
+#include "KinematicModel.h"
+#include "BatchKernels.h"
+#include "Constraints.h"
+#include "WholeBodyJacobian.h"
+
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+void giveMass(Robot& robot);
+bool check(string name, double error, double tolerance);
+double frameError(Robot& a, Robot& b);
+double frameError(const KinematicState& state, Robot& robot);
+bool incrementalFramesTest();
+bool jointLimitSetterTest();
+bool batchKernelTest();
+bool axisTransformTest();
+bool kinematicModelTest();
+bool jacobianTest();
+bool wholeBodyJacobianTest();
+
+
+
+
+
+
+
+int main(int argc, char *argv[])
+{
+    srand(5);
+
+    bool passed = true;
+    passed &= incrementalFramesTest();
+    passed &= jointLimitSetterTest();
+    passed &= batchKernelTest();
+    passed &= axisTransformTest();
+    passed &= kinematicModelTest();
+    passed &= jacobianTest();
+    passed &= wholeBodyJacobianTest();
+
+    return passed ? 0 : 1;
+}
+
+
+
+
+
+
+// Hubo comes without mass properties, so make some up
+void giveMass(Robot& robot)
+{
+    for(size_t k=0; k<robot.nJoints(); k++)
+    {
+        Vector3d d = Vector3d::Random().cwiseAbs()*0.02 + Vector3d::Constant(0.005);
+        robot.joint(k).link.setMass(0.5 + rand()%100/50.0, TRANSLATION::Random()*0.1);
+        robot.joint(k).link.setInertiaTensor(d.asDiagonal());
+    }
+
+    for(size_t l=0; l<robot.nLinkages(); l++)
+        robot.linkage(l).tool().massProperties.setMass(0.3 + rand()%10/10.0, TRANSLATION::Random()*0.05);
+}
+
+bool check(string name, double error, double tolerance)
+{
+    bool passed = error < tolerance;
+    cout << (passed ? "PASSED " : "FAILED ") << name << ": " << error << endl;
+    return passed;
+}
+
+// Largest difference between the joint and tool frames of two robots
+double frameError(Robot& a, Robot& b)
+{
+    double error = 0;
+    for(size_t k=0; k<a.nJoints(); k++)
+        error = std::max(error, (a.joint(k).respectToRobot().matrix()
+                                 - b.joint(k).respectToRobot().matrix()).norm());
+    for(size_t l=0; l<a.nLinkages(); l++)
+        error = std::max(error, (a.linkage(l).tool().respectToRobot().matrix()
+                                 - b.linkage(l).tool().respectToRobot().matrix()).norm());
+    return error;
+}
+
+bool incrementalFramesTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Incremental Frame Updates  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo, reference;
+    hubo.imposeLimits = false;
+    reference.imposeLimits = false;
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    // Writes one joint at a time in random order, so each one only
+    // recomputes the frames downstream of it
+    VectorXd q = VectorXd::Zero(n);
+    for(size_t i=0; i<3*n; i++)
+    {
+        size_t k = rand()%n;
+        q[k] = rand()%100/50.0 - 1;
+        hubo.joint(k).value(q[k]);
+    }
+    reference.values(q);
+    reference.updateFrames();
+    passed &= check("single joint writes", frameError(hubo, reference), 1e-12);
+
+    // Rewriting the same value must leave the frames alone
+    hubo.values(q);
+    passed &= check("unchanged values", frameError(hubo, reference), 1e-12);
+
+    // Deferred writes only mark the linkages, the commit brings them all up
+    // to date in one pass
+    q = VectorXd::Random(n);
+    hubo.deferFrameUpdates();
+    for(size_t k=0; k<n; k++)
+        hubo.joint(n-1-k).value(q[n-1-k]);
+    hubo.commitFrameUpdates();
+    reference.values(q);
+    reference.updateFrames();
+    passed &= check("deferred writes", frameError(hubo, reference), 1e-12);
+
+    // A later full sweep finds nothing left to fix
+    Hubo swept;
+    swept.imposeLimits = false;
+    swept.values(q);
+    hubo.updateFrames();
+    passed &= check("full sweep agrees", frameError(hubo, swept), 1e-12);
+
+    // Linkage writes defer the same way
+    Linkage& arm = hubo.linkage("LEFT_ARM");
+    VectorXd armValues = VectorXd::Random(arm.nJoints());
+    arm.values(armValues);
+    for(size_t j=0; j<arm.nJoints(); j++)
+        q[arm.joint(j).id()] = armValues[j];
+    reference.values(q);
+    passed &= check("linkage writes", frameError(hubo, reference), 1e-12);
+
+    return passed;
+}
+
+bool jointLimitSetterTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Joint Limit Setters        |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo, reference;
+    bool passed = true;
+
+    // Tightening a limit moves the joint, and the frames have to follow
+    Joint& elbow = hubo.joint("LEP");
+    elbow.value(-1.0);
+    elbow.min(-0.5);
+    reference.joint("LEP").value(-0.5);
+    passed &= check("min() clamp moves the frames", frameError(hubo, reference), 1e-12);
+
+    Joint& shoulder = hubo.joint("RSP");
+    shoulder.value(1.0);
+    shoulder.max(0.4);
+    shoulder.value(0.4);
+    reference.joint("RSP").value(0.4);
+    passed &= check("max() clamp then same value", frameError(hubo, reference), 1e-12);
+
+    // Copying a joint into place brings its value and the downstream frames
+    // along
+    reference.joint("LSP").value(0.7);
+    hubo.joint("LSP") = reference.joint("LSP");
+    passed &= check("joint assignment", frameError(hubo, reference), 1e-12);
+
+    return passed;
+}
+
+bool batchKernelTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Batch Forward Kinematics   |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    KinematicModel model(hubo);
+    KinematicState state(model);
+
+    bool passed = true;
+
+    // Odd sizes leave a tail after every vector width
+    const size_t sizes[] = {1, 3, 5, 9, 17};
+    const size_t nSizes = sizeof(sizes)/sizeof(sizes[0]);
+
+    const BatchKernelSet& scalar = *batchKernels(BATCH_SCALAR);
+    AXIS axis = AXIS::Random().normalized();
+    double a[9], b[3];
+    for(int i=0; i<9; i++)
+        a[i] = rand()%100/50.0 - 1;
+    for(int i=0; i<3; i++)
+        b[i] = rand()%100/50.0 - 1;
+
+    for(int set=BATCH_SCALAR+1; set<BATCH_INSTRUCTION_SET_SIZE; set++)
+    {
+        BatchInstructionSet instructionSet = static_cast<BatchInstructionSet>(set);
+        const BatchKernelSet* kernels = batchKernels(instructionSet);
+        if(kernels == NULL)
+        {
+            cout << "SKIPPED " << batchInstructionSetName(instructionSet) << ": not supported here" << endl;
+            continue;
+        }
+
+        double error = 0;
+        for(size_t i=0; i<nSizes; i++)
+        {
+            size_t n = sizes[i];
+            POSE_BATCH start = POSE_BATCH::Random(12, n), expected, result;
+            VectorXd q = VectorXd::Random(n);
+            VectorXd c = q.array().cos(), sn = q.array().sin();
+
+            expected = start; result = start;
+            scalar.constant(expected.data(), n, a, b);
+            kernels->constant(result.data(), n, a, b);
+            error = std::max(error, (expected - result).cwiseAbs().maxCoeff());
+
+            expected = start; result = start;
+            scalar.revolute(expected.data(), n, axis.data(), c.data(), sn.data());
+            kernels->revolute(result.data(), n, axis.data(), c.data(), sn.data());
+            error = std::max(error, (expected - result).cwiseAbs().maxCoeff());
+
+            for(int k=0; k<6; k++)
+            {
+                double sign = k < 3 ? 1.0 : -1.0;
+                expected = start; result = start;
+                scalar.revoluteCoordinate(expected.data(), n, k%3, sign, c.data(), sn.data());
+                kernels->revoluteCoordinate(result.data(), n, k%3, sign, c.data(), sn.data());
+                error = std::max(error, (expected - result).cwiseAbs().maxCoeff());
+            }
+
+            expected = start; result = start;
+            scalar.prismatic(expected.data(), n, axis.data(), q.data());
+            kernels->prismatic(result.data(), n, axis.data(), q.data());
+            error = std::max(error, (expected - result).cwiseAbs().maxCoeff());
+        }
+        passed &= check(string(batchInstructionSetName(instructionSet)) + " matches scalar", error, 1e-12);
+    }
+
+    // The batch over a whole arm, against the Robot one sample at a time
+    size_t armIndex = hubo.linkageIndex("LEFT_ARM");
+    Linkage& arm = hubo.linkage(armIndex);
+    double error = 0;
+    for(size_t i=0; i<nSizes; i++)
+    {
+        MatrixXd configurations = MatrixXd::Random(arm.nJoints(), sizes[i]);
+        POSE_BATCH poses;
+        if(model.forwardKinematicsBatch(state, armIndex, configurations, poses) != RK_SOLVED)
+            error = 1;
+
+        for(size_t s=0; s<sizes[i]; s++)
+        {
+            arm.values(configurations.col(s));
+            error = std::max(error, (KinematicModel::batchPose(poses, s).matrix()
+                                     - arm.tool().respectToRobot().matrix()).norm());
+        }
+    }
+    passed &= check(string(batchInstructionSetName(batchKernels().instructionSet)) + " batch matches Robot", error, 1e-12);
+
+    return passed;
+}
+
+bool axisTransformTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Axis Specialized Joints    |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    bool passed = true;
+
+    AXIS axes[] = { AXIS::UnitX(), AXIS::UnitY(), AXIS::UnitZ(),
+                    -AXIS::UnitX(), -AXIS::UnitY(), -AXIS::UnitZ(),
+                    AXIS(1, 2, -3).normalized() };
+    AxisType types[] = { AXIS_X, AXIS_Y, AXIS_Z,
+                         AXIS_NEGATIVE_X, AXIS_NEGATIVE_Y, AXIS_NEGATIVE_Z,
+                         AXIS_ARBITRARY };
+
+    TRANSFORM respectToFixed = TRANSFORM::Identity();
+    respectToFixed.rotate(Eigen::AngleAxisd(0.7, AXIS(0.3, -1, 0.2).normalized()));
+    respectToFixed.pretranslate(TRANSLATION(0.1, -0.2, 0.3));
+
+    // Every specialized path against the general AngleAxis and Translation
+    // path, for both joint types
+    for(size_t i=0; i<7; i++)
+    {
+        bool classified = classifyAxis(axes[i]) == types[i];
+        cout << (classified ? "PASSED " : "FAILED ") << "classify " << AxisType_to_string(types[i]) << endl;
+        passed &= classified;
+
+        double error = 0;
+        for(int k=0; k<5; k++)
+        {
+            double value = rand()%100/25.0 - 2;
+            TRANSFORM special, general;
+
+            jointTransform(special, respectToFixed, REVOLUTE, types[i], axes[i], value);
+            general = respectToFixed*Eigen::AngleAxisd(value, axes[i]);
+            error = std::max(error, (special.matrix() - general.matrix()).norm());
+
+            jointTransform(special, respectToFixed, PRISMATIC, types[i], axes[i], value);
+            general = respectToFixed*Eigen::Translation3d(value*axes[i]);
+            error = std::max(error, (special.matrix() - general.matrix()).norm());
+        }
+        passed &= check(AxisType_to_string(types[i]) + " matches AngleAxis", error, 1e-14);
+    }
+
+    return passed;
+}
+
+// Largest difference between the frames of a state and those of a robot
+double frameError(const KinematicState& state, Robot& robot)
+{
+    double error = 0;
+    for(size_t k=0; k<robot.nJoints(); k++)
+        error = std::max(error, (state.jointRespectToRobot(k).matrix()
+                                 - robot.joint(k).respectToRobot().matrix()).norm());
+    for(size_t l=0; l<robot.nLinkages(); l++)
+        error = std::max(error, (state.toolRespectToRobot(l).matrix()
+                                 - robot.linkage(l).tool().respectToRobot().matrix()).norm());
+    return error;
+}
+
+bool kinematicModelTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Kinematic Model vs Robot   |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    KinematicModel model(hubo);
+    KinematicState state(model);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n);
+    hubo.values(q);
+    model.values(state, q);
+    passed &= check("forward kinematics", frameError(state, hubo), 1e-12);
+    passed &= check("center of mass", (model.centerOfMass(state) - hubo.centerOfMass()).norm(), 1e-12);
+
+    // A chain write only recomputes what hangs below the chain
+    vector<size_t> jointIndices;
+    model.linkageJointIndices(hubo.linkageIndex("LEFT_ARM"), jointIndices);
+    VectorXd armValues = VectorXd::Random(jointIndices.size());
+    hubo.values(jointIndices, armValues);
+    model.values(state, jointIndices, armValues);
+    passed &= check("chain writes", frameError(state, hubo), 1e-12);
+
+    KinematicState swept(state);
+    model.updateFrames(swept);
+    double error = 0;
+    for(size_t k=0; k<n; k++)
+        error = std::max(error, (swept.jointRespectToRobot(k).matrix()
+                                 - state.jointRespectToRobot(k).matrix()).norm());
+    passed &= check("full sweep agrees", error, 1e-12);
+
+    // Both solvers run the same iteration, so from the same start they land
+    // on the same answer
+    VectorXd start = VectorXd::Zero(jointIndices.size());
+    start[3] = -0.8;
+    VectorXd goal = start + 0.3*VectorXd::Random(jointIndices.size());
+    hubo.values(jointIndices, goal);
+    TRANSFORM target = hubo.joint(jointIndices.back()).respectToRobot();
+
+    Constraints constraints;
+    constraints.useIterativeJacobianSeed = false;
+
+    VectorXd robotSolution = start, modelSolution = start;
+    hubo.values(jointIndices, start);
+    model.values(state, jointIndices, start);
+    rk_result_t robotResult = hubo.dampedLeastSquaresIK_chain(jointIndices, robotSolution, target, constraints);
+    rk_result_t modelResult = model.dampedLeastSquaresIK_chain(state, jointIndices, modelSolution, target, constraints);
+
+    bool solved = robotResult == RK_SOLVED && modelResult == RK_SOLVED;
+    cout << (solved ? "PASSED " : "FAILED ") << "both solve: " << rk_result_to_string(robotResult)
+         << ", " << rk_result_to_string(modelResult) << endl;
+    passed &= solved;
+    passed &= check("same solution", (robotSolution - modelSolution).norm(), 1e-9);
+    passed &= check("same frames after IK", frameError(state, hubo), 1e-9);
+
+    return passed;
+}
+
+bool jacobianTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Jacobians vs Differences   |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    // The torso joint and the left arm, so columns come from two linkages
+    Linkage& arm = hubo.linkage("LEFT_ARM");
+    vector<Joint*> joints(1, &hubo.linkage("TORSO").joint(0));
+    for(size_t j=0; j<arm.nJoints(); j++)
+        joints.push_back(&arm.joint(j));
+    size_t n = joints.size();
+
+    for(size_t k=0; k<n; k++)
+        joints[k]->value(0.5*(rand()%100/50.0 - 1));
+    joints[4]->value(-0.8);
+
+    // Central differences of the tool pose in robot coordinates
+    const double h = 1e-6;
+    Matrix<double, 6, 7> expected;
+    TRANSLATION location = arm.tool().respectToRobot().translation();
+    for(size_t k=0; k<n; k++)
+    {
+        double value = joints[k]->value();
+        joints[k]->value(value + h);
+        TRANSFORM ahead = arm.tool().respectToRobot();
+        joints[k]->value(value - h);
+        TRANSFORM behind = arm.tool().respectToRobot();
+        joints[k]->value(value);
+
+        AngleAxisd turn(ahead.rotation()*behind.rotation().transpose());
+        expected.block<3,1>(0, k) = (ahead.translation() - behind.translation())/(2*h);
+        expected.block<3,1>(3, k) = turn.angle()*turn.axis()/(2*h);
+    }
+
+    MatrixXd J;
+    hubo.jacobian(J, joints, location, &hubo);
+    passed &= check("robot frame", (J - expected).norm(), 1e-7);
+
+    Matrix<double, 6, 7> fixed;
+    hubo.jacobian<7>(fixed, joints, location);
+    passed &= check("fixed size", (fixed - expected).norm(), 1e-7);
+
+    // Rotated into the turned torso joint one block at a time
+    Matrix3d r = joints[0]->respectToRobot().rotation().transpose();
+    Matrix6Xd rotated;
+    hubo.jacobian<Dynamic>(rotated, joints, location, joints[0]);
+    double error = 0;
+    for(size_t k=0; k<n; k++)
+        error += (rotated.block<3,1>(0, k) - r*expected.block<3,1>(0, k)).norm()
+                 + (rotated.block<3,1>(3, k) - r*expected.block<3,1>(3, k)).norm();
+    passed &= check("reference frame", error, 1e-7);
+
+    // The linkage kernel takes the location in linkage coordinates
+    Matrix6Xd armJ;
+    arm.jacobian(armJ, arm.respectToRobot().inverse()*location, &hubo);
+    passed &= check("linkage", (armJ - expected.rightCols<6>()).norm(), 1e-7);
+
+    return passed;
+}
+
+bool wholeBodyJacobianTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Whole Body Jacobian        |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    VectorXd q = VectorXd::Random(n);
+    hubo.values(q);
+
+    const char* tools[] = {"LEFT_ARM", "RIGHT_ARM", "LEFT_LEG", "RIGHT_LEG"};
+    WholeBodyJacobian wbj(hubo);
+    for(size_t t=0; t<4; t++)
+        wbj.addTool(tools[t]);
+    wbj.addCenterOfMass();
+    wbj.update();
+
+    MatrixXd J;
+    wbj.toDense(J);
+
+    // Every column from finite differences, zero wherever a joint does not
+    // move the end effector
+    MatrixXd numerical(wbj.rows(), n);
+    double dq = 1e-6;
+    for(size_t k=0; k<n; k++)
+    {
+        TRANSFORM plus[4], minus[4];
+        hubo.joint(k).value(q[k] + dq);
+        for(size_t t=0; t<4; t++)
+            plus[t] = hubo.linkage(tools[t]).tool().respectToRobot();
+        TRANSLATION comPlus = hubo.centerOfMass(ROBOT);
+        hubo.joint(k).value(q[k] - dq);
+        for(size_t t=0; t<4; t++)
+            minus[t] = hubo.linkage(tools[t]).tool().respectToRobot();
+        TRANSLATION comMinus = hubo.centerOfMass(ROBOT);
+        hubo.joint(k).value(q[k]);
+
+        for(size_t t=0; t<4; t++)
+        {
+            Matrix3d dR = plus[t].linear()*minus[t].linear().transpose();
+            numerical.block<3,1>(6*t, k) = (plus[t].translation() - minus[t].translation())/(2*dq);
+            numerical.block<3,1>(6*t+3, k) = Vector3d(dR(2,1) - dR(1,2), dR(0,2) - dR(2,0), dR(1,0) - dR(0,1))/(4*dq);
+        }
+        numerical.block<3,1>(24, k) = (comPlus - comMinus)/(2*dq);
+    }
+    passed &= check("matches finite differences", (J - numerical).norm()/numerical.norm(), 1e-8);
+
+    cout << "Stored " << wbj.nonZeros() << " of " << J.size() << " entries" << endl;
+
+    VectorXd x = VectorXd::Random(n), y = VectorXd::Random(wbj.rows()), Jx, Jty;
+    MatrixXd JJt;
+    wbj.multiply(x, Jx);
+    wbj.multiplyTranspose(y, Jty);
+    wbj.outerProduct(JJt);
+    passed &= check("J*x", (Jx - J*x).norm(), 1e-12);
+    passed &= check("J^T*y", (Jty - J.transpose()*y).norm(), 1e-12);
+    passed &= check("J*J^T", (JJt - J*J.transpose()).norm(), 1e-12);
+
+    return passed;
+}
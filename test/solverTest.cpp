@@ -0,0 +1,830 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <atomic>
+#include "Robot.h"
+#include "Hubo.h"
+#include "IKWorkspace.h"
+#include "ParallelIK.h"
+#include "HierarchicalIK.h"
+#include "BoxQP.h"
+
+
+
+//------------------------------------------------------------------------------
+// Namespaces
+//------------------------------------------------------------------------------
+using namespace std;
+using namespace Eigen;
+using namespace RobotKin;
+
+
+// Written against the original nullSpaceTask() signature
+class CountingConstraints : public Constraints
+{
+public:
+    CountingConstraints() : calls(0) { }
+
+    VectorXd nullSpaceTask(Robot& robot, const std::vector<size_t>& indices,
+                           const VectorXd& values, VectorXd& nullTask)
+    {
+        calls++;
+        return Constraints::nullSpaceTask(robot, indices, values, nullTask);
+    }
+
+    size_t calls;
+};
+
+// Overrides the allocation-free overload instead
+class WorkspaceCountingConstraints : public Constraints
+{
+public:
+    WorkspaceCountingConstraints() : calls(0) { }
+
+    void nullSpaceTask(Robot& robot, const std::vector<size_t>& indices,
+                       const VectorXd& values, VectorXd& nullTask, const IKWorkspace& workspace)
+    {
+        calls++;
+        restingValuesTask(values, nullTask);
+    }
+
+    size_t calls;
+};
+
+// Counts the error clamps each solver path asks for
+class ClampCountingConstraints : public Constraints
+{
+public:
+    ClampCountingConstraints(bool modelOverride) : robotCalls(0), modelCalls(0), modelOverride_(modelOverride)
+    {
+        customErrorClamp = true;
+    }
+
+    void errorClamp(Robot& robot, const std::vector<size_t>& indices, SCREW& error)
+    {
+        robotCalls++;
+    }
+
+    void errorClamp(const KinematicModel& model, const KinematicState& state,
+                    const std::vector<size_t>& indices, SCREW& error) const
+    {
+        if(modelOverride_)
+            modelCalls++;
+        else
+            Constraints::errorClamp(model, state, indices, error);
+    }
+
+    size_t robotCalls;
+    mutable std::atomic<size_t> modelCalls;
+
+protected:
+    bool modelOverride_;
+};
+
+void giveMass(Robot& robot);
+bool check(string name, double error, double tolerance);
+bool checkResult(string name, rk_result_t result, rk_result_t expected);
+bool checkResult(string name, rk_result_t result, rk_result_t expected)
+{
+    bool passed = result == expected;
+    cout << (passed ? "PASSED " : "FAILED ") << name << ": " << rk_result_to_string(result) << endl;
+    return passed;
+}
+
+void armChain(Robot& robot, string linkageName, vector<size_t>& jointIndices);
+TRANSFORM reachableTarget(Robot& robot, const vector<size_t>& jointIndices, VectorXd& start);
+bool missingAnalyticalIK(Robot& robot, VectorXd& q, const TRANSFORM& B, const VectorXd& qPrev);
+bool nullSpaceTaskTest();
+bool levenbergMarquardtTest();
+bool parallelIKTest();
+bool analyticalIKTest();
+bool huboBranchIKTest();
+bool fixedSizeIKTest();
+bool trajectoryIKTest();
+bool constraintHooksTest();
+bool hierarchicalIKTest();
+bool boxConstrainedIKTest();
+
+
+
+
+
+
+
+int main(int argc, char *argv[])
+{
+    srand(7);
+
+    bool passed = true;
+    passed &= nullSpaceTaskTest();
+    passed &= levenbergMarquardtTest();
+    passed &= parallelIKTest();
+    passed &= analyticalIKTest();
+    passed &= huboBranchIKTest();
+    passed &= fixedSizeIKTest();
+    passed &= trajectoryIKTest();
+    passed &= constraintHooksTest();
+    passed &= hierarchicalIKTest();
+    passed &= boxConstrainedIKTest();
+
+    return passed ? 0 : 1;
+}
+
+
+
+
+
+
+// Hubo comes without mass properties, so make some up
+void giveMass(Robot& robot)
+{
+    for(size_t k=0; k<robot.nJoints(); k++)
+    {
+        Vector3d d = Vector3d::Random().cwiseAbs()*0.02 + Vector3d::Constant(0.005);
+        robot.joint(k).link.setMass(0.5 + rand()%100/50.0, TRANSLATION::Random()*0.1);
+        robot.joint(k).link.setInertiaTensor(d.asDiagonal());
+    }
+
+    for(size_t l=0; l<robot.nLinkages(); l++)
+        robot.linkage(l).tool().massProperties.setMass(0.3 + rand()%10/10.0, TRANSLATION::Random()*0.05);
+}
+
+bool check(string name, double error, double tolerance)
+{
+    bool passed = error < tolerance;
+    cout << (passed ? "PASSED " : "FAILED ") << name << ": " << error << endl;
+    return passed;
+}
+
+void armChain(Robot& robot, string linkageName, vector<size_t>& jointIndices)
+{
+    Linkage& arm = robot.linkage(linkageName);
+    jointIndices.resize(arm.nJoints());
+    for(size_t j=0; j<arm.nJoints(); j++)
+        jointIndices[j] = arm.joint(j).id();
+}
+
+// A target that some nearby configuration reaches. The elbow stays bent so
+// the target is away from the edge of the workspace. start gets a
+// configuration close to the answer.
+TRANSFORM reachableTarget(Robot& robot, const vector<size_t>& jointIndices, VectorXd& start)
+{
+    size_t n = jointIndices.size();
+    VectorXd goal(n);
+    start.resize(n);
+    for(size_t j=0; j<n; j++)
+    {
+        start[j] = 0.3*(rand()%100/50.0 - 1);
+        goal[j] = start[j] + 0.3*(rand()%100/50.0 - 1);
+    }
+    start[3] = -0.8;
+    goal[3] = -1.0;
+
+    robot.values(jointIndices, goal);
+    TRANSFORM target = robot.joint(jointIndices.back()).respectToRobot();
+    robot.values(jointIndices, start);
+
+    return target;
+}
+
+// A closed form that claims success but lands somewhere else
+bool missingAnalyticalIK(Robot&, VectorXd& q, const TRANSFORM&, const VectorXd& qPrev)
+{
+    q = qPrev.array() + 0.3;
+    return true;
+}
+
+bool nullSpaceTaskTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Null Space Task Overrides  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    vector<size_t> jointIndices;
+    armChain(hubo, "LEFT_ARM", jointIndices);
+
+    VectorXd q;
+    TRANSFORM target = reachableTarget(hubo, jointIndices, q);
+
+    CountingConstraints constraints;
+    constraints.restingValues(VectorXd::Zero(jointIndices.size()));
+    IKWorkspace workspace(jointIndices.size());
+
+    hubo.dampedLeastSquaresIK_chain(jointIndices, q, target, constraints, workspace);
+    bool called = constraints.calls > 0;
+    cout << (called ? "PASSED " : "FAILED ") << "override of the copying signature is called ("
+         << constraints.calls << " times)" << endl;
+    bool passed = called;
+
+    // Subclasses that leave nullSpaceTask() alone keep the resting values
+    // task, and so does one that overrides the workspace overload
+    Constraints plain;
+    ClampCountingConstraints clampOnly(true);
+    WorkspaceCountingConstraints inPlace;
+    plain.useIterativeJacobianSeed = false;
+    clampOnly.useIterativeJacobianSeed = false;
+    inPlace.useIterativeJacobianSeed = false;
+    VectorXd resting = VectorXd::Constant(jointIndices.size(), 0.1);
+    plain.restingValues(resting);
+    clampOnly.restingValues(resting);
+    inPlace.restingValues(resting);
+
+    VectorXd start = q;
+    TRANSFORM moved = target;
+    moved.pretranslate(TRANSLATION(0.02, 0, 0));
+    VectorXd plainSolution = start, clampOnlySolution = start, inPlaceSolution = start;
+    hubo.values(jointIndices, start);
+    hubo.dampedLeastSquaresIK_chain(jointIndices, plainSolution, moved, plain, workspace);
+    hubo.values(jointIndices, start);
+    hubo.dampedLeastSquaresIK_chain(jointIndices, clampOnlySolution, moved, clampOnly, workspace);
+    hubo.values(jointIndices, start);
+    hubo.dampedLeastSquaresIK_chain(jointIndices, inPlaceSolution, moved, inPlace, workspace);
+
+    passed &= check("subclass without an override", (clampOnlySolution - plainSolution).norm(), 1e-12);
+    passed &= check("override of the workspace signature is called", inPlace.calls > 0 ? 0 : 1, 0.5);
+    passed &= check("workspace override", (inPlaceSolution - plainSolution).norm(), 1e-12);
+
+    return passed;
+}
+
+bool levenbergMarquardtTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Levenberg-Marquardt IK     |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    vector<size_t> jointIndices;
+    armChain(hubo, "LEFT_ARM", jointIndices);
+    size_t n = jointIndices.size();
+
+    Constraints constraints;
+    constraints.useIterativeJacobianSeed = false;
+    IKWorkspace workspace(n);
+
+    VectorXd q;
+    TRANSFORM target = reachableTarget(hubo, jointIndices, q);
+    rk_result_t result = hubo.levenbergMarquardtIK_chain(jointIndices, q, target, constraints, workspace);
+    passed &= checkResult("reachable target", result, RK_SOLVED);
+
+    TRANSFORM reached = hubo.joint(jointIndices.back()).respectToRobot();
+    passed &= check("pose error", (reached.translation() - target.translation()).norm()
+                    + AngleAxisd(reached.rotation().transpose()*target.rotation()).angle(),
+                    2*constraints.convergenceTolerance);
+    cout << "(" << workspace.iterations << " iterations)" << endl;
+
+    // Out of reach the steps stop paying off, so the damping climbs until
+    // the solver gives up, well before running out of iterations
+    VectorXd start;
+    target = reachableTarget(hubo, jointIndices, start);
+    target.pretranslate(TRANSLATION(2, 0, 0));
+    q = start;
+    result = hubo.levenbergMarquardtIK_chain(jointIndices, q, target, constraints, workspace);
+    passed &= checkResult("unreachable target", result, RK_DIVERGED);
+    passed &= check("damping reached its ceiling", std::max(0.0, 1e5 - workspace.damping), 1e-6);
+    passed &= check("stopped early", workspace.iterations/(double)constraints.maxIterations, 1);
+
+    // The best it found is no worse than where it started
+    TRANSFORM closest = hubo.joint(jointIndices.back()).respectToRobot();
+    hubo.values(jointIndices, start);
+    TRANSFORM initial = hubo.joint(jointIndices.back()).respectToRobot();
+    passed &= check("unreachable target got closer",
+                    std::max(0.0, (closest.translation() - target.translation()).norm()
+                                  - (initial.translation() - target.translation()).norm()), 1e-12);
+
+    return passed;
+}
+
+bool parallelIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Parallel IK Pool           |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    vector<size_t> jointIndices;
+    armChain(hubo, "LEFT_ARM", jointIndices);
+
+    VectorXd q;
+    TRANSFORM target = reachableTarget(hubo, jointIndices, q);
+
+    KinematicModel model(hubo);
+    KinematicState state(model);
+    model.values(state, jointIndices, q);
+
+    // Plenty of attempts, so returning at all relies on the first success
+    // cancelling the rest
+    Constraints constraints;
+    constraints.maxAttempts = 1000;
+
+    ParallelIK pool(model, 4);
+    rk_result_t result = pool.dampedLeastSquaresIK_chain(state, jointIndices, q, target, constraints);
+    passed &= checkResult("reachable target", result, RK_SOLVED);
+    passed &= check("cancelled the remaining attempts", pool.attemptsStarted()/(double)constraints.maxAttempts, 0.05);
+
+    const TRANSFORM& reached = state.jointRespectToRobot(jointIndices.back());
+    passed &= check("state holds the solution", (reached.translation() - target.translation()).norm()
+                    + AngleAxisd(reached.rotation().transpose()*target.rotation()).angle(),
+                    2*constraints.convergenceTolerance);
+
+    // Out of reach every attempt runs, and the closest one comes back
+    target.pretranslate(TRANSLATION(2, 0, 0));
+    constraints.maxAttempts = 12;
+    result = pool.dampedLeastSquaresIK_chain(state, jointIndices, q, target, constraints);
+    passed &= checkResult("unreachable target", result, RK_DIVERGED);
+    passed &= check("closest attempt kept", pool.lastAttempt() >= 0 ? pool.lastError() : 1e10, 1e3);
+
+    // Every random seed gets its own values for each joint
+    KinematicState seeded(model);
+    VectorXd first(jointIndices.size()), second(jointIndices.size());
+    constraints.iterativeJacobianSeed(model, seeded, 3, jointIndices, first);
+    constraints.iterativeJacobianSeed(model, seeded, 4, jointIndices, second);
+    double spread = (first.array() - first[0]).abs().maxCoeff();
+    passed &= check("one draw per joint", spread > 0 ? 0 : 1, 0.5);
+    passed &= check("new draw per attempt", (first - second).norm() > 0 ? 0 : 1, 0.5);
+
+    return passed;
+}
+
+bool analyticalIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Analytical IK Fallback     |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo* hubo = new Hubo;
+    bool passed = true;
+
+    vector<size_t> jointIndices;
+    armChain(*hubo, "LEFT_ARM", jointIndices);
+    Linkage& arm = hubo->linkage("LEFT_ARM");
+
+    // Well inside the limits the Hubo closed form enforces
+    VectorXd q, start(6), goal(6);
+    start << 0, 0, 0, -0.8, 0, 0;
+    goal << 0.2, 0.1, -0.1, -1.0, 0.1, 0.2;
+    hubo->values(jointIndices, goal);
+    TRANSFORM target = arm.tool().respectToRobot();
+    hubo->values(jointIndices, start);
+
+    Constraints constraints;
+    constraints.useIterativeJacobianSeed = false;
+
+    // The Hubo closed form
+    q = start;
+    passed &= checkResult("closed form", hubo->analyticalIK_linkage("LEFT_ARM", q, target), RK_SOLVED);
+    passed &= check("closed form answer", (q - goal).norm(), 1e-6);
+
+    // A closed form that misses is caught by forward kinematics, leaves the
+    // joints alone, and the iterative solver takes over
+    hubo->values(jointIndices, start);
+    arm.analyticalIK = missingAnalyticalIK;
+    q = start;
+    passed &= checkResult("missed closed form", hubo->analyticalIK_linkage("LEFT_ARM", q, target), RK_NO_SOLUTION);
+    passed &= check("joints left alone", (arm.values() - start).norm(), 1e-15);
+    passed &= checkResult("falls back to damped least squares",
+                          hubo->dampedLeastSquaresIK_linkage("LEFT_ARM", q, target, constraints), RK_SOLVED);
+
+    // A copy of a Hubo linkage outlives the Hubo. Its solver is handed the
+    // robot it runs on, which is not a Hubo, so it declines.
+    Linkage copied = hubo->linkage("RIGHT_ARM");
+    delete hubo;
+
+    Robot robot;
+    robot.addLinkage(copied, -1, "ARM");
+    vector<size_t> armIndices;
+    armChain(robot, "ARM", armIndices);
+    target = reachableTarget(robot, armIndices, start);
+    target = target*robot.linkage("ARM").tool().respectToFixed();
+    q = start;
+    passed &= checkResult("copied closed form declines", robot.analyticalIK_linkage("ARM", q, target), RK_NO_SOLUTION);
+    passed &= checkResult("copy falls back", robot.dampedLeastSquaresIK_linkage("ARM", q, target, constraints), RK_SOLVED);
+
+    return passed;
+}
+
+bool huboBranchIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Hubo Closed Form Branches  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    // Wide limits, so every branch is allowed and qPrev alone picks one
+    MatrixX2d wide(6, 2);
+    wide.col(0).setConstant(-M_PI);
+    wide.col(1).setConstant(M_PI);
+    hubo.leftArmLimits = wide;
+    hubo.rightArmLimits = wide;
+    hubo.leftLegLimits = wide;
+    hubo.rightLegLimits = wide;
+
+    string names[4] = { "LEFT_ARM", "RIGHT_ARM", "LEFT_LEG", "RIGHT_LEG" };
+    SCREW goals[4], prevs[4];
+    goals[0] << 0.2, 0.1, -0.1, -1.0, 0.1, 0.2;
+    goals[1] << -0.3, -0.2, 0.4, -0.7, -0.2, 0.3;
+    goals[2] << 0.1, -0.05, -0.4, 0.8, -0.4, 0.05;
+    goals[3] << -0.1, 0.05, -0.3, 0.6, -0.3, -0.05;
+    prevs[1].setZero();
+    prevs[2] << 2, 0, 2, 0, 2, 0;
+    prevs[3] << -2, 2, -2, 2, -2, 2;
+
+    // The arm branches picked by the scalar implementation
+    SCREW expected[2][4];
+    expected[0][0] = goals[0];
+    expected[0][1] = goals[0];
+    expected[0][2] << 0.2, 0.1, 3.0415926535897935, 1.0, -3.0415926535897935, 0.2;
+    expected[0][3] << -2.9415926535897938, 2.4415926535897938, -0.1, 1.0, -3.0415926535897935, 0.2;
+    expected[1][0] = goals[1];
+    expected[1][1] = goals[1];
+    expected[1][2] << -0.3, -0.2, -2.7415926535897923, 0.7, 2.9415926535897929, 0.3;
+    expected[1][3] = expected[1][2];
+
+    for(int limb=0; limb<4; limb++)
+    {
+        size_t side = limb%2 == 0 ? SIDE_LEFT : SIDE_RIGHT;
+        bool arm = limb < 2;
+        Linkage& linkage = hubo.linkage(names[limb]);
+        linkage.values(goals[limb]);
+        TRANSFORM B = linkage.respectToRobot().inverse()*linkage.tool().respectToRobot();
+        prevs[0] = goals[limb];
+
+        for(int p=0; p<4; p++)
+        {
+            VectorXd q;
+            bool within = arm ? hubo.armAnalyticalIK(q, B, prevs[p], side)
+                              : hubo.legAnalyticalIK(q, B, prevs[p], side);
+            passed &= check(names[limb] + " branch within limits", within ? 0 : 1, 0.5);
+
+            TRANSFORM reached;
+            if(arm)
+                hubo.armFK(reached, q, side);
+            else
+                hubo.legFK(reached, q, side);
+            passed &= check(names[limb] + " branch reaches B", (reached.matrix() - B.matrix()).norm(), 1e-9);
+
+            if(arm)
+                passed &= check(names[limb] + " branch matches", (q - expected[limb][p]).norm(), 1e-9);
+            else if(p == 0)
+                passed &= check(names[limb] + " keeps the previous branch", (q - goals[limb]).norm(), 1e-9);
+        }
+    }
+
+    return passed;
+}
+
+bool fixedSizeIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Fixed Size DLS IK          |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    Constraints constraints;
+    constraints.useIterativeJacobianSeed = false;
+
+    // The left arm, and the same arm behind the torso joint
+    vector<size_t> arm, body(1, hubo.linkage("TORSO").joint(0).id());
+    armChain(hubo, "LEFT_ARM", arm);
+    body.insert(body.end(), arm.begin(), arm.end());
+
+    VectorXd armStart(6), armGoal(6), bodyStart(7), bodyGoal(7);
+    armStart << 0, 0, 0, -0.8, 0, 0;
+    armGoal << 0.2, 0.1, -0.1, -1.0, 0.1, 0.2;
+    bodyStart << 0, armStart;
+    bodyGoal << 0.3, armGoal;
+
+    for(int c=0; c<2; c++)
+    {
+        const vector<size_t>& jointIndices = c == 0 ? arm : body;
+        const VectorXd& start = c == 0 ? armStart : bodyStart;
+        string name = c == 0 ? "6 joints" : "7 joints";
+        IKWorkspace workspace(jointIndices.size());
+
+        hubo.values(jointIndices, c == 0 ? armGoal : bodyGoal);
+        TRANSFORM target = hubo.joint(jointIndices.back()).respectToRobot();
+
+        VectorXd fixed = start, dynamic = start, dispatched = start;
+        hubo.values(jointIndices, start);
+        rk_result_t fixedResult = c == 0
+                ? hubo.dampedLeastSquaresIK_chain<6>(jointIndices, fixed, target, constraints, workspace)
+                : hubo.dampedLeastSquaresIK_chain<7>(jointIndices, fixed, target, constraints, workspace);
+
+        hubo.values(jointIndices, start);
+        rk_result_t dynamicResult = hubo.dampedLeastSquaresIK_chain<Dynamic>(jointIndices, dynamic, target,
+                                                                             constraints, workspace);
+
+        hubo.values(jointIndices, start);
+        hubo.dampedLeastSquaresIK_chain(jointIndices, dispatched, target, constraints, workspace);
+
+        passed &= checkResult(name + " fixed size", fixedResult, RK_SOLVED);
+        passed &= checkResult(name + " dynamic size", dynamicResult, RK_SOLVED);
+        passed &= check(name + " same solution", (fixed - dynamic).norm(), 1e-9);
+        passed &= check(name + " dispatched to fixed size", (dispatched - fixed).norm(), 1e-15);
+    }
+
+    return passed;
+}
+
+bool trajectoryIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Trajectory IK              |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    vector<size_t> jointIndices;
+    armChain(hubo, "LEFT_ARM", jointIndices);
+
+    Constraints constraints;
+    constraints.useIterativeJacobianSeed = false;
+
+    // Small steps along the path, then one that swings the shoulder, then
+    // one out of reach
+    VectorXd start(6), step(6);
+    start << 0, 0, 0, -0.8, 0, 0;
+    step << 0.04, 0.02, -0.02, -0.04, 0.02, 0.04;
+    MatrixXd path(6, 6);
+    for(int w=0; w<4; w++)
+        path.col(w) = start + (w+1)*step;
+    path.col(4) = path.col(3);
+    path(0, 4) += 0.6;
+    path.col(5) = path.col(4);
+
+    TRANSFORM_VECTOR targets(path.cols());
+    for(int w=0; w<path.cols(); w++)
+    {
+        hubo.values(jointIndices, path.col(w));
+        targets[w] = hubo.joint(jointIndices.back()).respectToRobot();
+    }
+    targets[5].pretranslate(TRANSLATION(2, 0, 0));
+    hubo.values(jointIndices, start);
+
+    MatrixXd trajectory;
+    vector<rk_result_t> results;
+    vector<size_t> jumps;
+    rk_result_t result = hubo.dampedLeastSquaresIK_trajectory(jointIndices, targets, trajectory, results,
+                                                              jumps, constraints, 0.4);
+    passed &= checkResult("whole path", result, RK_DIVERGED);
+    for(int w=0; w<5; w++)
+        passed &= checkResult("waypoint " + to_string(w), results[w], RK_SOLVED);
+    passed &= checkResult("waypoint 5", results[5], RK_DIVERGED);
+    passed &= check("follows the path", (trajectory.leftCols(5) - path.leftCols(5)).norm(), 1e-2);
+
+    // Each waypoint starts where the last solved one ended
+    double error = 0;
+    VectorXd from = start;
+    for(int w=0; w<6; w++)
+    {
+        VectorXd q = from;
+        hubo.dampedLeastSquaresIK_chain(jointIndices, q, targets[w], constraints);
+        error += (q - trajectory.col(w)).norm();
+        if(results[w] == RK_SOLVED)
+            from = q;
+    }
+    passed &= check("warm started", error, 1e-12);
+
+    // Along the solved part only the shoulder swing moves further than
+    // maxJump. The closest miss of the last waypoint may land anywhere.
+    bool flagged = jumps.size() >= 1 && jumps[0] == 4 && (jumps.size() == 1 || jumps[1] == 5);
+    cout << (flagged ? "PASSED " : "FAILED ") << "jump at waypoint 4 (" << jumps.size() << " jumps)" << endl;
+    passed &= flagged;
+
+    return passed;
+}
+
+bool constraintHooksTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Constraint Hook Overloads  |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    bool passed = true;
+
+    vector<size_t> jointIndices;
+    armChain(hubo, "LEFT_ARM", jointIndices);
+
+    VectorXd start(6), goal(6);
+    start << 0, 0, 0, -0.8, 0, 0;
+    goal << 0.2, 0.1, -0.1, -1.0, 0.1, 0.2;
+    hubo.values(jointIndices, goal);
+    TRANSFORM target = hubo.joint(jointIndices.back()).respectToRobot();
+    hubo.values(jointIndices, start);
+
+    KinematicModel model(hubo);
+    KinematicState state(model);
+
+    // Each path reaches its own overload
+    ClampCountingConstraints both(true);
+    both.useIterativeJacobianSeed = false;
+    VectorXd q = start;
+    hubo.dampedLeastSquaresIK_chain(jointIndices, q, target, both);
+    passed &= check("Robot path calls the Robot overload", both.robotCalls > 0 ? 0 : 1, 0.5);
+
+    size_t robotCalls = both.robotCalls;
+    q = start;
+    model.values(state, jointIndices, start);
+    model.dampedLeastSquaresIK_chain(state, jointIndices, q, target, both);
+    passed &= check("model path calls the model overload", both.modelCalls > 0 ? 0 : 1, 0.5);
+    passed &= check("model path skips the Robot overload", both.robotCalls - robotCalls, 0.5);
+
+    size_t modelCalls = both.modelCalls;
+    ParallelIK pool(model, 2);
+    q = start;
+    model.values(state, jointIndices, start);
+    pool.dampedLeastSquaresIK_chain(state, jointIndices, q, target, both);
+    passed &= check("parallel path calls the model overload", both.modelCalls > modelCalls ? 0 : 1, 0.5);
+
+    // Overriding only the Robot overload leaves the model path unclamped,
+    // as Constraints.h says
+    ClampCountingConstraints robotOnly(false);
+    robotOnly.useIterativeJacobianSeed = false;
+    q = start;
+    model.values(state, jointIndices, start);
+    model.dampedLeastSquaresIK_chain(state, jointIndices, q, target, robotOnly);
+    passed &= check("Robot override not reached from the model", robotOnly.robotCalls + robotOnly.modelCalls, 0.5);
+
+    return passed;
+}
+
+bool hierarchicalIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Hierarchical Whole Body IK |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    Hubo hubo;
+    hubo.imposeLimits = false;
+    giveMass(hubo);
+
+    size_t n = hubo.nJoints();
+    bool passed = true;
+
+    // Every target comes from another configuration of the upper body, so
+    // the whole stack can be met. Bent elbows keep the arms off the edge of
+    // their workspace.
+    VectorXd q = VectorXd::Random(n)*0.3, goal = q;
+    Linkage& arm = hubo.linkage("LEFT_ARM");
+    Linkage& otherArm = hubo.linkage("RIGHT_ARM");
+    q[hubo.joint("LEP").id()] = q[hubo.joint("REP").id()] = -0.8;
+    goal[hubo.joint("TOR").id()] += 0.2;
+    for(size_t j=0; j<arm.nJoints(); j++)
+    {
+        goal[arm.joint(j).id()] = q[arm.joint(j).id()] + 0.2*(rand()%100/50.0 - 1);
+        goal[otherArm.joint(j).id()] = q[otherArm.joint(j).id()] + 0.2*(rand()%100/50.0 - 1);
+    }
+
+    hubo.values(goal);
+    TRANSLATION com = hubo.centerOfMass(ROBOT);
+    TRANSLATION hand = arm.tool().respectToRobot().translation();
+    hubo.values(q);
+
+    Constraints constraints;
+    constraints.wrapToJointLimits = false;
+
+    // Feet stay put, then the center of mass moves over the support, then
+    // the left hand reaches, and whatever freedom is left goes to posture
+    TRANSFORM leftFoot = hubo.linkage("LEFT_LEG").tool().respectToRobot();
+    TRANSFORM rightFoot = hubo.linkage("RIGHT_LEG").tool().respectToRobot();
+
+    HierarchicalIK ik(hubo);
+    ik.addPoseTask("LEFT_LEG", leftFoot);
+    ik.addPoseTask("RIGHT_LEG", rightFoot);
+    ik.addCenterOfMassTask(com, true);
+    ik.addPositionTask("LEFT_ARM", hand);
+    ik.addPostureTask(VectorXd::Zero(n));
+
+    rk_result_t result = ik.solve(q, constraints);
+    cout << (result == RK_SOLVED ? "PASSED " : "FAILED ") << "reachable stack: " << rk_result_to_string(result) << endl;
+    passed &= result == RK_SOLVED;
+    passed &= check("feet held", (hubo.linkage("LEFT_LEG").tool().respectToRobot().matrix() - leftFoot.matrix()).norm()
+                    + (hubo.linkage("RIGHT_LEG").tool().respectToRobot().matrix() - rightFoot.matrix()).norm(), 1e-3);
+    passed &= check("center of mass", (hubo.centerOfMass(ROBOT) - com).head<2>().norm(), 1e-3);
+    passed &= check("hand", (arm.tool().respectToRobot().translation() - hand).norm(), 1e-3);
+
+    // Out of reach, the hand gets as close as it can without giving up the
+    // tasks above it
+    ik.target(3, TRANSLATION(hand + TRANSLATION(2, 0, 0)));
+    result = ik.solve(q, constraints);
+    cout << (result == RK_CONVERGED ? "PASSED " : "FAILED ") << "unreachable hand: " << rk_result_to_string(result) << endl;
+    passed &= result == RK_CONVERGED;
+    passed &= check("feet still held", ik.taskError(0) + ik.taskError(1), 1e-3);
+    passed &= check("center of mass still held", ik.taskError(2), 1e-3);
+
+    return passed;
+}
+
+bool boxConstrainedIKTest()
+{
+    cout << "--------------------------------------" << endl;
+    cout << "| Testing Box Constrained IK         |" << endl;
+    cout << "--------------------------------------" << endl;
+
+    bool passed = true;
+
+    // The QP answer has to satisfy the KKT conditions: no gradient along a
+    // free variable, and the gradient of a held one pushing out of the box
+    size_t m = 6;
+    MatrixXd A = MatrixXd::Random(m + 2, m);
+    MatrixXd H = A.transpose()*A + 0.01*MatrixXd::Identity(m, m);
+    VectorXd g = VectorXd::Random(m), x;
+    VectorXd lower = -VectorXd::Random(m).cwiseAbs()*0.5, upper = VectorXd::Random(m).cwiseAbs()*0.5;
+
+    BoxQP qp(m);
+    rk_result_t result = qp.solve(H, g, lower, upper, x);
+    VectorXd gradient = H*x + g;
+    double kkt = 0;
+    for(size_t i=0; i<m; i++)
+    {
+        if(qp.bound(i) < 0)
+            kkt += std::max(0.0, -gradient[i]) + fabs(x[i] - lower[i]);
+        else if(qp.bound(i) > 0)
+            kkt += std::max(0.0, gradient[i]) + fabs(x[i] - upper[i]);
+        else
+            kkt += fabs(gradient[i]) + std::max(0.0, lower[i] - x[i]) + std::max(0.0, x[i] - upper[i]);
+    }
+    passed &= result == RK_SOLVED;
+    passed &= check("QP optimality", kkt, 1e-9);
+    cout << "(" << qp.nActive() << " of " << m << " bounds active)" << endl;
+
+    qp.solve(H, g, lower, upper, x);
+    passed &= check("warm started QP iterations", qp.iterations(), 0.5);
+
+    // The target needs the left elbow almost straight, right next to its
+    // limit. The joints do not clamp themselves, so any step past a limit
+    // would show up in the solution.
+    Hubo hubo;
+    hubo.imposeLimits = false;
+
+    Linkage& arm = hubo.linkage("LEFT_ARM");
+    size_t n = arm.nJoints();
+    vector<size_t> jointIndices(n);
+    VectorXd q(n), goal(n);
+    for(size_t j=0; j<n; j++)
+    {
+        jointIndices[j] = arm.joint(j).id();
+        q[j] = 0.3*(rand()%100/50.0 - 1);
+        goal[j] = q[j] + 0.3*(rand()%100/50.0 - 1);
+    }
+    size_t elbow = hubo.joint("LEP").localID();
+    q[elbow] = -1.0;
+    goal[elbow] = 0.0;
+
+    hubo.values(jointIndices, goal);
+    TRANSFORM target = arm.tool().respectToRobot();
+    hubo.values(jointIndices, q);
+
+    Constraints constraints;
+    constraints.finalTransform = arm.tool().respectToFixed();
+    IKWorkspace workspace(n);
+
+    VectorXd start = q;
+    result = hubo.boxConstrainedIK_chain(jointIndices, q, target, constraints, workspace);
+    cout << (result == RK_SOLVED ? "PASSED " : "FAILED ") << "near a limit: " << rk_result_to_string(result) << endl;
+    passed &= result == RK_SOLVED;
+
+    double violation = 0;
+    for(size_t j=0; j<n; j++)
+        violation += std::max(0.0, arm.joint(j).min() - q[j]) + std::max(0.0, q[j] - arm.joint(j).max());
+    passed &= check("solution within limits", violation, 1e-12);
+
+    // Out of reach, it gives up without ever leaving the limits
+    q = start;
+    target.translate(TRANSLATION(2, 0, 0));
+    result = hubo.boxConstrainedIK_chain(jointIndices, q, target, constraints, workspace);
+    cout << (result == RK_DIVERGED ? "PASSED " : "FAILED ") << "out of reach: " << rk_result_to_string(result) << endl;
+    passed &= result == RK_DIVERGED;
+
+    violation = 0;
+    for(size_t j=0; j<n; j++)
+        violation += std::max(0.0, arm.joint(j).min() - q[j]) + std::max(0.0, q[j] - arm.joint(j).max());
+    passed &= check("unreachable target within limits", violation, 1e-12);
+
+    // One iteration moves no joint faster than its velocity limit
+    for(size_t j=0; j<n; j++)
+        arm.joint(j).maxVelocity(1.0);
+    constraints.timeStep = 0.01;
+    constraints.maxIterations = 1;
+    constraints.useIterativeJacobianSeed = false;
+
+    q = start;
+    hubo.boxConstrainedIK_chain(jointIndices, q, target, constraints, workspace);
+    passed &= check("velocity limited step", std::max(0.0, (q - start).cwiseAbs().maxCoeff() - 0.01), 1e-12);
+
+    return passed;
+}